@@ -97,6 +97,7 @@ public:
     static auto GetThemeMusicEnable() -> bool;
     static auto GetLanguage() -> long;
     static auto GetTextScrollSpeed() -> long;
+    static auto GetDownloadCacheSize() -> long;
 
     static auto GetNszCompressLevel() -> u8;
     static auto GetNszThreadCount() -> u8;
@@ -308,6 +309,7 @@ public:
     option::OptionString m_left_menu{INI_SECTION, "left_side_menu", "FileBrowser"};
     option::OptionString m_right_menu{INI_SECTION, "right_side_menu", "Appstore"};
     option::OptionBool m_progress_boost_mode{INI_SECTION, "progress_boost_mode", true};
+    option::OptionLong m_download_cache_size{INI_SECTION, "download_cache_size", 256}; // MiB, 0 = unlimited.
 
     // install options
     option::OptionBool m_install_sysmmc{INI_SECTION, "install_sysmmc", false};
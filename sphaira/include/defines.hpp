@@ -554,6 +554,15 @@ enum class SphairaResult : Result {
 
     MmzBadLocalHeaderSig,
     MmzBadLocalHeaderRead,
+    // entry can't be extracted without the central directory.
+    MmzUnsupportedEntry,
+    MmzBadCrc32,
+    MmzFailedInflate,
+    MmzTruncated,
+    MmzBadEndRecord,
+    MmzBadFileHeader,
+    // local header doesn't match the central directory.
+    MmzCentralMismatch,
 
     FileBrowserFailedUpload,
     FileBrowserDirNotDaybreak,
@@ -561,6 +570,7 @@ enum class SphairaResult : Result {
     AppstoreFailedZipDownload,
     AppstoreFailedMd5,
     AppstoreFailedParseManifest,
+    AppstoreFailedDeltaDownload,
 
     GameBadReadForDump,
     GameEmptyMetaEntries,
@@ -730,11 +740,19 @@ enum : Result {
     MAKE_SPHAIRA_RESULT_ENUM(ZipWriteInFileInZip),
     MAKE_SPHAIRA_RESULT_ENUM(MmzBadLocalHeaderSig),
     MAKE_SPHAIRA_RESULT_ENUM(MmzBadLocalHeaderRead),
+    MAKE_SPHAIRA_RESULT_ENUM(MmzUnsupportedEntry),
+    MAKE_SPHAIRA_RESULT_ENUM(MmzBadCrc32),
+    MAKE_SPHAIRA_RESULT_ENUM(MmzFailedInflate),
+    MAKE_SPHAIRA_RESULT_ENUM(MmzTruncated),
+    MAKE_SPHAIRA_RESULT_ENUM(MmzBadEndRecord),
+    MAKE_SPHAIRA_RESULT_ENUM(MmzBadFileHeader),
+    MAKE_SPHAIRA_RESULT_ENUM(MmzCentralMismatch),
     MAKE_SPHAIRA_RESULT_ENUM(FileBrowserFailedUpload),
     MAKE_SPHAIRA_RESULT_ENUM(FileBrowserDirNotDaybreak),
     MAKE_SPHAIRA_RESULT_ENUM(AppstoreFailedZipDownload),
     MAKE_SPHAIRA_RESULT_ENUM(AppstoreFailedMd5),
     MAKE_SPHAIRA_RESULT_ENUM(AppstoreFailedParseManifest),
+    MAKE_SPHAIRA_RESULT_ENUM(AppstoreFailedDeltaDownload),
     MAKE_SPHAIRA_RESULT_ENUM(GameBadReadForDump),
     MAKE_SPHAIRA_RESULT_ENUM(GameEmptyMetaEntries),
     MAKE_SPHAIRA_RESULT_ENUM(GameMultipleKeysFound),
@@ -6,8 +6,11 @@
 #include <functional>
 #include <unordered_map>
 #include <algorithm>
+#include <memory>
+#include <atomic>
 #include <stop_token>
 #include <switch.h>
+#include <curl/curl.h>
 
 namespace sphaira::curl {
 
@@ -21,6 +24,12 @@ enum {
 
     // sets CURLOPT_NOBODY.
     Flag_NoBody = 1 << 1,
+
+    // large downloads are split into ranged segments that are downloaded
+    // in parallel, and resumed from where they left off if interrupted.
+    // falls back to a normal download if the server doesn't support ranges.
+    // this api is only available on sync downloading to file.
+    Flag_Resume = 1 << 2,
 };
 
 enum class Priority {
@@ -28,6 +37,54 @@ enum class Priority {
     High, // gets pushed to the front of the queue
 };
 
+// shared with an async request so that it can be cancelled, or have its
+// priority changed, whilst it is queued or in progress.
+// the request is not cancelled when the handle is destroyed.
+struct AsyncHandle {
+    AsyncHandle() = default;
+
+    static auto Create() -> AsyncHandle {
+        AsyncHandle handle;
+        handle.m_state = std::make_shared<State>();
+        return handle;
+    }
+
+    // drops the request from the queue, or aborts it if it has started.
+    // OnComplete is not called for a cancelled request.
+    void Cancel() {
+        if (m_state) {
+            m_state->cancelled = true;
+        }
+    }
+
+    // takes effect if the request has not yet started.
+    void SetPriority(Priority prio) {
+        if (m_state) {
+            m_state->prio = prio;
+        }
+    }
+
+    auto IsValid() const -> bool {
+        return m_state != nullptr;
+    }
+
+    auto IsCancelled() const -> bool {
+        return m_state && m_state->cancelled;
+    }
+
+    auto GetPriority() const -> Priority {
+        return m_state ? m_state->prio.load() : Priority::High;
+    }
+
+private:
+    struct State {
+        std::atomic_bool cancelled{};
+        std::atomic<Priority> prio{Priority::High};
+    };
+
+    std::shared_ptr<State> m_state{};
+};
+
 struct Api;
 struct ApiResult;
 
@@ -36,6 +93,9 @@ using OnComplete = std::function<void(ApiResult& result)>;
 using OnProgress = std::function<bool(s64 dltotal, s64 dlnow, s64 ultotal, s64 ulnow)>;
 using OnUploadCallback = std::function<size_t(void *ptr, size_t size)>;
 using OnUploadSeek = std::function<bool(s64 offset)>;
+// receives the data as it is downloaded, rather than it being stored in memory.
+// return false to abort the download.
+using OnDownloadData = std::function<bool(const void* data, size_t size)>;
 using StopToken = std::stop_token;
 
 struct Url {
@@ -62,6 +122,23 @@ struct Header {
     }
 };
 
+// requests part of the file rather than the whole file.
+// if off is negative, the last size bytes of the file are requested.
+// the result code is 206 if the server sent the range, 200 if it sent the whole file.
+struct Range {
+    Range() = default;
+    Range(s64 off, s64 size) : m_off{off}, m_size{size} {}
+    s64 m_off{};
+    s64 m_size{};
+};
+
+// limits the download speed in bytes per second, 0 is unlimited.
+struct MaxSpeed {
+    MaxSpeed() = default;
+    MaxSpeed(s64 bytes) : m_bytes{bytes} {}
+    s64 m_bytes{};
+};
+
 struct Flags {
     Flags() = default;
     Flags(u32 flags) : m_flags{flags} {}
@@ -129,6 +206,8 @@ struct DownloadEventData {
     OnComplete callback;
     ApiResult result;
     StopToken stoken;
+    // checked again on dispatch, as the request may be cancelled after it completed.
+    AsyncHandle handle;
 };
 
 // helper that generates the api using an location.
@@ -159,6 +238,19 @@ auto FromFileAsync(const Api& e) -> bool;
 // uses curl to convert string to their %XX
 auto EscapeString(const std::string& str) -> std::string;
 
+// returns the process wide share handle, this shares the connection cache,
+// tls sessions and dns cache between every handle that sets it.
+auto GetShareHandle() -> CURLSH*;
+
+// returns an idle easy handle that was last used for the same scheme/host/port,
+// or a new handle if none are idle.
+// NOTE: the handle should set CURLOPT_SHARE to the above for connection reuse.
+auto PoolAcquire(const std::string& url) -> CURL*;
+
+// resets the handle and returns it to the idle pool.
+// the oldest idle handle is cleaned up if the pool is full.
+void PoolRelease(const std::string& url, CURL* curl);
+
 struct Api {
     Api() = default;
 
@@ -290,6 +382,8 @@ struct Api {
     auto& GetFields() const { return m_fields.m_str; }
     auto& GetHeader() const { return m_header; }
     auto& GetFlags() const { return m_flags.m_flags; }
+    auto& GetRange() const { return m_range; }
+    auto& GetMaxSpeed() const { return m_max_speed.m_bytes; }
     auto& GetPath() const { return m_path; }
     auto& GetPort() const { return m_port.m_port; }
     auto& GetCustomRequest() const { return m_custom_request.m_str; }
@@ -301,13 +395,20 @@ struct Api {
     auto& GetOnComplete() const { return m_on_complete; }
     auto& GetOnProgress() const { return m_on_progress; }
     auto& GetOnUploadSeek() const { return m_on_upload_seek; }
+    auto& GetOnDownloadData() const { return m_on_download_data; }
     auto& GetPriority() const { return m_prio; }
     auto& GetToken() const { return m_stoken; }
+    auto& GetHandle() const { return m_handle; }
+
+    // true if either the stop token or the handle has been cancelled.
+    auto IsStopped() const { return m_stoken.stop_requested() || m_handle.IsCancelled(); }
 
     void SetOption(Url&& v) { m_url = v; }
     void SetOption(Fields&& v) { m_fields = v; }
     void SetOption(Header&& v) { m_header = v; }
     void SetOption(Flags&& v) { m_flags = v; }
+    void SetOption(Range&& v) { m_range = v; }
+    void SetOption(MaxSpeed&& v) { m_max_speed = v; }
     void SetOption(Path&& v) { m_path = v; }
     void SetOption(Port&& v) { m_port = v; }
     void SetOption(CustomRequest&& v) { m_custom_request = v; }
@@ -319,8 +420,10 @@ struct Api {
     void SetOption(OnComplete&& v) { m_on_complete = v; }
     void SetOption(OnProgress&& v) { m_on_progress = v; }
     void SetOption(OnUploadSeek&& v) { m_on_upload_seek = v; }
+    void SetOption(OnDownloadData&& v) { m_on_download_data = v; }
     void SetOption(Priority&& v) { m_prio = v; }
     void SetOption(StopToken&& v) { m_stoken = v; }
+    void SetOption(AsyncHandle&& v) { m_handle = v; }
 
     template <typename T>
     void set_option(T&& t) {
@@ -338,6 +441,8 @@ private:
     Fields m_fields{};
     Header m_header{};
     Flags m_flags{};
+    Range m_range{};
+    MaxSpeed m_max_speed{};
     Path m_path{};
     Port m_port{};
     CustomRequest m_custom_request{};
@@ -349,9 +454,11 @@ private:
     OnComplete m_on_complete{};
     OnProgress m_on_progress{};
     OnUploadSeek m_on_upload_seek{};
+    OnDownloadData m_on_download_data{};
     Priority m_prio{Priority::High};
     std::stop_source m_stop_source{};
     StopToken m_stoken{m_stop_source.get_token()};
+    AsyncHandle m_handle{};
     bool m_is_upload{};
 };
 
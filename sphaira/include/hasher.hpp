@@ -23,8 +23,17 @@ struct BaseSource {
     virtual Result Read(void* buf, s64 off, s64 size, u64* bytes_read) = 0;
 };
 
+// incremental hash, for when the data arrives in chunks.
+struct HashSource {
+    virtual ~HashSource() = default;
+    virtual void Update(const void* buf, s64 size, s64 file_size) = 0;
+    virtual void Get(std::string& out) = 0;
+};
+
 auto GetTypeStr(Type type) -> const char*;
 
+auto Create(Type type) -> std::unique_ptr<HashSource>;
+
 // returns the hash string.
 Result Hash(ui::ProgressBox* pbox, Type type, BaseSource* source, std::string& out);
 Result Hash(ui::ProgressBox* pbox, Type type, fs::Fs* fs, const fs::FsPath& path, std::string& out);
@@ -2,13 +2,51 @@
 
 #include <vector>
 #include <span>
+#include <deque>
+#include <functional>
 #include <switch.h>
+#include "nanovg.h"
 #include "fs.hpp"
 
 namespace sphaira {
 
+// pixel buffer allocated with malloc, so that the output of a decoder can be
+// taken over rather than copied into a new buffer.
+struct ImageBuffer {
+    ImageBuffer() = default;
+    explicit ImageBuffer(size_t size);
+    ~ImageBuffer();
+
+    ImageBuffer(ImageBuffer&& other) noexcept;
+    ImageBuffer& operator=(ImageBuffer&& other) noexcept;
+    ImageBuffer(const ImageBuffer&) = delete;
+    ImageBuffer& operator=(const ImageBuffer&) = delete;
+
+    // takes ownership of data, which must have been allocated with malloc.
+    static auto Adopt(void* data, size_t size) -> ImageBuffer;
+
+    // on failure the buffer is freed, so check empty() after.
+    void resize(size_t size);
+    void clear();
+
+    auto data() -> u8* { return m_data; }
+    auto data() const -> const u8* { return m_data; }
+    auto size() const -> size_t { return m_size; }
+    auto empty() const -> bool { return !m_size; }
+    auto begin() const -> const u8* { return m_data; }
+    auto end() const -> const u8* { return m_data + m_size; }
+
+    operator std::span<const u8>() const {
+        return {m_data, m_size};
+    }
+
+private:
+    u8* m_data{};
+    size_t m_size{};
+};
+
 struct ImageResult {
-    std::vector<u8> data;
+    ImageBuffer data;
     int w, h;
 };
 
@@ -18,9 +56,58 @@ enum ImageFlag {
     ImageFlag_JPEG = 1 << 0,
 };
 
-auto ImageLoadFromMemory(std::span<const u8> data, u32 flags = ImageFlag_None) -> ImageResult;
-auto ImageLoadFromFile(const fs::FsPath& file, u32 flags = ImageFlag_None) -> ImageResult;
-auto ImageResize(std::span<const u8> data, int inx, int iny, int outx, int outy) -> ImageResult;
+// if max_size is set, the image is scaled down whilst loading so that neither
+// side is larger than max_size, which avoids keeping a full size copy around.
+// jpegs with an exif thumbnail at least max_size large load the thumbnail instead.
+auto ImageLoadFromMemory(std::span<const u8> data, u32 flags = ImageFlag_None, int max_size = 0) -> ImageResult;
+auto ImageLoadFromFile(const fs::FsPath& file, u32 flags = ImageFlag_None, int max_size = 0) -> ImageResult;
+// pitch is the size of an input row in bytes, 0 if the rows are packed.
+auto ImageResize(std::span<const u8> data, int inx, int iny, int outx, int outy, int pitch = 0) -> ImageResult;
+// scales the image down so that neither side is larger than max_size.
+// large downscales are halved in place first, so only the final size is allocated.
+auto ImageScaleToFit(ImageResult&& image, int max_size) -> ImageResult;
 auto ImageConvertToJpg(std::span<const u8> data, int x, int y) -> ImageResult;
 
+// decodes images on worker threads, so that the ui thread only has to do the
+// upload, which is limited to a time budget per frame.
+// the most recent request is decoded first, as it's the most likely to be on screen.
+struct ImageDecoder {
+    // called on a worker thread to load and decode the image.
+    using Loader = std::function<ImageResult()>;
+    // called on the ui thread once uploaded, image is 0 if it failed to load.
+    using OnLoaded = std::function<void(int image, const ImageResult& result)>;
+
+    static constexpr u64 UPLOAD_BUDGET_NS = 3'000'000; // 3ms
+    static constexpr u32 MAX_THREADS = 2;
+
+    ImageDecoder() = default;
+    ~ImageDecoder();
+
+    void Push(Loader&& loader, OnLoaded&& on_loaded);
+    // drops every request, on_loaded is not called for dropped requests.
+    void Clear();
+    // uploads decoded images until the budget is used up, call once per frame.
+    void Upload(NVGcontext* vg, u64 budget_ns = UPLOAD_BUDGET_NS);
+
+private:
+    struct Request {
+        Loader loader;
+        OnLoaded on_loaded;
+        ImageResult result;
+        u32 generation;
+    };
+
+    static void thread_func(void* arg);
+    void Start();
+
+    Mutex m_mutex{};
+    CondVar m_can_decode{};
+    std::deque<Request> m_pending{};
+    std::deque<Request> m_done{};
+    Thread m_threads[MAX_THREADS]{};
+    u32 m_thread_count{};
+    u32 m_generation{};
+    bool m_exit{};
+};
+
 } // namespace sphaira
@@ -3,6 +3,7 @@
 #include <minizip/ioapi.h>
 #include <vector>
 #include <span>
+#include <functional>
 #include <switch.h>
 #include "fs.hpp"
 
@@ -29,4 +30,95 @@ void FileFuncNative(zlib_filefunc64_def* funcs);
 // which takes 1-2ms.
 Result PeekFirstFileName(fs::Fs* fs, const fs::FsPath& path, fs::FsPath& name);
 
+// entry in the central directory of a zip.
+struct CentralEntry {
+    fs::FsPath name;
+    u32 crc32;
+    u32 compressed_size;
+    u32 uncompressed_size;
+    s64 offset; // offset of the local header.
+};
+
+// finds the end record in the tail of a zip, which should be at least
+// END_RECORD_SEARCH_SIZE bytes, returns where the central directory is.
+// fails with Result_MmzUnsupportedEntry for zip64.
+constexpr s64 END_RECORD_SEARCH_SIZE = 0x16 + 0xFFFF;
+Result FindCentralDirectory(std::span<const u8> tail, s64& offset, s64& size);
+// parses the central directory, entries are in the order they appear in the directory.
+Result ParseCentralDirectory(std::span<const u8> data, std::vector<CentralEntry>& out);
+
+// extracts a zip as it is received, driven by the local headers rather than
+// the central directory, so the zip never has to be stored.
+// entries that can't be streamed (encrypted, zip64 or stored with a data descriptor)
+// fail with Result_MmzUnsupportedEntry, the zip then has to be extracted using the
+// central directory instead.
+struct StreamUnzip {
+    // set extract to false to skip the entry, size is 0 if not known in advance.
+    using OnEntry = std::function<Result(const fs::FsPath& name, s64 size, bool& extract)>;
+    // called with the uncompressed data of the entry being extracted.
+    using OnData = std::function<Result(const void* data, s64 size)>;
+    // called once the entry has been extracted and its crc32 matched.
+    using OnEntryDone = std::function<Result(void)>;
+
+    StreamUnzip(const OnEntry& on_entry, const OnData& on_data, const OnEntryDone& on_done);
+    ~StreamUnzip();
+
+    // feeds the next chunk of the zip.
+    Result Push(const void* data, s64 size);
+    // fails if the zip ended part way through an entry.
+    Result Finish();
+    // for zips that are fetched as ranges of whole entries, fails if the
+    // range ended part way through an entry, the next range can then be pushed.
+    Result EndRange();
+    // if set, every entry must be in the central directory with a matching
+    // crc32 and sizes, for ranges that may come from a different version of the zip.
+    // the entries must outlive the unzip, or be cleared.
+    void SetCentralDirectory(std::span<const CentralEntry> entries);
+
+private:
+    enum class State {
+        LocalHeader,
+        Name,
+        Data,
+        Descriptor,
+        Done,
+    };
+
+    // buffers data until want bytes are available, returns true once they are.
+    auto Take(const u8*& data, s64& size, s64 want) -> bool;
+    Result ParseLocalHeader();
+    Result StartEntry();
+    Result ReadData(const u8*& data, s64& size);
+    Result EndData();
+    Result EndEntry(u32 crc32, u32 compressed_size, u32 uncompressed_size);
+    Result CheckCentral(u32 crc32, u32 compressed_size, u32 uncompressed_size) const;
+    Result Write(const void* data, s64 size);
+
+    const OnEntry m_on_entry;
+    const OnData m_on_data;
+    const OnEntryDone m_on_done;
+
+    State m_state{State::LocalHeader};
+    std::vector<u8> m_buf{};
+    std::vector<u8> m_out{};
+    z_stream m_zs{};
+    bool m_zs_init{};
+
+    // current entry.
+    u16 m_flags{};
+    u16 m_compression{};
+    u32 m_crc32{};
+    u32 m_compressed_size{};
+    u32 m_uncompressed_size{};
+    u16 m_filename_len{};
+    u16 m_extrafield_len{};
+    s64 m_descriptor_size{};
+    s64 m_remaining{};
+    u32 m_crc32_calc{};
+    bool m_extract{};
+
+    std::span<const CentralEntry> m_central{};
+    const CentralEntry* m_central_entry{};
+};
+
 } // namespace sphaira::mz
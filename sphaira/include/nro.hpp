@@ -37,6 +37,7 @@ struct NroEntry {
 
     int image{}; // nvg image
     int x,y,w,h{}; // image
+    bool is_image_loading{}; // set whilst the icon is being decoded.
     bool is_nacp_valid{};
     std::optional<bool> has_star{std::nullopt};
 
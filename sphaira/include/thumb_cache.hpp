@@ -0,0 +1,36 @@
+#pragma once
+
+#include "image.hpp"
+#include "fs.hpp"
+#include <functional>
+#include <span>
+#include <string_view>
+#include <switch.h>
+
+// cache of decoded images on the sd card, so that icons are a single read on the
+// next launch rather than a decode (and possibly a resize).
+// images are scaled down to fit the target size and stored as raw rgba, packed
+// into a single data file along with an index of where each image is.
+// once full, the least recently used images are evicted to make space.
+namespace sphaira::thumb {
+
+// default target size, which is the size of grid icons.
+constexpr int DEFAULT_SIZE = 256;
+
+// key for a source that can be identified without reading it, ie, path + timestamp.
+auto MakeKey(std::string_view id, int size = DEFAULT_SIZE) -> u64;
+// key for a source that's already in memory.
+auto MakeKey(std::span<const u8> data, int size = DEFAULT_SIZE) -> u64;
+
+auto Get(u64 key, ImageResult& out) -> bool;
+void Put(u64 key, const ImageResult& image);
+
+// returns the cached image, otherwise calls the loader and caches the result.
+// the returned image is scaled down so that neither side is larger than size,
+// the key should have been made with the same size.
+auto Load(u64 key, const std::function<ImageResult()>& loader, int size = DEFAULT_SIZE) -> ImageResult;
+
+// same as above, keyed by the path, size and timestamp of the file.
+auto LoadFromFile(const fs::FsPath& path, u32 flags = ImageFlag_None, int size = DEFAULT_SIZE) -> ImageResult;
+
+} // namespace sphaira::thumb
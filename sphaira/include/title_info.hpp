@@ -69,7 +69,12 @@ auto GetNcmCs(u8 storage_id) -> NcmContentStorage&;
 auto GetNcmDb(u8 storage_id) -> NcmContentMetaDatabase&;
 
 // gets all meta entries for an id.
+// entries are cached per id for the session, so only the first call queries ns.
 Result GetMetaEntries(u64 id, MetaEntries& out, u32 flags = ContentFlag_All);
+// removes the cached entries for an id, call after installing or deleting its content.
+void InvalidateMetaEntries(u64 id);
+// removes all cached entries, ie, the gamecard was inserted or removed.
+void InvalidateMetaEntries();
 
 // returns the nca path of a control nca.
 Result GetControlPathFromStatus(const NsApplicationContentMetaStatus& status, u64* out_program_id, fs::FsPath* out_path);
@@ -6,6 +6,9 @@
 #include "ui/list.hpp"
 #include "fs.hpp"
 #include "option.hpp"
+#include "download.hpp"
+#include "utils/search_index.hpp"
+#include "image.hpp"
 #include <span>
 
 namespace sphaira::ui::menu::appstore {
@@ -31,7 +34,9 @@ struct LazyImage {
     int w{}, h{};
     bool tried_cache{};
     bool cached{};
+    bool decoding{}; // set whilst the image is being decoded.
     ImageDownloadState state{ImageDownloadState::None};
+    curl::AsyncHandle handle{}; // set whilst the download is in progress.
     u8 first_pixel[4]{};
 };
 
@@ -167,6 +172,11 @@ struct Menu final : grid::Menu {
     }
 
 private:
+    // raises the priority of visible downloads, lowers those near the screen
+    // and cancels those that have scrolled far off screen.
+    void UpdateImageDownloads(s64 start, s64 end);
+    // decodes the cached icon off the ui thread, replacing the image once uploaded.
+    void LoadImageAsync(u32 index, bool from_cache);
     void SetIndex(s64 index);
     void ScanHomebrew();
     void Sort();
@@ -174,6 +184,8 @@ private:
     void SetFilter();
     void SetSearch(const std::string& term);
     void OnLayoutChange();
+    // updates every app that has an update available, several at once.
+    void UpdateAll();
 
 private:
     static constexpr inline const char* INI_SECTION = "appstore";
@@ -183,11 +195,16 @@ private:
     std::vector<EntryMini> m_entries_index_author{};
     std::vector<EntryMini> m_entries_index_search{};
     std::span<EntryMini> m_entries_current{};
+    utils::SearchIndex m_search_index{};
 
     option::OptionLong m_filter{INI_SECTION, "filter", Filter::Filter_All};
     option::OptionLong m_sort{INI_SECTION, "sort", SortType::SortType_Updated};
     option::OptionLong m_order{INI_SECTION, "order", OrderType::OrderType_Descending};
     option::OptionLong m_layout{INI_SECTION, "layout", LayoutType::LayoutType_GridDetail};
+    // max number of apps downloaded at once by update all.
+    option::OptionLong m_update_jobs{INI_SECTION, "update_jobs", 3};
+    // combined download limit of update all in KiB/s, 0 is unlimited.
+    option::OptionLong m_update_max_speed{INI_SECTION, "update_max_speed", 0};
 
     s64 m_index{}; // where i am in the array
     LazyImage m_default_image{};
@@ -197,6 +214,7 @@ private:
     LazyImage m_installed{};
     ImageDownloadState m_repo_download_state{ImageDownloadState::None};
     std::unique_ptr<List> m_list{};
+    ImageDecoder m_decoder{};
 
     std::string m_search_term{};
     std::string m_author_term{};
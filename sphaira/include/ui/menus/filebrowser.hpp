@@ -8,6 +8,7 @@
 #include "option.hpp"
 #include "hasher.hpp"
 #include "nro.hpp"
+#include "image.hpp"
 #include <span>
 
 namespace sphaira::ui::menu::filebrowser {
@@ -127,6 +128,8 @@ struct FileEntry final : FsDirectoryEntry {
     bool checked_internal_extension{}; // did we already search for an ext?
     bool selected{}; // is this file selected?
     bool done_stat{}; // have we checked file_size / count.
+    int image{}; // nvg image of the preview, if any.
+    bool image_requested{}; // has the preview been requested.
 
     auto IsFile() const -> bool {
         return type == FsDirEntryType_File;
@@ -307,6 +310,9 @@ struct FsView final : Widget {
     void SortAndFindLastFile(bool scan = false);
     void SetIndexFromLastFile(const LastFile& last_file);
 
+    void LoadPreview(u32 index);
+    void FreeImages();
+
     void OnDeleteCallback();
     void OnPasteCallback();
     void OnRenameCallback();
@@ -358,6 +364,9 @@ struct FsView final : Widget {
     ScrollingText m_scroll_name{};
 
     bool m_is_update_folder{};
+
+    // decodes previews of images on the sd card.
+    ImageDecoder m_decoder{};
 };
 
 // contains all selected files for a command, such as copy, delete, cut etc.
@@ -5,6 +5,7 @@
 #include "nro.hpp"
 #include "fs.hpp"
 #include "option.hpp"
+#include "image.hpp"
 
 namespace sphaira::ui::menu::homebrew {
 
@@ -82,6 +83,7 @@ private:
 
     s64 m_index{}; // where i am in the array
     std::unique_ptr<List> m_list{};
+    ImageDecoder m_decoder{};
     bool m_dirty{};
 
     option::OptionLong m_sort{INI_SECTION, "sort", SortType::SortType_AlphabeticalStar};
@@ -2,6 +2,7 @@
 
 #include "ui/widget.hpp"
 #include "fs.hpp"
+#include "image.hpp"
 #include <vector>
 
 namespace sphaira::ui::menu::imageview {
@@ -19,11 +20,40 @@ struct Menu final : Widget {
 
     void UpdateSize();
 
+private:
+    // part of the full size image, level is how many times it was halved.
+    struct Tile {
+        int level;
+        int x, y; // tile index at the level.
+        int image; // nvg image, 0 whilst loading.
+        u64 last_used; // frame that it was last on screen.
+        u64 seq; // matches the tile to its load, as an evicted tile may be loaded again.
+    };
+
+    static constexpr int TILE_SIZE = 512;
+    // 48 tiles of 512x512 rgba is 48MiB.
+    static constexpr size_t MAX_TILES = 48;
+
+    void OnLoaded(int image, const ImageResult& result);
+    void DrawTiles(NVGcontext* vg);
+    void LoadTile(int level, int x, int y);
+    void OnTileLoaded(u64 seq, int image);
+    void EvictTiles(NVGcontext* vg);
+
 private:
     const fs::FsPath m_path;
+    // the whole image scaled to fit the screen, shown until tiles are loaded.
     int m_image{};
     float m_image_width{};
     float m_image_height{};
+    bool m_loaded{};
+
+    // full size image, only kept if it's larger than the preview.
+    // this is only written before the preview is loaded, and is then read only.
+    ImageResult m_full{};
+    std::vector<Tile> m_tiles{};
+    u64 m_frame{};
+    u64 m_tile_seq{};
 
     // for zoom, 0.1 - 1.0
     float m_zoom{1};
@@ -31,6 +61,9 @@ private:
     // for pan.
     float m_xoff{};
     float m_yoff{};
+
+    // declared last so that its threads exit before m_full is freed.
+    ImageDecoder m_decoder{};
 };
 
 } // namespace sphaira::ui::menu::imageview
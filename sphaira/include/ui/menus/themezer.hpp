@@ -6,6 +6,8 @@
 #include "ui/scrolling_text.hpp"
 #include "ui/list.hpp"
 #include "option.hpp"
+#include "download.hpp"
+#include "image.hpp"
 #include <span>
 
 namespace sphaira::ui::menu::themezer {
@@ -23,7 +25,9 @@ struct LazyImage {
     int w{}, h{};
     bool tried_cache{};
     bool cached{};
+    bool decoding{}; // set whilst the image is being decoded.
     ImageDownloadState state{ImageDownloadState::None};
+    curl::AsyncHandle handle{}; // set whilst the download is in progress.
 };
 
 enum MenuState {
@@ -140,6 +144,11 @@ struct Menu final : MenuBase {
     void OnFocusGained() override;
 
 private:
+    // raises the priority of visible downloads, lowers those near the screen
+    // and cancels those that have scrolled far off screen.
+    void UpdateImageDownloads(s64 start, s64 end);
+    // decodes the cached preview off the ui thread, replacing the image once uploaded.
+    void LoadImageAsync(s64 page_index, s64 pos, bool from_cache);
     void SetIndex(s64 index) {
         m_index = index;
         if (!m_index) {
@@ -163,6 +172,7 @@ private:
 
     s64 m_index{}; // where i am in the array
     std::unique_ptr<List> m_list{};
+    ImageDecoder m_decoder{};
 
     ScrollingText m_scroll_name{};
     ScrollingText m_scroll_author{};
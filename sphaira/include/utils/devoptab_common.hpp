@@ -93,7 +93,7 @@ void update_devoptab_for_read_only(devoptab_t* devoptab, bool read_only);
 struct PushPullThreadData {
     static constexpr size_t MAX_BUFFER_SIZE = 1024 * 64; // 64KB max buffer
 
-    explicit PushPullThreadData(CURL* _curl);
+    explicit PushPullThreadData(CURL* _curl, size_t _max_buffer_size = MAX_BUFFER_SIZE);
     virtual ~PushPullThreadData();
 
     Result CreateAndStart();
@@ -104,14 +104,29 @@ struct PushPullThreadData {
     size_t PullData(char* data, size_t total_size, bool curl = false);
     size_t PushData(const char* data, size_t total_size, bool curl = false);
 
+    // signals that no more data will be pushed and waits for the thread to exit.
+    // returns true if the transfer completed without error.
+    bool FinishAndWait();
+
     static size_t progress_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
 
 private:
     static void thread_func(void* arg);
 
+    // size of the data in the buffer that has yet to be pulled.
+    size_t BufferedSize() const {
+        return buffer.size() - buffer_off;
+    }
+
+    // copies data out of the buffer, the consumed data is only removed once
+    // enough has built up to avoid moving the buffer on every pull.
+    size_t ConsumeBuffer(char* data, size_t size);
+
 public:
     CURL* const curl{};
+    const size_t max_buffer_size;
     std::vector<char> buffer{};
+    size_t buffer_off{};
     Mutex mutex{};
     CondVar can_push{};
     CondVar can_pull{};
@@ -153,6 +168,40 @@ struct PushThreadData final : PushPullThreadData {
     static size_t push_thread_callback(const char *ptr, size_t size, size_t nmemb, void *userdata);
 };
 
+// coalesces small writes into large chunks before handing them to the upload thread,
+// rather than every write requiring a mutex / condvar handoff.
+// the chunks are uploaded in the background whilst the next chunk is being filled.
+// upload errors are reported on the next write, flush or close.
+struct WriteBackData {
+    static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+
+    explicit WriteBackData(PullThreadData* _data) : data{_data} {
+        pending.reserve(CHUNK_SIZE);
+    }
+
+    ~WriteBackData() {
+        delete data;
+    }
+
+    // returns the number of bytes written or -errno.
+    ssize_t Write(const char* ptr, size_t len);
+    // hands off pending data to the upload thread, returns 0 or -errno.
+    int Flush();
+    // flushes pending data and waits for the upload to complete, returns 0 or -errno.
+    int Close();
+
+private:
+    PullThreadData* const data;
+    std::vector<char> pending{};
+};
+
+// read-ahead window used by MountCurlDevice::ParallelRangeRead().
+struct RangeReadBuffer {
+    std::vector<char> data{};
+    u64 off{};
+    u64 size{};
+};
+
 struct MountDevice {
     MountDevice(const MountConfig& _config) : config{_config} {}
     virtual ~MountDevice() = default;
@@ -190,7 +239,8 @@ struct MountCurlDevice : MountDevice {
     virtual ~MountCurlDevice();
 
     PushThreadData* CreatePushData(CURL* curl, const std::string& url, size_t offset);
-    PullThreadData* CreatePullData(CURL* curl, const std::string& url, bool append = false);
+    PullThreadData* CreatePullData(CURL* curl, const std::string& url, bool append = false, size_t max_buffer_size = PushPullThreadData::MAX_BUFFER_SIZE);
+    WriteBackData* CreateWriteBackData(CURL* curl, const std::string& url, bool append = false);
 
     virtual bool Mount();
     virtual void curl_set_common_options(CURL* curl,  const std::string& url);
@@ -201,17 +251,41 @@ struct MountCurlDevice : MountDevice {
     static std::string url_decode(const std::string& str);
     std::string build_url(const std::string& path, bool is_dir);
 
+    // reads from the url using ranged requests, served from the read-ahead buffer.
+    // sequential reads are split into several ranges that are fetched in parallel,
+    // each on its own connection, which avoids servers that throttle per connection.
+    // for ftp, each range is a separate data connection started with REST.
+    // returns the number of bytes read or -errno.
+    ssize_t ParallelRangeRead(RangeReadBuffer& buf, const std::string& url, char* ptr, u64 off, size_t len, u64 file_size);
+
+    // size of each range fetched per connection on sequential reads.
+    static constexpr u64 RANGE_SEGMENT_SIZE = 1024 * 1024;
+    // min size fetched for random reads, ranges are never split below this.
+    static constexpr u64 RANGE_MIN_SIZE = 1024 * 64;
+    static constexpr long RANGE_DEFAULT_CONNECTIONS = 4;
+    static constexpr long RANGE_MAX_CONNECTIONS = 8;
+
 protected:
+    // fetches [off, off + size) into dst, split over the number of connections.
+    // returns the number of bytes fetched or -errno.
+    ssize_t FetchRanges(const std::string& url, char* dst, u64 off, u64 size, size_t connections);
+
     CURL* curl{};
     CURL* transfer_curl{};
 
 private:
     // path extracted from the url.
     std::string m_url_path{};
+    // url with the scheme fixed up, used as the key for the curl handle pool.
+    std::string m_pool_url{};
     CURLU* curlu{};
-    CURLSH* m_curl_share{};
-    RwLock m_rwlocks[CURL_LOCK_DATA_LAST]{};
     bool m_mounted{};
+
+    // handles used for parallel ranged reads, acquired on first use.
+    // the easy handles are kept around so that their connections are reused.
+    CURLM* m_range_multi{};
+    std::vector<CURL*> m_range_curls{};
+    long m_range_connections{RANGE_DEFAULT_CONNECTIONS};
 };
 
 void LoadConfigsFromIni(const fs::FsPath& path, MountConfigs& out_configs);
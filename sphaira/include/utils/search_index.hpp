@@ -0,0 +1,63 @@
+#pragma once
+
+#include <switch.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sphaira::utils {
+
+// case-insensitive substring index over the searchable fields of a list.
+// each field is split into lowercase trigrams, each trigram has a bitmap
+// of the entries that contain it, so a query only has to intersect
+// the bitmaps of its trigrams and then verify the few candidates left.
+// a query that extends the previous one only searches the previous matches,
+// so filtering narrows as the user types.
+struct SearchIndex {
+    using Bitmap = std::vector<u64>;
+
+    // removes all entries, call this whenever the list changes.
+    void Clear();
+
+    // adds a searchable field for entry id, ids must be added in order.
+    // field is used for ranking, lower fields rank first (ie, 0 = title).
+    void Add(u32 id, u32 field, std::string_view text);
+
+    // returns the ids of the entries whose fields contain the term.
+    // matches are ranked by the first field matched, then prefix matches first.
+    // field_mask limits which fields are searched.
+    auto Search(std::string_view term, u32 field_mask = ~0U) -> std::vector<u32>;
+
+    auto GetCount() const -> u32 {
+        return m_count;
+    }
+
+private:
+    struct Field {
+        u32 id;
+        u32 field;
+        u32 off;
+        u32 len;
+    };
+
+    auto AllSet() const -> Bitmap;
+    // returns the position of the term in the best matching field, or npos.
+    auto Match(u32 id, std::string_view term, u32 field_mask, u32& field) const -> size_t;
+
+private:
+    // lowercase copy of every field.
+    std::string m_text{};
+    std::vector<Field> m_fields{};
+    // index into m_fields of the first field of each id.
+    std::vector<u32> m_id_fields{};
+    std::unordered_map<u32, Bitmap> m_trigrams{};
+    u32 m_count{};
+
+    // result of the last search, used to narrow the next search.
+    std::string m_last_term{};
+    Bitmap m_last_matches{};
+    u32 m_last_field_mask{};
+};
+
+} // namespace sphaira::utils
@@ -359,7 +359,7 @@ auto GetNroIcon(const std::vector<u8>& nro_icon) -> std::vector<u8> {
         if (!image.data.empty()) {
             image = ImageConvertToJpg(image.data, image.w, image.h);
             if (!image.data.empty()) {
-                return image.data;
+                return {image.data.begin(), image.data.end()};
             }
         }
     }
@@ -541,7 +541,7 @@ void App::Loop() {
                     }
                 } else if constexpr(std::is_same_v<T, curl::DownloadEventData>) {
                     log_write("[DownloadEventData] got event\n");
-                    if (arg.callback && !arg.stoken.stop_requested()) {
+                    if (arg.callback && !arg.stoken.stop_requested() && !arg.handle.IsCancelled()) {
                         arg.callback(arg.result);
                     }
                 } else {
@@ -752,6 +752,10 @@ auto App::GetTextScrollSpeed() -> long {
     return g_app->m_text_scroll_speed.Get();
 }
 
+auto App::GetDownloadCacheSize() -> long {
+    return g_app->m_download_cache_size.Get();
+}
+
 auto App::GetNszCompressLevel() -> u8 {
     return NSZ_COMPRESS_LEVEL_OPTIONS[App::GetApp()->m_nsz_compress_level.Get()].value;
 }
@@ -1514,6 +1518,7 @@ App::App(const char* argv0) {
             else if (app->m_install_emummc.LoadFrom(Key, Value)) {}
             else if (app->m_install_sd.LoadFrom(Key, Value)) {}
             else if (app->m_progress_boost_mode.LoadFrom(Key, Value)) {}
+            else if (app->m_download_cache_size.LoadFrom(Key, Value)) {}
             else if (app->m_allow_downgrade.LoadFrom(Key, Value)) {}
             else if (app->m_skip_if_already_installed.LoadFrom(Key, Value)) {}
             else if (app->m_ticket_only.LoadFrom(Key, Value)) {}
@@ -8,12 +8,15 @@
 
 #include <switch.h>
 #include <cstring>
+#include <ctime>
 #include <cassert>
 #include <vector>
 #include <deque>
+#include <memory>
 #include <mutex>
 #include <algorithm>
 #include <ranges>
+#include <optional>
 #include <curl/curl.h>
 #include <yyjson.h>
 
@@ -32,15 +35,285 @@ namespace {
 
 constexpr auto API_AGENT = "DI-CIOLLA";
 constexpr u64 CHUNK_SIZE = 1024*1024;
-constexpr auto MAX_THREADS = 4;
+// max transfers in flight at once, and per scheme/host/port.
+constexpr size_t MAX_TRANSFERS = 32;
+constexpr size_t MAX_TRANSFERS_PER_HOST = 6;
+// max idle handles kept around in total and per scheme/host/port.
+constexpr auto POOL_MAX_IDLE = 16;
+constexpr auto POOL_MAX_IDLE_PER_HOST = 4;
 
 std::atomic_bool g_running{};
 CURLSH* g_curl_share{};
-// this is used for single threaded blocking installs.
-// avoids the needed for re-creating the handle each time.
-CURL* g_curl_single{};
 Mutex g_mutex_share[CURL_LOCK_DATA_LAST]{};
 
+struct PoolEntry {
+    std::string key;
+    CURL* curl;
+};
+
+// idle handles, oldest at the front.
+std::deque<PoolEntry> g_pool{};
+Mutex g_pool_mutex{};
+
+struct WriteStream;
+
+struct WriteBuffer {
+    std::vector<u8> data{};
+    size_t size{};
+    s64 off{};
+    WriteStream* stream{};
+};
+
+// a file being written to by the writer thread.
+struct WriteStream {
+    fs::File* f{};
+    s64 offset{}; // offset the next buffer will be written to.
+    WriteBuffer* buffer{}; // buffer currently being filled.
+    // below are protected by the writer mutex.
+    u32 pending{};
+    bool failed{};
+};
+
+// sd card writes are handed off to a single thread so that a slow write
+// doesn't stall the socket in the curl write callback.
+// there are more buffers than transfers, so a transfer can always hold a part filled
+// buffer while the rest are queued, which the writer thread frees as it goes.
+struct FileWriter {
+    static constexpr size_t BUFFER_SIZE = 1024 * 256;
+    static constexpr size_t BUFFER_COUNT = MAX_TRANSFERS + 8;
+    // free buffers past this count have their memory released.
+    static constexpr size_t BUFFER_KEEP = 8;
+    // max time to wait for a free buffer before writing directly.
+    static constexpr u64 ACQUIRE_TIMEOUT = 1e+9;
+
+    auto Create() -> Result {
+        mutexInit(&m_mutex);
+        condvarInit(&m_can_write);
+        condvarInit(&m_done);
+
+        for (auto& b : m_buffers) {
+            m_free.emplace_back(&b);
+        }
+
+        R_TRY(utils::CreateThread(&m_thread, ThreadFunc, this, 1024*32));
+        R_TRY(threadStart(&m_thread));
+
+        SCOPED_MUTEX(&m_mutex);
+        m_started = true;
+        R_SUCCEED();
+    }
+
+    // writes any queued buffers before exiting.
+    void Close() {
+        bool started;
+        {
+            SCOPED_MUTEX(&m_mutex);
+            m_exit = true;
+            started = m_started;
+            condvarWakeAll(&m_can_write);
+            condvarWakeAll(&m_done);
+        }
+
+        if (started) {
+            threadWaitForExit(&m_thread);
+            threadClose(&m_thread);
+
+            SCOPED_MUTEX(&m_mutex);
+            m_started = false;
+            condvarWakeAll(&m_done);
+        }
+    }
+
+    // copies the data into the stream's buffer, which is queued once full.
+    // returns false if a previous write failed.
+    auto Write(WriteStream& s, const void* data, size_t size) -> bool {
+        auto ptr = static_cast<const u8*>(data);
+
+        while (size) {
+            if (!s.buffer) {
+                if (!Acquire(s)) {
+                    return false;
+                }
+
+                // only happens if more streams than transfers are open at once,
+                // don't stall the curl thread any longer than the timeout.
+                if (!s.buffer) {
+                    return WriteDirect(s, ptr, size);
+                }
+            }
+
+            auto b = s.buffer;
+            const auto wsize = std::min(size, BUFFER_SIZE - b->size);
+            std::memcpy(b->data.data() + b->size, ptr, wsize);
+            b->size += wsize;
+            ptr += wsize;
+            size -= wsize;
+
+            if (b->size == BUFFER_SIZE) {
+                Submit(s);
+            }
+        }
+
+        return true;
+    }
+
+    // queues the partially filled buffer and waits for all of the streams writes.
+    // returns false if any write failed.
+    auto Flush(WriteStream& s) -> bool {
+        if (s.buffer) {
+            Submit(s);
+        }
+
+        // the thread writes everything queued before it exits, stop waiting once it's gone.
+        SCOPED_MUTEX(&m_mutex);
+        while (s.pending && m_started) {
+            condvarWait(&m_done, &m_mutex);
+        }
+
+        return !s.failed && !s.pending;
+    }
+
+    // size of the data written or queued for the stream.
+    static auto GetOffset(const WriteStream& s) -> s64 {
+        return s.offset + (s.buffer ? s.buffer->size : 0);
+    }
+
+private:
+    // takes a free buffer for the stream, waiting up to ACQUIRE_TIMEOUT for one.
+    // returns false if a previous write failed.
+    auto Acquire(WriteStream& s) -> bool {
+        SCOPED_MUTEX(&m_mutex);
+        if (m_free.empty() && m_started && !m_exit && !s.failed) {
+            condvarWaitTimeout(&m_done, &m_mutex, ACQUIRE_TIMEOUT);
+        }
+
+        if (m_exit || s.failed) {
+            return false;
+        }
+
+        if (m_free.empty()) {
+            log_write("[WRITER] no free buffer, writing directly\n");
+            return true;
+        }
+
+        s.buffer = m_free.back();
+        m_free.pop_back();
+
+        // allocated on first use.
+        if (s.buffer->data.empty()) {
+            s.buffer->data.resize(BUFFER_SIZE);
+        }
+
+        return true;
+    }
+
+    auto WriteDirect(WriteStream& s, const void* data, size_t size) -> bool {
+        const auto off = s.offset;
+        s.offset += size;
+
+        if (R_FAILED(s.f->Write(off, data, size, FsWriteOption_None))) {
+            SCOPED_MUTEX(&m_mutex);
+            s.failed = true;
+            return false;
+        }
+
+        return true;
+    }
+
+    // must be called with the mutex locked.
+    void Release(WriteBuffer* b) {
+        b->stream = nullptr;
+        b->size = 0;
+
+        // keep a few allocated, the rest are only needed when many transfers are in flight.
+        if (m_free.size() >= BUFFER_KEEP) {
+            std::vector<u8>{}.swap(b->data);
+        }
+
+        m_free.emplace_back(b);
+        condvarWakeAll(&m_done);
+    }
+
+    void Submit(WriteStream& s) {
+        SCOPED_MUTEX(&m_mutex);
+        auto b = s.buffer;
+        s.buffer = nullptr;
+
+        if (!b->size) {
+            Release(b);
+            return;
+        }
+
+        b->off = s.offset;
+        b->stream = &s;
+        s.offset += b->size;
+
+        // no thread to hand off to, or it's exiting, so write it here instead.
+        if (!m_started || m_exit) {
+            if (R_FAILED(s.f->Write(b->off, b->data.data(), b->size, FsWriteOption_None))) {
+                s.failed = true;
+            }
+
+            Release(b);
+            return;
+        }
+
+        s.pending++;
+        m_queue.emplace_back(b);
+        condvarWakeOne(&m_can_write);
+    }
+
+    static void ThreadFunc(void* p);
+
+    WriteBuffer m_buffers[BUFFER_COUNT]{};
+    std::vector<WriteBuffer*> m_free{};
+    std::deque<WriteBuffer*> m_queue{};
+    Mutex m_mutex{};
+    CondVar m_can_write{};
+    CondVar m_done{};
+    Thread m_thread{};
+    // below are protected by the mutex.
+    bool m_exit{};
+    bool m_started{};
+};
+
+void FileWriter::ThreadFunc(void* p) {
+    auto data = static_cast<FileWriter*>(p);
+
+    for (;;) {
+        WriteBuffer* b;
+
+        {
+            SCOPED_MUTEX(&data->m_mutex);
+            while (data->m_queue.empty() && !data->m_exit) {
+                condvarWait(&data->m_can_write, &data->m_mutex);
+            }
+
+            if (data->m_queue.empty()) {
+                break;
+            }
+
+            b = data->m_queue.front();
+            data->m_queue.pop_front();
+        }
+
+        const auto rc = b->stream->f->Write(b->off, b->data.data(), b->size, FsWriteOption_None);
+
+        SCOPED_MUTEX(&data->m_mutex);
+        if (R_FAILED(rc)) {
+            log_write("[WRITER] failed to write: 0x%X\n", rc);
+            b->stream->failed = true;
+        }
+
+        b->stream->pending--;
+        data->Release(b);
+    }
+
+    log_write("exited file writer thread\n");
+}
+
+FileWriter g_file_writer;
+
 struct UploadStruct {
     std::span<const u8> data;
     s64 offset{};
@@ -52,7 +325,7 @@ struct DataStruct {
     std::vector<u8> data;
     s64 offset{};
     fs::File f{};
-    s64 file_offset{};
+    WriteStream stream{};
 };
 
 struct SeekCustomData {
@@ -69,29 +342,41 @@ void Yield() {
     svcSleepThread(YieldType_WithoutCoreMigration);
 }
 
+// index of the files downloaded with Flag_Cache, keyed by the crc32 of the path.
+// the files live at the path given by the caller, the index stores the validators
+// used to revalidate them, how long they are fresh for (from cache-control max-age)
+// and their size, so that the least recently used files can be deleted once
+// the total size goes over the budget.
+//
+// the index is stored as an append-only log, each change appends a record
+// rather than rewriting the whole file. records are checksummed so that a
+// record torn by a crash is dropped on load. the log is compacted into a new
+// file once most of its records are stale, this is done on a background thread
+// so that the download that triggered it isn't held up by the write.
 struct Cache {
-    using Value = std::pair<std::string, std::string>;
+    struct Entry {
+        std::string path{};
+        std::string etag{};
+        std::string last_modified{};
+        u64 expires{}; // unix time the file is fresh until, 0 if it always needs revalidating.
+        u64 size{};
+        u64 last_used{}; // unix time.
+        bool touched{}; // last_used changed since the entry was logged.
+    };
+
+    // 0 disables eviction.
+    void set_budget(u64 size) {
+        SCOPED_MUTEX(&m_mutex);
+        m_budget = size;
+    }
 
     bool init() {
         SCOPED_MUTEX(&m_mutex);
 
-        if (!m_json) {
-            auto json_in = yyjson_read_file(JSON_PATH, YYJSON_READ_NOFLAG, nullptr, nullptr);
-            if (json_in) {
-                log_write("loading old json doc\n");
-                m_json = yyjson_doc_mut_copy(json_in, nullptr);
-                yyjson_doc_free(json_in);
-                m_root = yyjson_mut_doc_get_root(m_json);
-            } else {
-                log_write("creating new json doc\n");
-                m_json = yyjson_mut_doc_new(nullptr);
-                m_root = yyjson_mut_obj(m_json);
-                yyjson_mut_doc_set_root(m_json, m_root);
-            }
-        }
-
-        if (!m_json) {
-            return false;
+        if (!m_init_ref_count) {
+            // started first so that a compaction needed on load is also done in the background.
+            start_thread();
+            load();
         }
 
         m_init_ref_count++;
@@ -100,43 +385,87 @@ struct Cache {
     }
 
     void exit() {
-        SCOPED_MUTEX(&m_mutex);
+        {
+            SCOPED_MUTEX(&m_mutex);
 
-        if (!m_json) {
-            return;
-        }
+            if (!m_init_ref_count) {
+                return;
+            }
 
-        m_init_ref_count--;
-        if (m_init_ref_count) {
-            return;
+            m_init_ref_count--;
+            if (m_init_ref_count) {
+                return;
+            }
+
+            m_thread_exit = true;
+            condvarWakeAll(&m_can_compact);
         }
 
-        // note: this takes 20ms
-        if (!yyjson_mut_write_file(JSON_PATH, m_json, YYJSON_WRITE_NOFLAG, nullptr, nullptr)) {
-            log_write("[ETAG] failed to write etag json: %s\n", JSON_PATH.s);
+        // the thread needs the mutex to exit, so it's joined with the mutex unlocked.
+        if (m_thread_started) {
+            threadWaitForExit(&m_thread);
+            threadClose(&m_thread);
+            m_thread_started = false;
         }
 
-        yyjson_mut_doc_free(m_json);
-        m_json = nullptr;
-        m_root = nullptr;
+        SCOPED_MUTEX(&m_mutex);
+        evict({});
+
+        // last used times are only logged on exit, losing them on a crash only affects eviction order.
+        std::vector<u8> data;
+        for (auto& [key, entry] : m_entries) {
+            if (entry.touched) {
+                serialize(data, RecordType_Set, key, entry);
+                entry.touched = false;
+                m_records++;
+            }
+        }
+        append(data);
+        compact_if_needed();
+
+        m_log.Close();
+        m_log_open = false;
+        m_fs.reset();
+        m_entries.clear();
+        m_total_size = 0;
         log_write("[ETAG] exit\n");
     }
 
-    void get(const fs::FsPath& path, curl::Header& header) {
-        ON_SCOPE_EXIT(mutexUnlock(&m_mutex));
+    // returns true if the file is still fresh and can be used without a request,
+    // otherwise the validators are added to the header.
+    bool get(const fs::FsPath& path, curl::Header& header) {
+        SCOPED_MUTEX(&m_mutex);
+
+        const auto it = m_entries.find(generate_key_from_path(path));
+        if (it == m_entries.end()) {
+            return false;
+        }
+
+        auto& entry = it->second;
+        entry.last_used = std::time(nullptr);
+        entry.touched = true;
+
+        if (entry.last_used < entry.expires) {
+            return true;
+        }
 
-        const auto [etag, last_modified] = get_internal(path);
-        if (!etag.empty()) {
-            header.m_map.emplace("if-none-match", etag);
+        if (!entry.etag.empty()) {
+            header.m_map.emplace("if-none-match", entry.etag);
         }
 
-        if (!last_modified.empty()) {
-            header.m_map.emplace("if-modified-since", last_modified);
+        if (!entry.last_modified.empty()) {
+            header.m_map.emplace("if-modified-since", entry.last_modified);
         }
+
+        return false;
     }
 
-    void set(const fs::FsPath& path, const curl::Header& value) {
-        ON_SCOPE_EXIT(mutexUnlock(&m_mutex));
+    // called once the file has been downloaded.
+    void set(const fs::FsPath& path, const curl::Header& value, u64 size) {
+        SCOPED_MUTEX(&m_mutex);
+
+        const auto kkey = generate_key_from_path(path);
+        auto& entry = m_entries[kkey];
 
         std::string etag_str;
         std::string last_modified_str;
@@ -148,180 +477,507 @@ struct Cache {
             last_modified_str = it->second;
         }
 
+        // workaround for appstore accepting etags but not returning them.
         if (!etag_str.empty() || !last_modified_str.empty()) {
-            set_internal(path, Value{etag_str, last_modified_str});
+            entry.etag = etag_str;
+            entry.last_modified = last_modified_str;
+        }
+
+        log_write("[ETAG] setting entry, path: %s key: %s size: %lu\n", path.s, kkey.c_str(), size);
+
+        m_total_size = m_total_size - entry.size + size;
+        entry.path = path.s;
+        entry.size = size;
+        entry.last_used = std::time(nullptr);
+        entry.expires = get_expires(value, entry.last_used);
+        log_entry(RecordType_Set, kkey, entry);
+
+        evict(kkey);
+        compact_if_needed();
+    }
+
+    // called on a 304, the server may have extended how long the file is fresh for.
+    void revalidated(const fs::FsPath& path, const curl::Header& value) {
+        SCOPED_MUTEX(&m_mutex);
+
+        const auto it = m_entries.find(generate_key_from_path(path));
+        if (it != m_entries.end()) {
+            auto& entry = it->second;
+            entry.last_used = std::time(nullptr);
+            entry.expires = get_expires(value, entry.last_used);
+            log_entry(RecordType_Set, it->first, entry);
         }
     }
 
 private:
-    auto get_internal(const fs::FsPath& path) -> Value {
-        if (!fs::FsNativeSd().FileExists(path)) {
-            return {};
+    enum RecordType : u8 {
+        RecordType_Set,
+        RecordType_Erase,
+    };
+
+    struct LogHeader {
+        u32 magic;
+        u32 version;
+    };
+
+    // followed by the path, etag and last-modified strings.
+    struct LogRecord {
+        u32 crc; // crc32 of the rest of the record, including the strings.
+        u8 type;
+        u8 pad;
+        u16 path_len;
+        u16 etag_len;
+        u16 last_modified_len;
+        u32 key;
+        u64 expires;
+        u64 size;
+        u64 last_used;
+    };
+
+    static auto get_expires(const curl::Header& value, u64 now) -> u64 {
+        const auto it = value.Find(CACHE_CONTROL_STR);
+        if (it == value.m_map.end()) {
+            return 0;
         }
 
-        const auto kkey = generate_key_from_path(path);
-        const auto it = m_cache.find(kkey);
-        if (it != m_cache.end()) {
-            return it->second;
+        const auto& str = it->second;
+        if (str.contains("no-cache") || str.contains("no-store")) {
+            return 0;
         }
 
-        auto hash_key = yyjson_mut_obj_getn(m_root, kkey.c_str(), kkey.length());
-        if (!hash_key) {
-            return {};
+        const auto pos = str.find(MAX_AGE_STR);
+        if (pos == std::string::npos) {
+            return 0;
         }
 
-        auto etag_key = yyjson_mut_obj_get(hash_key, ETAG_STR);
-        auto last_modified_key = yyjson_mut_obj_get(hash_key, LAST_MODIFIED_STR);
+        const auto max_age = std::strtoull(str.c_str() + pos + std::strlen(MAX_AGE_STR), nullptr, 10);
+        return max_age ? now + max_age : 0;
+    }
 
-        const auto etag_value = yyjson_mut_get_str(etag_key);
-        const auto etag_value_len = yyjson_mut_get_len(etag_key);
-        const auto last_modified_value = yyjson_mut_get_str(last_modified_key);
-        const auto last_modified_value_len = yyjson_mut_get_len(last_modified_key);
+    // deletes the least recently used files until the total size is within budget.
+    // entries from older versions don't store the path, so they are skipped.
+    void evict(const std::string& keep) {
+        if (!m_budget || m_total_size <= m_budget || !m_fs) {
+            return;
+        }
 
-        if ((!etag_value || !etag_value_len) && (!last_modified_value || !last_modified_value_len)) {
-            return {};
+        while (m_total_size > m_budget) {
+            auto lru = m_entries.end();
+            for (auto it = m_entries.begin(); it != m_entries.end(); it++) {
+                if (it->first == keep || it->second.path.empty()) {
+                    continue;
+                }
+
+                if (lru == m_entries.end() || it->second.last_used < lru->second.last_used) {
+                    lru = it;
+                }
+            }
+
+            if (lru == m_entries.end()) {
+                break;
+            }
+
+            log_write("[ETAG] evicting: %s size: %lu\n", lru->second.path.c_str(), lru->second.size);
+            m_fs->DeleteFile(lru->second.path);
+            m_total_size -= lru->second.size;
+            log_entry(RecordType_Erase, lru->first, {});
+            m_entries.erase(lru);
         }
+    }
 
-        std::string etag;
-        std::string last_modified;
-        if (etag_value && etag_value_len) {
-            etag.assign(etag_value, etag_value_len);
+    static void serialize(std::vector<u8>& out, RecordType type, const std::string& key, const Entry& entry) {
+        LogRecord rec{};
+        rec.type = type;
+        rec.key = std::strtoul(key.c_str(), nullptr, 10);
+        if (type == RecordType_Set) {
+            rec.path_len = entry.path.length();
+            rec.etag_len = entry.etag.length();
+            rec.last_modified_len = entry.last_modified.length();
+            rec.expires = entry.expires;
+            rec.size = entry.size;
+            rec.last_used = entry.last_used;
         }
-        if (last_modified_value && last_modified_value_len) {
-            last_modified.assign(last_modified_value, last_modified_value_len);
+
+        const auto off = out.size();
+        out.resize(off + sizeof(rec) + rec.path_len + rec.etag_len + rec.last_modified_len);
+
+        auto p = out.data() + off + sizeof(rec);
+        std::memcpy(p, entry.path.data(), rec.path_len);
+        p += rec.path_len;
+        std::memcpy(p, entry.etag.data(), rec.etag_len);
+        p += rec.etag_len;
+        std::memcpy(p, entry.last_modified.data(), rec.last_modified_len);
+
+        std::memcpy(out.data() + off, &rec, sizeof(rec));
+        rec.crc = crc32Calculate(out.data() + off + sizeof(rec.crc), out.size() - off - sizeof(rec.crc));
+        std::memcpy(out.data() + off, &rec.crc, sizeof(rec.crc));
+    }
+
+    // parses the records, returns the offset of the first torn or corrupt record.
+    auto parse(std::span<const u8> data) -> size_t {
+        size_t off = sizeof(LogHeader);
+        while (off + sizeof(LogRecord) <= data.size()) {
+            LogRecord rec;
+            std::memcpy(&rec, data.data() + off, sizeof(rec));
+
+            const auto rec_size = sizeof(rec) + rec.path_len + rec.etag_len + rec.last_modified_len;
+            if (off + rec_size > data.size()) {
+                break;
+            }
+
+            if (rec.crc != crc32Calculate(data.data() + off + sizeof(rec.crc), rec_size - sizeof(rec.crc))) {
+                break;
+            }
+
+            const auto key = std::to_string(rec.key);
+            if (auto it = m_entries.find(key); it != m_entries.end()) {
+                m_total_size -= it->second.size;
+                m_entries.erase(it);
+            }
+
+            if (rec.type == RecordType_Set) {
+                auto str = (const char*)data.data() + off + sizeof(rec);
+
+                Entry entry{};
+                entry.path.assign(str, rec.path_len);
+                str += rec.path_len;
+                entry.etag.assign(str, rec.etag_len);
+                str += rec.etag_len;
+                entry.last_modified.assign(str, rec.last_modified_len);
+                entry.expires = rec.expires;
+                entry.size = rec.size;
+                entry.last_used = rec.last_used;
+
+                m_total_size += entry.size;
+                m_entries.emplace(key, std::move(entry));
+            }
+
+            m_records++;
+            off += rec_size;
         }
 
-        const Value ret{etag, last_modified};
-        m_cache.insert_or_assign(it, kkey, ret);
-        return ret;
+        return off;
     }
 
-    void set_internal(const fs::FsPath& path, const Value& value) {
-        const auto kkey = generate_key_from_path(path);
+    void load() {
+        m_fs = std::make_unique<fs::FsNativeSd>();
+        m_records = 0;
+
+        std::vector<u8> data;
+        auto rc = m_fs->read_entire_file(LOG_PATH, data);
 
-        // check if we already have this entry
-        const auto it = m_cache.find(kkey);
-        if (it != m_cache.end() && it->second == value) {
-            log_write("already has etag, not updating, path: %s key: %s\n", path.s, kkey.c_str());
+        // a crash during compaction can leave only the new log.
+        if (R_FAILED(rc) && R_SUCCEEDED(m_fs->RenameFile(LOG_TEMP_PATH, LOG_PATH))) {
+            rc = m_fs->read_entire_file(LOG_PATH, data);
+        }
+
+        if (R_FAILED(rc)) {
+            import_legacy();
+            compact();
             return;
         }
 
-        if (it != m_cache.end()) {
-            log_write("updating etag, path: %s key: %s\n", path.s, kkey.c_str());
-        } else {
-            log_write("setting new etag, path: %s key: %s\n", path.s, kkey.c_str());
+        LogHeader header{};
+        if (data.size() >= sizeof(header)) {
+            std::memcpy(&header, data.data(), sizeof(header));
+        }
+
+        if (header.magic != LOG_MAGIC || header.version != LOG_VERSION) {
+            log_write("[ETAG] bad log header, starting empty\n");
+            compact();
+            return;
         }
 
-        // insert new entry into cache, this will never fail.
-        const auto& [jkey, jvalue] = *m_cache.insert_or_assign(it, kkey, value);
-        const auto& [etag, last_modified] = jvalue;
+        const auto end = parse(data);
+        log_write("[ETAG] loaded %zu entries from %u records, size: %lu\n", m_entries.size(), m_records, m_total_size);
 
-        // check if we need to add a new entry to root or simply update the value.
-        auto hash_key = yyjson_mut_obj_getn(m_root, kkey.c_str(), kkey.length());
-        if (!hash_key) {
-            hash_key = yyjson_mut_obj_add_obj(m_json, m_root, jkey.c_str());
+        // appending after a torn record would leave the new records unreachable.
+        if (end != data.size()) {
+            log_write("[ETAG] log is torn at: %zu size: %zu, compacting\n", end, data.size());
+            compact();
+            return;
         }
 
-        if (!hash_key) {
-            log_write("failed to set new cache key obj, path: %s key: %s\n", path.s, jkey.c_str());
-        } else {
-            const auto update_entry = [this, &hash_key](const char* tag, const std::string& value) {
-                if (value.empty()) {
-                    // workaround for appstore accepting etags but not returning them.
-                    yyjson_mut_obj_remove_str(hash_key, tag);
-                    return true;
-                } else {
-                    auto key = yyjson_mut_obj_get(hash_key, tag);
-                    if (!key) {
-                        return yyjson_mut_obj_add_str(m_json, hash_key, tag, value.c_str());
-                    } else {
-                        return yyjson_mut_set_str(key, value.c_str());
-                    }
-                }
-            };
+        if (R_FAILED(m_fs->OpenFile(LOG_PATH, FsOpenMode_Write|FsOpenMode_Append, &m_log))) {
+            log_write("[ETAG] failed to open log: %s\n", LOG_PATH.s);
+            return;
+        }
 
-            if (!update_entry("etag", etag)) {
-                log_write("failed to set new etag, path: %s key: %s\n", path.s, jkey.c_str());
-            }
+        m_log_open = true;
+        m_log_size = data.size();
+        compact_if_needed();
+    }
 
-            if (!update_entry("last-modified", last_modified)) {
-                log_write("failed to set new last-modified, path: %s key: %s\n", path.s, jkey.c_str());
+    // imports the json index used by older versions.
+    void import_legacy() {
+        auto json = yyjson_read_file(LEGACY_JSON_PATH, YYJSON_READ_NOFLAG, nullptr, nullptr);
+        if (!json) {
+            log_write("[ETAG] no log or json doc, starting empty\n");
+            return;
+        }
+        ON_SCOPE_EXIT(yyjson_doc_free(json));
+
+        const auto get_str = [](yyjson_val* obj, const char* name) -> std::string {
+            const auto val = yyjson_obj_get(obj, name);
+            if (const auto str = yyjson_get_str(val)) {
+                return {str, yyjson_get_len(val)};
             }
+            return {};
+        };
+
+        size_t idx, max;
+        yyjson_val *key, *val;
+        yyjson_obj_foreach(yyjson_doc_get_root(json), idx, max, key, val) {
+            Entry entry{};
+            entry.path = get_str(val, PATH_STR);
+            entry.etag = get_str(val, ETAG_STR);
+            entry.last_modified = get_str(val, LAST_MODIFIED_STR);
+            entry.expires = yyjson_get_uint(yyjson_obj_get(val, EXPIRES_STR));
+            entry.size = yyjson_get_uint(yyjson_obj_get(val, SIZE_STR));
+            entry.last_used = yyjson_get_uint(yyjson_obj_get(val, LAST_USED_STR));
+
+            m_total_size += entry.size;
+            m_entries.emplace(std::string{yyjson_get_str(key), yyjson_get_len(key)}, std::move(entry));
         }
+
+        log_write("[ETAG] imported %zu entries from: %s\n", m_entries.size(), LEGACY_JSON_PATH.s);
+        m_fs->DeleteFile(LEGACY_JSON_PATH);
     }
 
-    static constexpr inline fs::FsPath JSON_PATH{"/switch/sphaira/cache/etag_v2.json"};
-    static constexpr inline const char* ETAG_STR{"etag"};
-    static constexpr inline const char* LAST_MODIFIED_STR{"last-modified"};
+    void log_entry(RecordType type, const std::string& key, const Entry& entry) {
+        std::vector<u8> data;
+        serialize(data, type, key, entry);
+        append(data);
+        m_records++;
 
-    Mutex m_mutex{};
-    yyjson_mut_doc* m_json{};
-    yyjson_mut_val* m_root{};
-    std::unordered_map<std::string, Value> m_cache{};
-    u32 m_init_ref_count{};
-};
+        if (m_compacting) {
+            m_compact_tail_records++;
+        }
+    }
 
-struct ThreadEntry {
-    auto Create() -> Result {
-        m_curl = curl_easy_init();
-        R_UNLESS(m_curl != nullptr, Result_CurlFailedEasyInit);
+    void append(std::span<const u8> data) {
+        if (!m_log_open || data.empty()) {
+            return;
+        }
 
-        ueventCreate(&m_uevent, true);
-        R_TRY(utils::CreateThread(&m_thread, ThreadFunc, this, 1024*32));
-        R_TRY(threadStart(&m_thread));
-        R_SUCCEED();
+        // also added to the new log once it has been written.
+        if (m_compacting) {
+            m_compact_tail.insert(m_compact_tail.end(), data.begin(), data.end());
+        }
+
+        if (R_FAILED(m_log.Write(m_log_size, data.data(), data.size(), FsWriteOption_Flush))) {
+            log_write("[ETAG] failed to append to log\n");
+            return;
+        }
+
+        m_log_size += data.size();
     }
 
-    void SignalClose() {
-        ueventSignal(&m_uevent);
+    auto needs_compact() const -> bool {
+        return m_records > m_entries.size() * 2 + COMPACT_MIN_RECORDS;
     }
 
-    void Close() {
-        SignalClose();
-        threadWaitForExit(&m_thread);
-        threadClose(&m_thread);
-        if (m_curl) {
-            curl_easy_cleanup(m_curl);
-            m_curl = nullptr;
+    void compact_if_needed() {
+        if (!needs_compact()) {
+            return;
+        }
+
+        if (m_thread_started && !m_thread_exit) {
+            m_compact_requested = true;
+            condvarWakeOne(&m_can_compact);
+        } else if (!m_compacting) {
+            compact();
+        }
+    }
+
+    void start_thread() {
+        condvarInit(&m_can_compact);
+        m_thread_exit = false;
+        m_compact_requested = false;
+
+        if (R_FAILED(utils::CreateThread(&m_thread, ThreadFunc, this, 1024*32))) {
+            log_write("[ETAG] failed to create thread, compacting inline\n");
+            return;
+        }
+
+        if (R_FAILED(threadStart(&m_thread))) {
+            log_write("[ETAG] failed to start thread, compacting inline\n");
+            threadClose(&m_thread);
+            return;
+        }
+
+        m_thread_started = true;
+    }
+
+    static void ThreadFunc(void* p) {
+        auto cache = static_cast<Cache*>(p);
+        SCOPED_MUTEX(&cache->m_mutex);
+
+        for (;;) {
+            while (!cache->m_compact_requested && !cache->m_thread_exit) {
+                condvarWait(&cache->m_can_compact, &cache->m_mutex);
+            }
+
+            if (cache->m_thread_exit) {
+                break;
+            }
+
+            cache->m_compact_requested = false;
+            if (cache->needs_compact()) {
+                cache->compact_background();
+            }
         }
     }
 
-    auto InProgress() -> bool {
-        return m_in_progress == true;
+    // header followed by a record for each live entry.
+    auto snapshot() -> std::vector<u8> {
+        const LogHeader header{LOG_MAGIC, LOG_VERSION};
+        std::vector<u8> data(sizeof(header));
+        std::memcpy(data.data(), &header, sizeof(header));
+
+        for (auto& [key, entry] : m_entries) {
+            serialize(data, RecordType_Set, key, entry);
+            entry.touched = false;
+        }
+
+        return data;
+    }
+
+    // writes the live entries to a new log which then replaces the old one.
+    void compact() {
+        if (!m_fs) {
+            return;
+        }
+
+        const auto data = snapshot();
+        log_write("[ETAG] compacting %u records into %zu\n", m_records, m_entries.size());
+
+        m_log.Close();
+        m_log_open = false;
+        m_records = m_entries.size();
+
+        m_fs->CreateDirectoryRecursivelyWithPath(LOG_PATH);
+        if (R_FAILED(m_fs->write_entire_file(LOG_TEMP_PATH, data))) {
+            log_write("[ETAG] failed to write log: %s\n", LOG_TEMP_PATH.s);
+            return;
+        }
+
+        replace_log(data.size());
     }
 
-    auto Setup(const Api& api) -> bool {
-        assert(m_in_progress == false && "Setting up thread while active");
+    // same as above, but the new log is written with the mutex unlocked.
+    // records logged in the meantime still go to the old log, and are also
+    // added to the new log before it replaces the old one.
+    // called from the thread with the mutex locked.
+    void compact_background() {
+        if (!m_fs) {
+            return;
+        }
+
+        const auto data = snapshot();
+        const u32 records = m_entries.size();
+        log_write("[ETAG] compacting %u records into %u in the background\n", m_records, records);
+
+        m_compacting = true;
+        m_compact_tail.clear();
+        m_compact_tail_records = 0;
+
+        mutexUnlock(&m_mutex);
+        m_fs->CreateDirectoryRecursivelyWithPath(LOG_PATH);
+        const auto rc = m_fs->write_entire_file(LOG_TEMP_PATH, data);
         mutexLock(&m_mutex);
-        ON_SCOPE_EXIT(mutexUnlock(&m_mutex));
 
-        if (m_in_progress) {
-            return false;
+        m_compacting = false;
+        ON_SCOPE_EXIT(m_compact_tail.clear());
+
+        // the old log is untouched, so nothing is lost on failure.
+        if (R_FAILED(rc)) {
+            log_write("[ETAG] failed to write log: %s\n", LOG_TEMP_PATH.s);
+            return;
         }
-        m_api = api;
-        m_in_progress = true;
-        // log_write("started download :)\n");
-        ueventSignal(&m_uevent);
-        return true;
+
+        if (!m_compact_tail.empty()) {
+            fs::File f;
+            if (R_FAILED(m_fs->OpenFile(LOG_TEMP_PATH, FsOpenMode_Write|FsOpenMode_Append, &f)) ||
+                R_FAILED(f.Write(data.size(), m_compact_tail.data(), m_compact_tail.size(), FsWriteOption_Flush))) {
+                log_write("[ETAG] failed to append to log: %s\n", LOG_TEMP_PATH.s);
+                return;
+            }
+        }
+
+        m_log.Close();
+        m_log_open = false;
+        m_records = records + m_compact_tail_records;
+        replace_log(data.size() + m_compact_tail.size());
     }
 
-    static void ThreadFunc(void* p);
+    // replaces the log with the newly written log of size bytes.
+    void replace_log(s64 size) {
+        m_fs->DeleteFile(LOG_PATH);
+        if (R_FAILED(m_fs->RenameFile(LOG_TEMP_PATH, LOG_PATH))) {
+            log_write("[ETAG] failed to rename log: %s\n", LOG_PATH.s);
+            return;
+        }
+
+        if (R_FAILED(m_fs->OpenFile(LOG_PATH, FsOpenMode_Write|FsOpenMode_Append, &m_log))) {
+            log_write("[ETAG] failed to open log: %s\n", LOG_PATH.s);
+            return;
+        }
+
+        m_log_open = true;
+        m_log_size = size;
+    }
+
+    static constexpr inline fs::FsPath LOG_PATH{"/switch/sphaira/cache/etag_v3.log"};
+    static constexpr inline fs::FsPath LOG_TEMP_PATH{"/switch/sphaira/cache/etag_v3.log.tmp"};
+    static constexpr inline fs::FsPath LEGACY_JSON_PATH{"/switch/sphaira/cache/etag_v2.json"};
+    static constexpr inline const char* PATH_STR{"path"};
+    static constexpr inline const char* ETAG_STR{"etag"};
+    static constexpr inline const char* LAST_MODIFIED_STR{"last-modified"};
+    static constexpr inline const char* EXPIRES_STR{"expires"};
+    static constexpr inline const char* SIZE_STR{"size"};
+    static constexpr inline const char* LAST_USED_STR{"last-used"};
+    static constexpr inline const char* CACHE_CONTROL_STR{"cache-control"};
+    static constexpr inline const char* MAX_AGE_STR{"max-age="};
+
+    static constexpr u32 LOG_MAGIC = 0x43455053; // SPEC
+    static constexpr u32 LOG_VERSION = 1;
+    // the log is compacted once it has this many more records than twice the entries.
+    static constexpr u32 COMPACT_MIN_RECORDS = 256;
 
-    CURL* m_curl{};
-    Thread m_thread{};
-    Api m_api{};
-    std::atomic_bool m_in_progress{};
     Mutex m_mutex{};
-    UEvent m_uevent{};
+    std::unordered_map<std::string, Entry> m_entries{};
+    std::unique_ptr<fs::FsNativeSd> m_fs{};
+    fs::File m_log{};
+    s64 m_log_size{};
+    u32 m_records{};
+    bool m_log_open{};
+    u64 m_total_size{};
+    u64 m_budget{};
+    u32 m_init_ref_count{};
+
+    Thread m_thread{};
+    CondVar m_can_compact{};
+    bool m_thread_started{};
+    bool m_thread_exit{};
+    bool m_compact_requested{};
+    // set whilst the thread writes the new log, appended records are also kept in the tail.
+    bool m_compacting{};
+    std::vector<u8> m_compact_tail{};
+    u32 m_compact_tail_records{};
 };
 
 struct ThreadQueueEntry {
     Api api;
-    bool m_delete{};
+    // scheme://host:port, set once the entry is first looked at.
+    std::string key{};
 };
 
+// queued transfers are driven by a single curl_multi handle on one thread,
+// rather than a thread per transfer blocking on curl_easy_perform.
 struct ThreadQueue {
     std::deque<ThreadQueueEntry> m_entries{};
+    CURLM* m_multi{};
     Thread m_thread{};
     Mutex m_mutex{};
     UEvent m_uevent{};
@@ -334,7 +990,8 @@ struct ThreadQueue {
     }
 
     void SignalClose() {
-        ueventSignal(&m_uevent);
+        SCOPED_MUTEX(&m_mutex);
+        Wakeup();
     }
 
     void Close() {
@@ -351,6 +1008,10 @@ struct ThreadQueue {
         mutexLock(&m_mutex);
         ON_SCOPE_EXIT(mutexUnlock(&m_mutex));
 
+        // the handle tracks the priority from now on so that it can be changed.
+        auto handle = api.GetHandle();
+        handle.SetPriority(api.GetPriority());
+
         switch (api.GetPriority()) {
             case Priority::Normal:
                 m_entries.emplace_back(api).api.SetUpload(is_upload);
@@ -360,14 +1021,26 @@ struct ThreadQueue {
                 break;
         }
 
-        ueventSignal(&m_uevent);
+        Wakeup();
         return true;
     }
 
     static void ThreadFunc(void* p);
+
+private:
+    // wakes the thread if it's waiting for either the queue or the sockets.
+    // must be called with the mutex held.
+    void Wakeup() {
+        ueventSignal(&m_uevent);
+
+        #if LIBCURL_VERSION_NUM >= 0x074400
+        if (m_multi) {
+            curl_multi_wakeup(m_multi);
+        }
+        #endif
+    }
 };
 
-ThreadEntry g_threads[MAX_THREADS]{};
 ThreadQueue g_thread_queue;
 Cache g_cache;
 
@@ -394,7 +1067,7 @@ auto ProgressCallbackFunc1(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
 
 auto ProgressCallbackFunc2(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) -> size_t {
     auto api = static_cast<Api*>(clientp);
-    if (!g_running || api->GetToken().stop_requested()) {
+    if (!g_running || api->IsStopped()) {
         return 1;
     }
 
@@ -516,35 +1189,32 @@ auto WriteMemoryCallback(void *contents, size_t size, size_t num_files, void *us
     return realsize;
 }
 
-auto WriteFileCallback(void *contents, size_t size, size_t num_files, void *userp) -> size_t {
+auto WriteDataCallback(void *contents, size_t size, size_t num_files, void *userp) -> size_t {
     if (!g_running) {
         return 0;
     }
 
-    auto data_struct = static_cast<DataStruct*>(userp);
+    auto api = static_cast<const Api*>(userp);
     const auto realsize = size * num_files;
 
-    // flush data if incomming data would overflow the buffer
-    if (data_struct->offset && data_struct->data.size() < data_struct->offset + realsize) {
-        if (R_FAILED(data_struct->f.Write(data_struct->file_offset, data_struct->data.data(), data_struct->offset, FsWriteOption_None))) {
-            return 0;
-        }
+    if (!api->GetOnDownloadData()(contents, realsize)) {
+        return 0;
+    }
 
-        data_struct->file_offset += data_struct->offset;
-        data_struct->offset = 0;
+    return realsize;
+}
+
+auto WriteFileCallback(void *contents, size_t size, size_t num_files, void *userp) -> size_t {
+    if (!g_running) {
+        return 0;
     }
 
-    // we have a huge chunk! write it directly to file
-    if (data_struct->data.size() < realsize) {
-        if (R_FAILED(data_struct->f.Write(data_struct->file_offset, contents, realsize, FsWriteOption_None))) {
-            return 0;
-        }
+    auto data_struct = static_cast<DataStruct*>(userp);
+    const auto realsize = size * num_files;
 
-        data_struct->file_offset += realsize;
-    } else {
-        // buffer data until later
-        std::memcpy(data_struct->data.data() + data_struct->offset, contents, realsize);
-        data_struct->offset += realsize;
+    // only blocks if the writer has fallen behind.
+    if (!g_file_writer.Write(data_struct->stream, contents, realsize)) {
+        return 0;
     }
 
     Yield();
@@ -571,6 +1241,34 @@ auto header_callback(char* b, size_t size, size_t nitems, void* userdata) -> siz
     return numbytes;
 }
 
+// the key is scheme://host:port, so handles are only reused for the same server.
+auto GetPoolKey(const std::string& url) -> std::string {
+    auto clu = curl_url();
+    R_UNLESS(clu, url);
+    ON_SCOPE_EXIT(curl_url_cleanup(clu));
+
+    if (CURLUE_OK != curl_url_set(clu, CURLUPART_URL, url.c_str(), CURLU_GUESS_SCHEME | CURLU_NON_SUPPORT_SCHEME)) {
+        return url;
+    }
+
+    std::string key;
+    const auto append_part = [clu, &key](CURLUPart part, u32 flags) {
+        char* str{};
+        if (CURLUE_OK == curl_url_get(clu, part, &str, flags) && str) {
+            key += str;
+            curl_free(str);
+        }
+    };
+
+    append_part(CURLUPART_SCHEME, 0);
+    key += "://";
+    append_part(CURLUPART_HOST, 0);
+    key += ':';
+    append_part(CURLUPART_PORT, CURLU_DEFAULT_PORT);
+
+    return key;
+}
+
 auto EscapeString(CURL* curl, const std::string& str) -> std::string {
     char* s{};
     if (!curl) {
@@ -678,266 +1376,752 @@ void SetCommonCurlOptions(CURL* curl, const Api& e) {
     } else {
         CURL_EASY_SETOPT_LOG(curl, CURLOPT_XFERINFOFUNCTION, ProgressCallbackFunc1);
     }
+}
+
+// state for a single transfer, the curl callbacks point into this so it
+// must stay alive (and not move) until the transfer has finished.
+struct Transfer {
+    Transfer(CURL* _curl, const Api& _api, bool _is_upload) : curl{_curl}, api{_api}, is_upload{_is_upload} {}
+
+    ~Transfer() {
+        if (list) {
+            curl_slist_free_all(list);
+        }
+
+        if (auto_sleep_disabled) {
+            App::SetAutoSleepDisabled(false);
+        }
+    }
+
+    CURL* const curl;
+    const Api& api;
+    const bool is_upload;
+    std::string url{};
+    fs::FsNativeSd fs{};
+    fs::FsPath tmp_buf{};
+    DataStruct chunk{}; // downloaded data, or the response of an upload.
+    UploadStruct upload{};
+    SeekCustomData seek_data{};
+    Header header_out{};
+    curl_slist* list{};
+    bool has_file{};
+    bool auto_sleep_disabled{};
+    bool fresh{}; // cached file is still fresh, no request is needed.
+};
+
+void SetHeaders(CURL* curl, curl_slist*& list, const Header& header_in) {
+    for (const auto& [key, value] : header_in.m_map) {
+        if (value.empty()) {
+            continue;
+        }
 
+        // create header key value pair.
+        const auto header_str = key + ": " + value;
+
+        // try to append header chunk.
+        auto temp = curl_slist_append(list, header_str.c_str());
+        if (temp) {
+            log_write("adding header: %s\n", header_str.c_str());
+            list = temp;
+        } else {
+            log_write("failed to append header\n");
+        }
+    }
+
+    if (list) {
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_HTTPHEADER, list);
+    }
 }
-auto DownloadInternal(CURL* curl, const Api& e) -> ApiResult {
-    App::SetAutoSleepDisabled(true);
-    ON_SCOPE_EXIT(App::SetAutoSleepDisabled(false));
+
+auto DownloadSetup(Transfer& t) -> bool {
+    const auto& e = t.api;
+    auto curl = t.curl;
 
     // check if stop has been requested before starting download
-    if (e.GetToken().stop_requested()) {
-        return {};
+    if (e.IsStopped()) {
+        return false;
     }
 
-    fs::FsPath tmp_buf;
-    const bool has_file = !e.GetPath().empty() && e.GetPath() != "";
+    App::SetAutoSleepDisabled(true);
+    t.auto_sleep_disabled = true;
+
+    t.has_file = !e.GetPath().empty() && e.GetPath() != "";
     const bool has_post = !e.GetFields().empty() && e.GetFields() != "";
-    const auto encoded_url = EncodeUrl(e.GetUrl());
+    t.url = EncodeUrl(e.GetUrl());
 
-    DataStruct chunk;
     Header header_in = e.GetHeader();
-    Header header_out;
-    fs::FsNativeSd fs;
-
-    if (has_file) {
-        GetDownloadTempPath(tmp_buf);
-        fs.CreateDirectoryRecursivelyWithPath(tmp_buf);
 
-        if (auto rc = fs.CreateFile(tmp_buf, 0, 0); R_FAILED(rc) && rc != FsError_PathAlreadyExists) {
-            log_write("failed to create file: %s\n", tmp_buf.s);
-            return {};
+    if (t.has_file) {
+        // only add etag if the dst file still exists.
+        if ((e.GetFlags() & Flag_Cache) && fs::FileExists(&t.fs.m_fs, e.GetPath())) {
+            if (g_cache.get(e.GetPath(), header_in)) {
+                t.fresh = true;
+                return true;
+            }
         }
 
-        if (R_FAILED(fs.OpenFile(tmp_buf, FsOpenMode_Write|FsOpenMode_Append, &chunk.f))) {
-            log_write("failed to open file: %s\n", tmp_buf.s);
-            return {};
+        GetDownloadTempPath(t.tmp_buf);
+        t.fs.CreateDirectoryRecursivelyWithPath(t.tmp_buf);
+
+        if (auto rc = t.fs.CreateFile(t.tmp_buf, 0, 0); R_FAILED(rc) && rc != FsError_PathAlreadyExists) {
+            log_write("failed to create file: %s\n", t.tmp_buf.s);
+            return false;
         }
 
-        // only add etag if the dst file still exists.
-        if ((e.GetFlags() & Flag_Cache) && fs::FileExists(&fs.m_fs, e.GetPath())) {
-            g_cache.get(e.GetPath(), header_in);
+        if (R_FAILED(t.fs.OpenFile(t.tmp_buf, FsOpenMode_Write|FsOpenMode_Append, &t.chunk.f))) {
+            log_write("failed to open file: %s\n", t.tmp_buf.s);
+            return false;
         }
+
+        t.chunk.stream.f = &t.chunk.f;
     }
 
     // reserve the first chunk
-    chunk.data.reserve(CHUNK_SIZE);
+    t.chunk.data.reserve(CHUNK_SIZE);
 
     curl_easy_reset(curl);
     SetCommonCurlOptions(curl, e);
 
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_URL, encoded_url.c_str());
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_URL, t.url.c_str());
     CURL_EASY_SETOPT_LOG(curl, CURLOPT_HEADERFUNCTION, header_callback);
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_HEADERDATA, &header_out);
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_HEADERDATA, &t.header_out);
 
     if (has_post) {
         CURL_EASY_SETOPT_LOG(curl, CURLOPT_POSTFIELDS, e.GetFields().c_str());
         log_write("setting post field: %s\n", e.GetFields().c_str());
     }
 
-    struct curl_slist* list = NULL;
-    ON_SCOPE_EXIT(if (list) { curl_slist_free_all(list); } );
+    if (const auto& range = e.GetRange(); range.m_size > 0) {
+        char range_str[64];
+        if (range.m_off < 0) {
+            std::snprintf(range_str, sizeof(range_str), "-%ld", range.m_size);
+        } else {
+            std::snprintf(range_str, sizeof(range_str), "%ld-%ld", range.m_off, range.m_off + range.m_size - 1);
+        }
+
+        // ranges apply to the encoded data, so compression must be disabled.
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_ACCEPT_ENCODING, nullptr);
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_RANGE, range_str);
+    }
+
+    if (e.GetMaxSpeed() > 0) {
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_MAX_RECV_SPEED_LARGE, (curl_off_t)e.GetMaxSpeed());
+    }
+
+    SetHeaders(curl, t.list, header_in);
+
+    // write calls.
+    if (!t.has_file && e.GetOnDownloadData()) {
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEFUNCTION, WriteDataCallback);
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEDATA, &e);
+    } else {
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEFUNCTION, t.has_file ? WriteFileCallback : WriteMemoryCallback);
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEDATA, &t.chunk);
+    }
+    return true;
+}
+
+auto DownloadFinish(Transfer& t, CURLcode res) -> ApiResult {
+    const auto& e = t.api;
+    auto& chunk = t.chunk;
+    bool success = res == CURLE_OK;
+
+    if (t.fresh) {
+        log_write("fresh cached download: %s\n", e.GetUrl().c_str());
+        return {true, 304, {}, {}, e.GetPath()};
+    }
+
+    long http_code = 0;
+    curl_easy_getinfo(t.curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+    if (t.has_file) {
+        ON_SCOPE_EXIT( t.fs.DeleteFile(t.tmp_buf) );
+
+        // the file must not be closed until all queued writes are done.
+        if (!g_file_writer.Flush(chunk.stream)) {
+            success = false;
+        }
+
+        chunk.f.Close();
+
+        if (success) {
+            if (http_code == 304) {
+                log_write("cached download: %s\n", e.GetUrl().c_str());
+                if (e.GetFlags() & Flag_Cache) {
+                    g_cache.revalidated(e.GetPath(), t.header_out);
+                }
+            } else {
+                log_write("un-cached download: %s code: %lu\n", e.GetUrl().c_str(), http_code);
+                if (e.GetFlags() & Flag_Cache) {
+                    g_cache.set(e.GetPath(), t.header_out, FileWriter::GetOffset(chunk.stream));
+                }
+
+                // enable to log received headers.
+                #if 0
+                log_write("\n\nLOGGING HEADER\n");
+                    for (auto [a, b] : t.header_out.m_map) {
+                        log_write("\t%s: %s\n", a.c_str(), b.c_str());
+                    }
+                log_write("\n\n");
+                #endif
+
+                t.fs.DeleteFile(e.GetPath());
+                t.fs.CreateDirectoryRecursivelyWithPath(e.GetPath());
+                if (R_FAILED(t.fs.RenameFile(t.tmp_buf, e.GetPath()))) {
+                    success = false;
+                }
+            }
+        }
+        chunk.data.clear();
+    } else {
+        // empty data if we failed
+        if (res != CURLE_OK) {
+            chunk.data.clear();
+        }
+    }
+
+    log_write("Downloaded %s code: %ld %s\n", e.GetUrl().c_str(), http_code, curl_easy_strerror(res));
+    return {success, http_code, t.header_out, std::move(chunk.data), e.GetPath()};
+}
+
+auto UploadSetup(Transfer& t) -> bool {
+    const auto& e = t.api;
+    auto curl = t.curl;
+    auto& chunk = t.upload;
+
+    // check if stop has been requested before starting download
+    if (e.IsStopped()) {
+        return false;
+    }
+
+    const auto& info = e.GetUploadInfo();
+    const auto url = e.GetUrl() + "/" + info.m_name;
+    t.url = EncodeUrl(url);
+    t.has_file = !e.GetPath().empty() && e.GetPath() != "";
+
+    if (t.has_file) {
+        if (R_FAILED(t.fs.OpenFile(e.GetPath(), FsOpenMode_Read, &chunk.f))) {
+            log_write("failed to open file: %s\n", e.GetPath().s);
+            return false;
+        }
+
+        chunk.f.GetSize(&chunk.size);
+        log_write("got chunk size: %zd\n", chunk.size);
+    } else {
+        if (info.m_callback) {
+            chunk.size = info.m_size;
+            log_write("setting upload size: %zu\n", chunk.size);
+        } else {
+            chunk.size = info.m_data.size();
+            chunk.data = info.m_data;
+        }
+    }
+
+    if (url.starts_with("file://")) {
+        const auto folder_path = fs::AppendPath("/", url.substr(std::strlen("file://")));
+        log_write("creating local folder: %s\n", folder_path.s);
+        // create the folder as libcurl doesn't seem to manually create it.
+        t.fs.CreateDirectoryRecursivelyWithPath(folder_path);
+        // remove the path so that libcurl can upload over it.
+        t.fs.DeleteFile(folder_path);
+    }
+
+    // reserve the first chunk
+    t.chunk.data.reserve(CHUNK_SIZE);
+
+    curl_easy_reset(curl);
+    SetCommonCurlOptions(curl, e);
+
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_URL, t.url.c_str());
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_HEADERDATA, &t.header_out);
+
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_UPLOAD, 1L);
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)chunk.size);
+
+    // instruct libcurl to create ftp folders if they don't yet exist.
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_FTP_CREATE_MISSING_DIRS, CURLFTP_CREATE_DIR_RETRY);
+
+    SetHeaders(curl, t.list, e.GetHeader());
+
+    // set callback for reading more data.
+    if (info.m_callback) {
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_READFUNCTION, ReadCustomCallback);
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_READDATA, &info);
+
+        if (e.GetOnUploadSeek()) {
+            t.seek_data.cb = e.GetOnUploadSeek();
+            t.seek_data.size = chunk.size;
+            CURL_EASY_SETOPT_LOG(curl, CURLOPT_SEEKFUNCTION, SeekCustomCallback);
+            CURL_EASY_SETOPT_LOG(curl, CURLOPT_SEEKDATA, &t.seek_data);
+        }
+    } else {
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_READFUNCTION, t.has_file ? ReadFileCallback : ReadMemoryCallback);
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_READDATA, &chunk);
+
+        // allow for seeking upon uploads, may be used for ftp and http.
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_SEEKFUNCTION, SeekCallback);
+        CURL_EASY_SETOPT_LOG(curl, CURLOPT_SEEKDATA, &chunk);
+    }
+
+    // write calls.
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEDATA, &t.chunk);
+    return true;
+}
+
+auto UploadFinish(Transfer& t, CURLcode res) -> ApiResult {
+    const bool success = res == CURLE_OK;
+
+    long http_code = 0;
+    curl_easy_getinfo(t.curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+    if (t.has_file) {
+        t.upload.f.Close();
+    }
+
+    log_write("Uploaded %s code: %ld %s\n", t.url.c_str(), http_code, curl_easy_strerror(res));
+    return {success, http_code, t.header_out, std::move(t.chunk.data)};
+}
+
+auto TransferSetup(Transfer& t) -> bool {
+    return t.is_upload ? UploadSetup(t) : DownloadSetup(t);
+}
+
+auto TransferFinish(Transfer& t, CURLcode res) -> ApiResult {
+    return t.is_upload ? UploadFinish(t, res) : DownloadFinish(t, res);
+}
+
+auto PerformWithPool(const Api& e, bool is_upload) -> ApiResult {
+    auto curl = PoolAcquire(e.GetUrl());
+    if (!curl) {
+        log_write("failed to acquire curl handle\n");
+        return {};
+    }
+    ON_SCOPE_EXIT(PoolRelease(e.GetUrl(), curl));
+
+    Transfer t{curl, e, is_upload};
+    if (!TransferSetup(t)) {
+        return {};
+    }
+
+    if (t.fresh) {
+        return TransferFinish(t, CURLE_OK);
+    }
+
+    return TransferFinish(t, curl_easy_perform(curl));
+}
+
+// files smaller than this are downloaded in one go.
+constexpr s64 RESUME_MIN_SIZE = 1024 * 1024 * 8;
+constexpr s64 RESUME_SEGMENT_SIZE = 1024 * 1024 * 4;
+constexpr size_t RESUME_CONNECTIONS = 4;
+constexpr u32 RESUME_MAX_RETRIES = 3;
+
+constexpr u32 JOURNAL_MAGIC = 0x4A445053; // SPDJ
+constexpr u32 JOURNAL_VERSION = 1;
+
+// sidecar saved next to the partial file, followed by a byte per segment
+// which is set once that segment has been written.
+struct JournalHeader {
+    u32 magic;
+    u32 version;
+    u32 url_crc;
+    u32 segment_count;
+    s64 size;
+    s64 segment_size;
+    char etag[128];
+    char last_modified[64];
+};
+
+struct ResumeInfo {
+    std::string url{}; // effective url, after redirects.
+    s64 size{};
+    std::string etag{};
+    std::string last_modified{};
+};
+
+struct Segment {
+    u32 index{};
+    s64 start{};
+    s64 end{};
+    u32 retries{};
+    WriteStream stream{}; // offset is where the segment continues from.
+    CURL* curl{};
+    curl_slist* list{};
+};
+
+void GetResumePaths(const fs::FsPath& path, fs::FsPath& part, fs::FsPath& journal) {
+    const auto key = generate_key_from_path(path);
+    std::snprintf(part, sizeof(part), "/switch/sphaira/cache/resume/%s.part", key.c_str());
+    std::snprintf(journal, sizeof(journal), "/switch/sphaira/cache/resume/%s.journal", key.c_str());
+}
+
+auto ProbeWriteCallback(void *contents, size_t size, size_t num_files, void *userp) -> size_t {
+    auto count = static_cast<s64*>(userp);
+    const auto realsize = size * num_files;
+
+    // the range was ignored and the whole file is being sent.
+    *count += realsize;
+    if (*count > 1) {
+        return 0;
+    }
+
+    return realsize;
+}
+
+// requests the first byte to check that ranges are supported and to get the
+// size and validators of the file.
+auto ProbeResume(CURL* curl, const Api& e, ResumeInfo& out) -> bool {
+    Header header_out;
+    curl_slist* list{};
+    ON_SCOPE_EXIT(if (list) { curl_slist_free_all(list); } );
+    s64 count{};
+
+    const auto url = EncodeUrl(e.GetUrl());
+    curl_easy_reset(curl);
+    SetCommonCurlOptions(curl, e);
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_NOPROGRESS, 1L);
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_URL, url.c_str());
+    // ranges apply to the encoded data, so compression must be disabled.
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_ACCEPT_ENCODING, nullptr);
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_RANGE, "0-0");
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_HEADERDATA, &header_out);
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEFUNCTION, ProbeWriteCallback);
+    CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEDATA, &count);
+    SetHeaders(curl, list, e.GetHeader());
+
+    curl_easy_perform(curl);
+
+    long http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code != 206) {
+        log_write("[RESUME] ranges not supported, code: %ld\n", http_code);
+        return false;
+    }
+
+    // Content-Range: bytes 0-0/1234
+    const auto it = header_out.Find("content-range");
+    if (it == header_out.m_map.end()) {
+        return false;
+    }
+
+    const auto slash = it->second.rfind('/');
+    if (slash == std::string::npos) {
+        return false;
+    }
+
+    out.size = std::strtoll(it->second.c_str() + slash + 1, nullptr, 10);
+
+    char* effective_url{};
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+    out.url = effective_url ? effective_url : url;
+
+    if (auto v = header_out.Find("etag"); v != header_out.m_map.end()) {
+        out.etag = v->second;
+    }
+    if (auto v = header_out.Find("last-modified"); v != header_out.m_map.end()) {
+        out.last_modified = v->second;
+    }
+
+    log_write("[RESUME] size: %zd etag: %s last-modified: %s\n", out.size, out.etag.c_str(), out.last_modified.c_str());
+    return true;
+}
+
+// loads the journal, returns false if it's missing or doesn't match the file on the server.
+auto LoadJournal(fs::Fs& fs, const fs::FsPath& path, const JournalHeader& expected, std::vector<u8>& done) -> bool {
+    std::vector<u8> data;
+    if (R_FAILED(fs.read_entire_file(path, data)) || data.size() != sizeof(JournalHeader) + expected.segment_count) {
+        return false;
+    }
+
+    JournalHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    // without a validator there's no way to know if the partial data is still valid.
+    if (!expected.etag[0] && !expected.last_modified[0]) {
+        log_write("[RESUME] no etag or last-modified, not resuming\n");
+        return false;
+    }
+
+    if (header.magic != expected.magic || header.version != expected.version ||
+        header.url_crc != expected.url_crc || header.segment_count != expected.segment_count ||
+        header.size != expected.size || header.segment_size != expected.segment_size ||
+        std::strncmp(header.etag, expected.etag, sizeof(header.etag)) ||
+        std::strncmp(header.last_modified, expected.last_modified, sizeof(header.last_modified))) {
+        log_write("[RESUME] journal does not match, not resuming\n");
+        return false;
+    }
+
+    done.assign(data.begin() + sizeof(header), data.end());
+    return true;
+}
+
+void SaveJournal(fs::Fs& fs, const fs::FsPath& path, const JournalHeader& header, std::span<const u8> done) {
+    std::vector<u8> data(sizeof(header) + done.size());
+    std::memcpy(data.data(), &header, sizeof(header));
+    std::memcpy(data.data() + sizeof(header), done.data(), done.size());
 
-    for (const auto& [key, value] : header_in.m_map) {
-        if (value.empty()) {
-            continue;
-        }
+    if (R_FAILED(fs.write_entire_file(path, data))) {
+        log_write("[RESUME] failed to save journal: %s\n", path.s);
+    }
+}
 
-        // create header key value pair.
-        const auto header_str = key + ": " + value;
+auto SegmentWriteCallback(void *contents, size_t size, size_t num_files, void *userp) -> size_t {
+    if (!g_running) {
+        return 0;
+    }
 
-        // try to append header chunk.
-        auto temp = curl_slist_append(list, header_str.c_str());
-        if (temp) {
-            log_write("adding header: %s\n", header_str.c_str());
-            list = temp;
-        } else {
-            log_write("failed to append header\n");
-        }
+    auto segment = static_cast<Segment*>(userp);
+    const auto realsize = size * num_files;
+
+    // more data than was asked for, the range was ignored.
+    if (FileWriter::GetOffset(segment->stream) + (s64)realsize > segment->end) {
+        log_write("[RESUME] segment %u overflow\n", segment->index);
+        return 0;
     }
 
-    if (list) {
-        CURL_EASY_SETOPT_LOG(curl, CURLOPT_HTTPHEADER, list);
+    if (!g_file_writer.Write(segment->stream, contents, realsize)) {
+        return 0;
     }
 
-    // write calls.
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEFUNCTION, has_file ? WriteFileCallback : WriteMemoryCallback);
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEDATA, &chunk);
+    return realsize;
+}
 
-    // perform download and cleanup after and report the result.
-    const auto res = curl_easy_perform(curl);
-    bool success = res == CURLE_OK;
+void SetupSegment(Segment& s, const Api& e, const ResumeInfo& info) {
+    char range[64];
+    std::snprintf(range, sizeof(range), "%ld-%ld", s.stream.offset, s.end - 1);
+
+    curl_easy_reset(s.curl);
+    SetCommonCurlOptions(s.curl, e);
+    CURL_EASY_SETOPT_LOG(s.curl, CURLOPT_NOPROGRESS, 1L);
+    CURL_EASY_SETOPT_LOG(s.curl, CURLOPT_URL, info.url.c_str());
+    CURL_EASY_SETOPT_LOG(s.curl, CURLOPT_ACCEPT_ENCODING, nullptr);
+    CURL_EASY_SETOPT_LOG(s.curl, CURLOPT_RANGE, range);
+    CURL_EASY_SETOPT_LOG(s.curl, CURLOPT_WRITEFUNCTION, SegmentWriteCallback);
+    CURL_EASY_SETOPT_LOG(s.curl, CURLOPT_WRITEDATA, &s);
+
+    // if the file changed since the probe, the server sends the whole file
+    // rather than the range, which is then detected as an overflow.
+    auto header = e.GetHeader();
+    if (!info.etag.empty()) {
+        header.m_map.emplace("If-Range", info.etag);
+    } else if (!info.last_modified.empty()) {
+        header.m_map.emplace("If-Range", info.last_modified);
+    }
+
+    if (s.list) {
+        curl_slist_free_all(s.list);
+        s.list = nullptr;
+    }
+    SetHeaders(s.curl, s.list, header);
+}
 
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+// returns std::nullopt if the download should fallback to a normal download.
+auto DownloadResume(const Api& e) -> std::optional<ApiResult> {
+    if (e.IsStopped()) {
+        return ApiResult{};
+    }
 
-    if (has_file) {
-        ON_SCOPE_EXIT( fs.DeleteFile(tmp_buf) );
-        if (res == CURLE_OK && chunk.offset) {
-            chunk.f.Write(chunk.file_offset, chunk.data.data(), chunk.offset, FsWriteOption_None);
+    ResumeInfo info{};
+    {
+        auto curl = PoolAcquire(e.GetUrl());
+        if (!curl) {
+            return std::nullopt;
         }
+        ON_SCOPE_EXIT(PoolRelease(e.GetUrl(), curl));
 
-        chunk.f.Close();
-
-        if (res == CURLE_OK) {
-            if (http_code == 304) {
-                log_write("cached download: %s\n", e.GetUrl().c_str());
-            } else {
-                log_write("un-cached download: %s code: %lu\n", e.GetUrl().c_str(), http_code);
-                if (e.GetFlags() & Flag_Cache) {
-                    g_cache.set(e.GetPath(), header_out);
-                }
+        if (!ProbeResume(curl, e, info) || info.size < RESUME_MIN_SIZE) {
+            return std::nullopt;
+        }
+    }
 
-                // enable to log received headers.
-                #if 0
-                log_write("\n\nLOGGING HEADER\n");
-                    for (auto [a, b] : header_out.m_map) {
-                        log_write("\t%s: %s\n", a.c_str(), b.c_str());
-                    }
-                log_write("\n\n");
-                #endif
+    App::SetAutoSleepDisabled(true);
+    ON_SCOPE_EXIT(App::SetAutoSleepDisabled(false));
 
-                fs.DeleteFile(e.GetPath());
-                fs.CreateDirectoryRecursivelyWithPath(e.GetPath());
-                if (R_FAILED(fs.RenameFile(tmp_buf, e.GetPath()))) {
-                    success = false;
-                }
-            }
+    fs::FsNativeSd fs;
+    fs::FsPath part_path, journal_path;
+    GetResumePaths(e.GetPath(), part_path, journal_path);
+    fs.CreateDirectoryRecursivelyWithPath(part_path);
+
+    JournalHeader header{};
+    header.magic = JOURNAL_MAGIC;
+    header.version = JOURNAL_VERSION;
+    header.url_crc = crc32Calculate(e.GetUrl().data(), e.GetUrl().size());
+    header.size = info.size;
+    header.segment_size = RESUME_SEGMENT_SIZE;
+    header.segment_count = (info.size + RESUME_SEGMENT_SIZE - 1) / RESUME_SEGMENT_SIZE;
+    std::strncpy(header.etag, info.etag.c_str(), sizeof(header.etag) - 1);
+    std::strncpy(header.last_modified, info.last_modified.c_str(), sizeof(header.last_modified) - 1);
+
+    const auto get_part_size = [&fs, &part_path]() -> s64 {
+        fs::File f;
+        s64 size{};
+        if (R_FAILED(fs.OpenFile(part_path, FsOpenMode_Read, &f)) || R_FAILED(f.GetSize(&size))) {
+            return -1;
         }
-        chunk.data.clear();
+        return size;
+    };
+
+    std::vector<u8> done;
+    if (LoadJournal(fs, journal_path, header, done) && get_part_size() == info.size) {
+        log_write("[RESUME] resuming download: %s\n", e.GetPath().s);
     } else {
-        // empty data if we failed
-        if (res != CURLE_OK) {
-            chunk.data.clear();
+        done.assign(header.segment_count, 0);
+        fs.DeleteFile(part_path);
+        // preallocate so that segments can be written at any offset.
+        if (R_FAILED(fs.CreateFile(part_path, info.size, 0))) {
+            log_write("[RESUME] failed to create file: %s\n", part_path.s);
+            return ApiResult{};
         }
+        SaveJournal(fs, journal_path, header, done);
     }
 
-    log_write("Downloaded %s code: %ld %s\n", e.GetUrl().c_str(), http_code, curl_easy_strerror(res));
-    return {success, http_code, header_out, chunk.data, e.GetPath()};
-}
-
-auto UploadInternal(CURL* curl, const Api& e) -> ApiResult {
-    // check if stop has been requested before starting download
-    if (e.GetToken().stop_requested()) {
-        return {};
+    fs::File f;
+    if (R_FAILED(fs.OpenFile(part_path, FsOpenMode_Write, &f))) {
+        log_write("[RESUME] failed to open file: %s\n", part_path.s);
+        return ApiResult{};
     }
 
-    const auto& info = e.GetUploadInfo();
-    const auto url = e.GetUrl() + "/" + info.m_name;
-    const auto encoded_url = EncodeUrl(url);
-    const bool has_file = !e.GetPath().empty() && e.GetPath() != "";
-
-    UploadStruct chunk{};
-    DataStruct chunk_out{};
-    SeekCustomData seek_data{};
-    Header header_in = e.GetHeader();
-    Header header_out;
-    fs::FsNativeSd fs{};
+    std::vector<Segment> segments(header.segment_count);
+    std::deque<Segment*> pending;
+    s64 done_size{};
 
-    if (has_file) {
-        if (R_FAILED(fs.OpenFile(e.GetPath(), FsOpenMode_Read, &chunk.f))) {
-            log_write("failed to open file: %s\n", e.GetPath().s);
-            return {};
-        }
+    for (u32 i = 0; i < header.segment_count; i++) {
+        auto& s = segments[i];
+        s.index = i;
+        s.start = (s64)i * RESUME_SEGMENT_SIZE;
+        s.end = std::min<s64>(s.start + RESUME_SEGMENT_SIZE, info.size);
+        s.stream.f = &f;
+        s.stream.offset = s.start;
 
-        chunk.f.GetSize(&chunk.size);
-        log_write("got chunk size: %zd\n", chunk.size);
-    } else {
-        if (info.m_callback) {
-            chunk.size = info.m_size;
-            log_write("setting upload size: %zu\n", chunk.size);
+        if (done[i]) {
+            done_size += s.end - s.start;
         } else {
-            chunk.size = info.m_data.size();
-            chunk.data = info.m_data;
+            pending.emplace_back(&s);
         }
     }
 
-    if (url.starts_with("file://")) {
-        const auto folder_path = fs::AppendPath("/", url.substr(std::strlen("file://")));
-        log_write("creating local folder: %s\n", folder_path.s);
-        // create the folder as libcurl doesn't seem to manually create it.
-        fs.CreateDirectoryRecursivelyWithPath(folder_path);
-        // remove the path so that libcurl can upload over it.
-        fs.DeleteFile(folder_path);
+    auto multi = curl_multi_init();
+    if (!multi) {
+        log_write("[RESUME] curl_multi_init() failed\n");
+        return ApiResult{};
     }
 
-    // reserve the first chunk
-    chunk_out.data.reserve(CHUNK_SIZE);
+    std::vector<Segment*> active;
+    bool failed{};
 
-    curl_easy_reset(curl);
-    SetCommonCurlOptions(curl, e);
+    while (!failed && (!pending.empty() || !active.empty())) {
+        while (active.size() < RESUME_CONNECTIONS && !pending.empty()) {
+            auto s = pending.front();
+            s->curl = PoolAcquire(info.url);
+            if (!s->curl) {
+                failed = true;
+                break;
+            }
 
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_URL, encoded_url.c_str());
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_HEADERFUNCTION, header_callback);
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_HEADERDATA, &header_out);
+            pending.pop_front();
+            SetupSegment(*s, e, info);
+            curl_multi_add_handle(multi, s->curl);
+            active.emplace_back(s);
+        }
 
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_UPLOAD, 1L);
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)chunk.size);
+        int running{};
+        curl_multi_perform(multi, &running);
 
-    // instruct libcurl to create ftp folders if they don't yet exist.
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_FTP_CREATE_MISSING_DIRS, CURLFTP_CREATE_DIR_RETRY);
+        CURLMsg* msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
 
-    struct curl_slist* list = NULL;
-    ON_SCOPE_EXIT(if (list) { curl_slist_free_all(list); } );
+            const auto it = std::ranges::find_if(active, [msg](auto s) {
+                return s->curl == msg->easy_handle;
+            });
 
-    for (const auto& [key, value] : header_in.m_map) {
-        if (value.empty()) {
-            continue;
-        }
+            if (it == active.end()) {
+                continue;
+            }
 
-        // create header key value pair.
-        const auto header_str = key + ": " + value;
+            auto s = *it;
+            active.erase(it);
+
+            long http_code = 0;
+            curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &http_code);
+            curl_multi_remove_handle(multi, s->curl);
+            PoolRelease(info.url, s->curl);
+            s->curl = nullptr;
+
+            // the segment is only marked as done once it's on the sd card.
+            const auto flushed = g_file_writer.Flush(s->stream);
+            if (msg->data.result == CURLE_OK && http_code == 206 && flushed && s->stream.offset == s->end) {
+                done[s->index] = 1;
+                done_size += s->end - s->start;
+                SaveJournal(fs, journal_path, header, done);
+            } else if (++s->retries < RESUME_MAX_RETRIES && http_code != 200 && flushed) {
+                // continues from what was written.
+                log_write("[RESUME] retrying segment: %u code: %ld %s\n", s->index, http_code, curl_easy_strerror(msg->data.result));
+                pending.emplace_back(s);
+            } else {
+                log_write("[RESUME] segment failed: %u code: %ld %s\n", s->index, http_code, curl_easy_strerror(msg->data.result));
+                failed = true;
+            }
+        }
 
-        // try to append header chunk.
-        auto temp = curl_slist_append(list, header_str.c_str());
-        if (temp) {
-            log_write("adding header: %s\n", header_str.c_str());
-            list = temp;
-        } else {
-            log_write("failed to append header\n");
+        if (!g_running || e.IsStopped()) {
+            failed = true;
         }
-    }
 
-    if (list) {
-        CURL_EASY_SETOPT_LOG(curl, CURLOPT_HTTPHEADER, list);
-    }
+        if (e.GetOnProgress()) {
+            s64 dlnow = done_size;
+            for (auto s : active) {
+                dlnow += FileWriter::GetOffset(s->stream) - s->start;
+            }
 
-    // set callback for reading more data.
-    if (info.m_callback) {
-        CURL_EASY_SETOPT_LOG(curl, CURLOPT_READFUNCTION, ReadCustomCallback);
-        CURL_EASY_SETOPT_LOG(curl, CURLOPT_READDATA, &info);
+            if (!e.GetOnProgress()(info.size, dlnow, 0, 0)) {
+                failed = true;
+            }
+        }
 
-        if (e.GetOnUploadSeek()) {
-            seek_data.cb = e.GetOnUploadSeek();
-            seek_data.size = chunk.size;
-            CURL_EASY_SETOPT_LOG(curl, CURLOPT_SEEKFUNCTION, SeekCustomCallback);
-            CURL_EASY_SETOPT_LOG(curl, CURLOPT_SEEKDATA, &seek_data);
+        if (running && !failed) {
+            curl_multi_wait(multi, nullptr, 0, 1000, nullptr);
         }
-    } else {
-        CURL_EASY_SETOPT_LOG(curl, CURLOPT_READFUNCTION, has_file ? ReadFileCallback : ReadMemoryCallback);
-        CURL_EASY_SETOPT_LOG(curl, CURLOPT_READDATA, &chunk);
+    }
 
-        // allow for seeking upon uploads, may be used for ftp and http.
-        CURL_EASY_SETOPT_LOG(curl, CURLOPT_SEEKFUNCTION, SeekCallback);
-        CURL_EASY_SETOPT_LOG(curl, CURLOPT_SEEKDATA, &chunk);
+    // written data is kept, the journal only marks completed segments.
+    for (auto s : active) {
+        curl_multi_remove_handle(multi, s->curl);
+        PoolRelease(info.url, s->curl);
+        g_file_writer.Flush(s->stream);
     }
 
-    // write calls.
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-    CURL_EASY_SETOPT_LOG(curl, CURLOPT_WRITEDATA, &chunk_out);
+    for (auto& s : segments) {
+        if (s.list) {
+            curl_slist_free_all(s.list);
+        }
+    }
 
-    // perform upload and cleanup after and report the result.
-    const auto res = curl_easy_perform(curl);
-    bool success = res == CURLE_OK;
+    curl_multi_cleanup(multi);
+    f.Close();
 
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (failed) {
+        log_write("[RESUME] download failed, can be resumed: %s\n", e.GetUrl().c_str());
+        return ApiResult{};
+    }
 
-    if (has_file) {
-        chunk.f.Close();
+    fs.DeleteFile(journal_path);
+    fs.DeleteFile(e.GetPath());
+    fs.CreateDirectoryRecursivelyWithPath(e.GetPath());
+    if (R_FAILED(fs.RenameFile(part_path, e.GetPath()))) {
+        log_write("[RESUME] failed to rename: %s\n", e.GetPath().s);
+        fs.DeleteFile(part_path);
+        return ApiResult{};
     }
 
-    log_write("Uploaded %s code: %ld %s\n", url.c_str(), http_code, curl_easy_strerror(res));
-    return {success, http_code, header_out, chunk_out.data};
+    log_write("[RESUME] Downloaded %s\n", e.GetUrl().c_str());
+    return ApiResult{true, 200, {}, {}, e.GetPath()};
 }
 
 void my_lock(CURL *handle, curl_lock_data data, curl_lock_access laccess, void *useptr) {
@@ -948,95 +2132,200 @@ void my_unlock(CURL *handle, curl_lock_data data, void *useptr) {
     mutexUnlock(&g_mutex_share[data]);
 }
 
-void ThreadEntry::ThreadFunc(void* p) {
-    auto data = static_cast<ThreadEntry*>(p);
+struct MultiEntry {
+    MultiEntry(CURL* curl, ThreadQueueEntry&& entry)
+    : api{std::move(entry.api)}
+    , key{std::move(entry.key)}
+    , transfer{curl, api, api.IsUpload()} {
 
-    if (!g_cache.init()) {
-        log_write("failed to init json cache\n");
     }
-    ON_SCOPE_EXIT(g_cache.exit());
 
-    while (g_running) {
-        auto rc = waitSingle(waiterForUEvent(&data->m_uevent), UINT64_MAX);
-        // log_write("woke up\n");
-        if (!g_running) {
-            break;
+    const Api api;
+    const std::string key;
+    Transfer transfer;
+};
+
+void PushResult(const Api& api, ApiResult& result) {
+    if (g_running && api.GetOnComplete() && !api.IsStopped()) {
+        evman::push(
+            DownloadEventData{api.GetOnComplete(), result, api.GetToken(), api.GetHandle()},
+            false
+        );
+    }
+}
+
+void FinishEntry(CURLM* multi, MultiEntry& e, CURLcode res) {
+    curl_multi_remove_handle(multi, e.transfer.curl);
+    auto result = TransferFinish(e.transfer, res);
+    PoolRelease(e.api.GetUrl(), e.transfer.curl);
+    PushResult(e.api, result);
+}
+
+// entries with a handle can have their priority changed after being queued.
+auto GetQueuePriority(const Api& api) -> Priority {
+    return api.GetHandle().IsValid() ? api.GetHandle().GetPriority() : api.GetPriority();
+}
+
+// takes entries from the front of the queue, high priority entries first,
+// skipping those whose host is already at its limit so that one slow server
+// doesn't block the rest.
+void StartEntries(ThreadQueue* data, CURLM* multi, std::vector<std::unique_ptr<MultiEntry>>& active) {
+    std::vector<ThreadQueueEntry> entries;
+
+    {
+        SCOPED_MUTEX(&data->m_mutex);
+
+        for (const auto prio : {Priority::High, Priority::Normal}) {
+            for (auto it = data->m_entries.begin(); it != data->m_entries.end() && active.size() + entries.size() < MAX_TRANSFERS;) {
+                if (it->api.IsStopped()) {
+                    it = data->m_entries.erase(it);
+                    continue;
+                }
+
+                if (GetQueuePriority(it->api) != prio) {
+                    it++;
+                    continue;
+                }
+
+                if (it->key.empty()) {
+                    it->key = GetPoolKey(it->api.GetUrl());
+                }
+
+                const auto& key = it->key;
+                const size_t host_count = std::ranges::count_if(active, [&key](auto& e) { return e->key == key; }) +
+                    std::ranges::count_if(entries, [&key](auto& e) { return e.key == key; });
+
+                if (host_count >= MAX_TRANSFERS_PER_HOST) {
+                    it++;
+                    continue;
+                }
+
+                entries.emplace_back(std::move(*it));
+                it = data->m_entries.erase(it);
+            }
         }
+    }
 
-        if (R_FAILED(rc)) {
+    // setup is done outside of the lock as it may create files.
+    for (auto& entry : entries) {
+        auto curl = PoolAcquire(entry.api.GetUrl());
+        if (!curl) {
+            log_write("failed to acquire curl handle\n");
+            ApiResult result{};
+            PushResult(entry.api, result);
             continue;
         }
 
-        const auto result = data->m_api.IsUpload() ? UploadInternal(data->m_curl, data->m_api) : DownloadInternal(data->m_curl, data->m_api);
-        if (g_running && data->m_api.GetOnComplete() && !data->m_api.GetToken().stop_requested()) {
-            evman::push(
-                DownloadEventData{data->m_api.GetOnComplete(), result, data->m_api.GetToken()},
-                false
-            );
+        auto e = std::make_unique<MultiEntry>(curl, std::move(entry));
+        if (!TransferSetup(e->transfer)) {
+            PoolRelease(e->api.GetUrl(), curl);
+            ApiResult result{};
+            PushResult(e->api, result);
+            continue;
+        }
+
+        if (e->transfer.fresh) {
+            auto result = TransferFinish(e->transfer, CURLE_OK);
+            PoolRelease(e->api.GetUrl(), curl);
+            PushResult(e->api, result);
+            continue;
         }
 
-        data->m_in_progress = false;
-        // notify the queue that there's a space free
-        ueventSignal(&g_thread_queue.m_uevent);
+        if (auto mc = curl_multi_add_handle(multi, curl); mc != CURLM_OK) {
+            log_write("curl_multi_add_handle() failed: %s\n", curl_multi_strerror(mc));
+            auto result = TransferFinish(e->transfer, CURLE_FAILED_INIT);
+            PoolRelease(e->api.GetUrl(), curl);
+            PushResult(e->api, result);
+            continue;
+        }
+
+        active.emplace_back(std::move(e));
     }
-    log_write("exited download thread\n");
 }
 
 void ThreadQueue::ThreadFunc(void* p) {
     auto data = static_cast<ThreadQueue*>(p);
 
+    if (!g_cache.init()) {
+        log_write("failed to init json cache\n");
+    }
+    ON_SCOPE_EXIT(g_cache.exit());
+
+    auto multi = curl_multi_init();
+    if (!multi) {
+        log_write("curl_multi_init() failed\n");
+        return;
+    }
+
+    {
+        SCOPED_MUTEX(&data->m_mutex);
+        data->m_multi = multi;
+    }
+
+    std::vector<std::unique_ptr<MultiEntry>> active;
+
     while (g_running) {
-        auto rc = waitSingle(waiterForUEvent(&data->m_uevent), UINT64_MAX);
-        log_write("[thread queue] woke up\n");
-        if (!g_running) {
-            return;
-        }
-        if (R_FAILED(rc)) {
+        StartEntries(data, multi, active);
+
+        // nothing in flight, sleep until something is queued.
+        if (active.empty()) {
+            waitSingle(waiterForUEvent(&data->m_uevent), UINT64_MAX);
             continue;
         }
 
-        mutexLock(&data->m_mutex);
-        ON_SCOPE_EXIT(mutexUnlock(&data->m_mutex));
-        if (data->m_entries.empty()) {
-            continue;
+        int running{};
+        if (auto mc = curl_multi_perform(multi, &running); mc != CURLM_OK) {
+            log_write("curl_multi_perform() failed: %s\n", curl_multi_strerror(mc));
         }
 
-        // find the next avaliable thread
-        for (auto& entry : data->m_entries) {
-            if (!g_running) {
-                return;
+        CURLMsg* msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
             }
 
-            bool keep_going{};
-
-            for (auto& thread : g_threads) {
-                if (!g_running) {
-                    return;
-                }
+            const auto it = std::ranges::find_if(active, [msg](auto& e) {
+                return e->transfer.curl == msg->easy_handle;
+            });
 
-                if (!thread.InProgress()) {
-                    if (thread.Setup(entry.api)) {
-                        // log_write("[dl queue] starting download\n");
-                        // mark entry for deletion
-                        entry.m_delete = true;
-                        // pop_count++;
-                        keep_going = true;
-                        break;
-                    }
-                }
+            if (it != active.end()) {
+                FinishEntry(multi, **it, msg->data.result);
+                active.erase(it);
             }
+        }
 
-            if (!keep_going) {
-                break;
+        // cancel transfers that are no longer wanted.
+        std::erase_if(active, [multi](auto& e) {
+            if (!e->api.IsStopped()) {
+                return false;
             }
-        }
 
-        // delete all entries marked for deletion
-        std::erase_if(data->m_entries, [](auto& e){
-            return e.m_delete;
+            FinishEntry(multi, *e, CURLE_ABORTED_BY_CALLBACK);
+            return true;
         });
+
+        if (running) {
+            // woken early by either socket activity or a new entry being queued.
+            #if LIBCURL_VERSION_NUM >= 0x074400
+            curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+            #else
+            curl_multi_wait(multi, nullptr, 0, 20, nullptr);
+            #endif
+        }
     }
 
+    {
+        SCOPED_MUTEX(&data->m_mutex);
+        data->m_multi = nullptr;
+    }
+
+    for (auto& e : active) {
+        FinishEntry(multi, *e, CURLE_ABORTED_BY_CALLBACK);
+    }
+    active.clear();
+
+    curl_multi_cleanup(multi);
     log_write("exited download thread queue\n");
 }
 
@@ -1056,23 +2345,19 @@ auto Init() -> bool {
         CURL_SHARE_SETOPT_LOG(g_curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_PSL);
         CURL_SHARE_SETOPT_LOG(g_curl_share, CURLSHOPT_LOCKFUNC, my_lock);
         CURL_SHARE_SETOPT_LOG(g_curl_share, CURLSHOPT_UNLOCKFUNC, my_unlock);
+    } else {
+        log_write("failed to create curl share\n");
     }
 
     g_running = true;
+    g_cache.set_budget(std::max(0L, App::GetDownloadCacheSize()) * 1024 * 1024);
 
-    if (R_FAILED(g_thread_queue.Create())) {
-        log_write("!failed to create download thread queue\n");
-    }
-
-    for (auto& entry : g_threads) {
-        if (R_FAILED(entry.Create())) {
-            log_write("!failed to create download thread\n");
-        }
+    if (R_FAILED(g_file_writer.Create())) {
+        log_write("!failed to create file writer thread\n");
     }
 
-    g_curl_single = curl_easy_init();
-    if (!g_curl_single) {
-        log_write("failed to create g_curl_single\n");
+    if (R_FAILED(g_thread_queue.Create())) {
+        log_write("!failed to create download thread queue\n");
     }
 
     log_write("finished creating threads\n");
@@ -1084,24 +2369,21 @@ void ExitSignal() {
     g_running = false;
 
     g_thread_queue.SignalClose();
-
-    for (auto& entry : g_threads) {
-        entry.SignalClose();
-    }
 }
 
 void Exit() {
     ExitSignal();
 
     g_thread_queue.Close();
+    // closed after the queue as transfers flush their writes on exit.
+    g_file_writer.Close();
 
-    if (g_curl_single) {
-        curl_easy_cleanup(g_curl_single);
-        g_curl_single = nullptr;
-    }
-
-    for (auto& entry : g_threads) {
-        entry.Close();
+    {
+        SCOPED_MUTEX(&g_pool_mutex);
+        for (auto& e : g_pool) {
+            curl_easy_cleanup(e.curl);
+        }
+        g_pool.clear();
     }
 
     if (g_curl_share) {
@@ -1116,28 +2398,35 @@ auto ToMemory(const Api& e) -> ApiResult {
     if (!e.GetPath().empty()) {
         return {};
     }
-    return DownloadInternal(g_curl_single, e);
+    return PerformWithPool(e, false);
 }
 
 auto ToFile(const Api& e) -> ApiResult {
     if (e.GetPath().empty()) {
         return {};
     }
-    return DownloadInternal(g_curl_single, e);
+
+    if ((e.GetFlags() & Flag_Resume) && !(e.GetFlags() & (Flag_Cache | Flag_NoBody))) {
+        if (auto result = DownloadResume(e)) {
+            return *result;
+        }
+    }
+
+    return PerformWithPool(e, false);
 }
 
 auto FromMemory(const Api& e) -> ApiResult {
     if (!e.GetPath().empty()) {
         return {};
     }
-    return UploadInternal(g_curl_single, e);
+    return PerformWithPool(e, true);
 }
 
 auto FromFile(const Api& e) -> ApiResult {
     if (e.GetPath().empty()) {
         return {};
     }
-    return UploadInternal(g_curl_single, e);
+    return PerformWithPool(e, true);
 }
 
 auto ToMemoryAsync(const Api& api) -> bool {
@@ -1160,4 +2449,72 @@ auto EscapeString(const std::string& str) -> std::string {
     return EscapeString(nullptr, str);
 }
 
+auto GetShareHandle() -> CURLSH* {
+    return g_curl_share;
+}
+
+auto PoolAcquire(const std::string& url) -> CURL* {
+    const auto key = GetPoolKey(url);
+
+    {
+        SCOPED_MUTEX(&g_pool_mutex);
+
+        // take the most recently used handle as it's the most likely to still
+        // have a live connection.
+        for (auto it = g_pool.rbegin(); it != g_pool.rend(); it++) {
+            if (it->key == key) {
+                auto curl = it->curl;
+                g_pool.erase(std::next(it).base());
+                return curl;
+            }
+        }
+    }
+
+    auto curl = curl_easy_init();
+    if (!curl) {
+        log_write("[CURL] pool curl_easy_init() failed\n");
+        return nullptr;
+    }
+
+    log_write("[CURL] pool created handle for: %s\n", key.c_str());
+    return curl;
+}
+
+void PoolRelease(const std::string& url, CURL* curl) {
+    if (!curl) {
+        return;
+    }
+
+    // reset so that no stale pointers are left in the handle, this keeps the
+    // connections, tls sessions and dns cache alive.
+    curl_easy_reset(curl);
+
+    auto key = GetPoolKey(url);
+    SCOPED_MUTEX(&g_pool_mutex);
+
+    // don't keep idle handles around after exit.
+    if (!g_curl_share) {
+        curl_easy_cleanup(curl);
+        return;
+    }
+
+    const auto host_count = std::ranges::count_if(g_pool, [&key](auto& e) {
+        return e.key == key;
+    });
+
+    // remove the oldest handle for this host, otherwise the oldest overall.
+    if (host_count >= POOL_MAX_IDLE_PER_HOST) {
+        auto it = std::ranges::find_if(g_pool, [&key](auto& e) {
+            return e.key == key;
+        });
+        curl_easy_cleanup(it->curl);
+        g_pool.erase(it);
+    } else if (g_pool.size() >= POOL_MAX_IDLE) {
+        curl_easy_cleanup(g_pool.front().curl);
+        g_pool.pop_front();
+    }
+
+    g_pool.emplace_back(std::move(key), curl);
+}
+
 } // namespace sphaira::curl
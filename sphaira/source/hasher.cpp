@@ -57,12 +57,6 @@ private:
     const std::span<const u8> m_data;
 };
 
-struct HashSource {
-    virtual ~HashSource() = default;
-    virtual void Update(const void* buf, s64 size, s64 file_size) = 0;
-    virtual void Get(std::string& out) = 0;
-};
-
 struct HashNull final : HashSource {
     void Update(const void* buf, s64 size, s64 file_size) override {
         m_in_size += size;
@@ -204,17 +198,21 @@ auto GetTypeStr(Type type) -> const char* {
     return "";
 }
 
-Result Hash(ui::ProgressBox* pbox, Type type, BaseSource* source, std::string& out) {
+auto Create(Type type) -> std::unique_ptr<HashSource> {
     switch (type) {
-        case Type::Crc32: return Hash(pbox, std::make_unique<HashCrc32>(), source, out);
-        case Type::Md5: return Hash(pbox, std::make_unique<HashMd5>(), source, out);
-        case Type::Sha1: return Hash(pbox, std::make_unique<HashSha1>(), source, out);
-        case Type::Sha256: return Hash(pbox, std::make_unique<HashSha256>(), source, out);
-        case Type::Null: return Hash(pbox, std::make_unique<HashNull>(), source, out);
+        case Type::Crc32: return std::make_unique<HashCrc32>();
+        case Type::Md5: return std::make_unique<HashMd5>();
+        case Type::Sha1: return std::make_unique<HashSha1>();
+        case Type::Sha256: return std::make_unique<HashSha256>();
+        case Type::Null: return std::make_unique<HashNull>();
     }
     std::unreachable();
 }
 
+Result Hash(ui::ProgressBox* pbox, Type type, BaseSource* source, std::string& out) {
+    return Hash(pbox, Create(type), source, out);
+}
+
 Result Hash(ui::ProgressBox* pbox, Type type, fs::Fs* fs, const fs::FsPath& path, std::string& out) {
     auto source = std::make_unique<FileSource>(fs, path);
     return Hash(pbox, type, source.get(), out);
@@ -22,24 +22,221 @@
 
 #include "app.hpp"
 #include "log.hpp"
+#include "defines.hpp"
+#include "utils/thread.hpp"
 #ifdef USE_NVJPG
 #include <nvjpg.hpp>
 #endif
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <algorithm>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace sphaira {
 namespace {
 
 constexpr int BPP = 4;
 
-auto ImageLoadInternal(stbi_uc* image_data, int x, int y) -> ImageResult {
+// the exif segment is one of the first in the file and is at most 64KiB.
+constexpr size_t EXIF_READ_SIZE = 1024 * 128;
+
+#ifdef USE_NVJPG
+// the hw decoder is shared, so only one image can be rendered at a time.
+Mutex g_nvjpg_mutex{};
+#endif
+
+// returns the size that fits within max_size, keeping the aspect ratio.
+void FitSize(int w, int h, int max_size, int& out_w, int& out_h) {
+    const auto scale = (double)max_size / std::max(w, h);
+    out_w = std::max(1, (int)(w * scale));
+    out_h = std::max(1, (int)(h * scale));
+}
+
+// halves the image by averaging each 2x2 block, the output is packed.
+// this is done in place, as each output row is written behind the rows it reads.
+void BoxHalve(u8* data, int w, int h, int pitch) {
+    const auto ow = w / 2;
+    const auto oh = h / 2;
+
+    for (int y = 0; y < oh; y++) {
+        const auto r0 = data + y * 2 * pitch;
+        const auto r1 = r0 + pitch;
+        const auto out = data + y * ow * BPP;
+        int x = 0;
+
+#if defined(__ARM_NEON)
+        // 8 pixels from each row are split into even and odd pixels, then averaged.
+        for (; x + 4 <= ow; x += 4) {
+            const auto a = vld2q_u32((const u32*)(r0 + x * 2 * BPP));
+            const auto b = vld2q_u32((const u32*)(r1 + x * 2 * BPP));
+            const auto top = vrhaddq_u8(vreinterpretq_u8_u32(a.val[0]), vreinterpretq_u8_u32(a.val[1]));
+            const auto bottom = vhaddq_u8(vreinterpretq_u8_u32(b.val[0]), vreinterpretq_u8_u32(b.val[1]));
+            vst1q_u8(out + x * BPP, vrhaddq_u8(top, bottom));
+        }
+#elif defined(__SSE2__)
+        const auto even = [](__m128i a, __m128i b) {
+            return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+        };
+        const auto odd = [](__m128i a, __m128i b) {
+            return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1)));
+        };
+
+        for (; x + 4 <= ow; x += 4) {
+            const auto a0 = _mm_loadu_si128((const __m128i*)(r0 + x * 2 * BPP));
+            const auto a1 = _mm_loadu_si128((const __m128i*)(r0 + x * 2 * BPP + 16));
+            const auto b0 = _mm_loadu_si128((const __m128i*)(r1 + x * 2 * BPP));
+            const auto b1 = _mm_loadu_si128((const __m128i*)(r1 + x * 2 * BPP + 16));
+            const auto top = _mm_avg_epu8(even(a0, a1), odd(a0, a1));
+            const auto bottom = _mm_avg_epu8(even(b0, b1), odd(b0, b1));
+            _mm_storeu_si128((__m128i*)(out + x * BPP), _mm_avg_epu8(top, bottom));
+        }
+#endif
+
+        for (; x < ow; x++) {
+            for (int c = 0; c < BPP; c++) {
+                const auto i = x * 2 * BPP + c;
+                out[x * BPP + c] = (r0[i] + r0[i + BPP] + r1[i] + r1[i + BPP] + 2) / 4;
+            }
+        }
+    }
+}
+
+// halves the image in place whilst it's at least twice the target size.
+// the box filter is cheap and keeps the final resize to a small input.
+void HalveToFit(u8* data, int& w, int& h, int& pitch, int tw, int th) {
+    while (w >= tw * 2 && h >= th * 2) {
+        BoxHalve(data, w, h, pitch);
+        w /= 2;
+        h /= 2;
+        pitch = w * BPP;
+    }
+}
+
+auto ResizeInternal(const u8* data, int inx, int iny, int pitch, int outx, int outy) -> ImageResult {
+    ImageResult result{ImageBuffer(outx*outy*BPP), outx, outy};
+    if (result.data.empty()) {
+        log_write("failed resize alloc\n");
+        return {};
+    }
+
+    if (!stbir_resize_uint8_linear(data, inx, iny, pitch, result.data.data(), outx, outy, outx*BPP, (stbir_pixel_layout)BPP)) {
+        log_write("failed resize\n");
+        return {};
+    }
+
+    return result;
+}
+
+// returns the jpeg thumbnail pointed to by IFD1 of the tiff header, if any.
+auto FindTiffThumbnail(std::span<const u8> tiff) -> std::span<const u8> {
+    if (tiff.size() < 8) {
+        return {};
+    }
+
+    const auto le = tiff[0] == 'I' && tiff[1] == 'I';
+    if (!le && !(tiff[0] == 'M' && tiff[1] == 'M')) {
+        return {};
+    }
+
+    const auto read16 = [&](u64 off) -> u32 {
+        return le ? tiff[off] | tiff[off + 1] << 8 : tiff[off] << 8 | tiff[off + 1];
+    };
+    const auto read32 = [&](u64 off) -> u32 {
+        return le ? read16(off) | read16(off + 2) << 16 : read16(off) << 16 | read16(off + 2);
+    };
+
+    if (read16(2) != 42) {
+        return {};
+    }
+
+    // IFD0 describes the image, the IFD after it describes the thumbnail.
+    u64 ifd = read32(4);
+    if (ifd + 2 > tiff.size()) {
+        return {};
+    }
+
+    const auto next = ifd + 2 + read16(ifd) * 12;
+    if (next + 4 > tiff.size()) {
+        return {};
+    }
+
+    ifd = read32(next);
+    if (!ifd || ifd + 2 > tiff.size()) {
+        return {};
+    }
+
+    u64 offset{}, size{};
+    const auto count = read16(ifd);
+    for (u32 i = 0; i < count; i++) {
+        const auto entry = ifd + 2 + i * 12;
+        if (entry + 12 > tiff.size()) {
+            return {};
+        }
+
+        switch (read16(entry)) {
+            case 0x0201: offset = read32(entry + 8); break; // JPEGInterchangeFormat
+            case 0x0202: size = read32(entry + 8); break; // JPEGInterchangeFormatLength
+        }
+    }
+
+    if (!offset || size < 2 || offset + size > tiff.size()) {
+        return {};
+    }
+
+    const auto thumb = tiff.subspan(offset, size);
+    if (thumb[0] != 0xFF || thumb[1] != 0xD8) {
+        return {};
+    }
+
+    return thumb;
+}
+
+// returns the thumbnail embedded in the exif (APP1) segment of a jpeg, if any.
+auto FindExifThumbnail(std::span<const u8> data) -> std::span<const u8> {
+    if (data.size() < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return {};
+    }
+
+    for (u64 off = 2; off + 4 <= data.size();) {
+        if (data[off] != 0xFF) {
+            break;
+        }
+
+        // the image data starts after SOS, so there's nothing more to find.
+        const auto marker = data[off + 1];
+        if (marker == 0xDA || marker == 0xD9) {
+            break;
+        }
+
+        const u64 len = data[off + 2] << 8 | data[off + 3];
+        if (len < 2 || off + 2 + len > data.size()) {
+            break;
+        }
+
+        if (marker == 0xE1 && len >= 8 && !std::memcmp(data.data() + off + 4, "Exif\0\0", 6)) {
+            return FindTiffThumbnail(data.subspan(off + 10, len - 8));
+        }
+
+        off += 2 + len;
+    }
+
+    return {};
+}
+
+auto ImageLoadInternal(stbi_uc* image_data, int x, int y, int max_size) -> ImageResult {
     if (image_data) {
-        ImageResult result{};
-        result.data.resize(x*y*BPP);
-        result.w = x;
-        result.h = y;
-        std::memcpy(result.data.data(), image_data, result.data.size());
-        stbi_image_free(image_data);
+        // stb allocates with malloc, so its buffer is taken over rather than copied.
+        ImageResult result{ImageBuffer::Adopt(image_data, x*y*BPP), x, y};
+        if (max_size) {
+            return ImageScaleToFit(std::move(result), max_size);
+        }
         return result;
     }
 
@@ -47,8 +244,35 @@ auto ImageLoadInternal(stbi_uc* image_data, int x, int y) -> ImageResult {
     return {};
 }
 
+// loads the exif thumbnail if it's large enough to be scaled down to max_size.
+auto LoadExifThumbnail(std::span<const u8> data, int max_size) -> ImageResult {
+    const auto thumb = FindExifThumbnail(data);
+    if (thumb.empty()) {
+        return {};
+    }
+
+    int x, y, channels;
+    if (!stbi_info_from_memory(thumb.data(), thumb.size(), &x, &y, &channels) || std::max(x, y) < max_size) {
+        return {};
+    }
+
+    return ImageLoadInternal(stbi_load_from_memory(thumb.data(), thumb.size(), &x, &y, &channels, BPP), x, y, max_size);
+}
+
+auto LoadExifThumbnail(const fs::FsPath& file, int max_size) -> ImageResult {
+    auto f = std::fopen(file, "rb");
+    if (!f) {
+        return {};
+    }
+    ON_SCOPE_EXIT(std::fclose(f));
+
+    std::vector<u8> buf(EXIF_READ_SIZE);
+    buf.resize(std::fread(buf.data(), 1, buf.size(), f));
+    return LoadExifThumbnail(buf, max_size);
+}
+
 #ifdef USE_NVJPG
-auto ImageLoadInternal(nj::Image&& image) -> ImageResult {
+auto ImageLoadInternal(nj::Image&& image, int max_size) -> ImageResult {
     if (!image.is_valid() || image.parse()) {
         log_write("[NVJPG] failed to parse image\n");
         return {};
@@ -60,6 +284,7 @@ auto ImageLoadInternal(nj::Image&& image) -> ImageResult {
         return {};
     }
 
+    SCOPED_MUTEX(&g_nvjpg_mutex);
     if (R_FAILED(App::GetApp()->m_decoder.render(image, surf, 255))) {
         log_write("[NVJPG] failed to render\n");
         return {};
@@ -70,10 +295,30 @@ auto ImageLoadInternal(nj::Image&& image) -> ImageResult {
         return {};
     }
 
+    // scale straight from the surface, rather than copying the full size image first.
+    if (max_size && ((int)surf.width > max_size || (int)surf.height > max_size)) {
+        int w = surf.width, h = surf.height, pitch = surf.pitch, tw, th;
+        FitSize(w, h, max_size, tw, th);
+        HalveToFit((u8*)surf.data(), w, h, pitch, tw, th);
+
+        if (w != tw || h != th) {
+            return ResizeInternal((const u8*)surf.data(), w, h, pitch, tw, th);
+        }
+
+        ImageResult result{ImageBuffer(w * h * BPP), w, h};
+        if (!result.data.empty()) {
+            std::memcpy(result.data.data(), surf.data(), result.data.size());
+        }
+        return result;
+    }
+
     ImageResult result{};
     result.w = surf.width;
     result.h = surf.height;
     result.data.resize(surf.width * surf.height * surf.get_bpp());
+    if (result.data.empty()) {
+        return {};
+    }
     // std::printf("[NVJPG] w: %zu h: %zu bpp: %u pitch: %zu size: %zu size2: %u\n", surf.width, surf.height, surf.get_bpp(), surf.pitch, surf.size(), 256*256*4);
 
     if (surf.width * surf.get_bpp() == surf.pitch) [[likely]] {
@@ -92,73 +337,267 @@ auto ImageLoadInternal(nj::Image&& image) -> ImageResult {
 
 } // namespace
 
-auto ImageLoadFromMemory(std::span<const u8> data, u32 flags) -> ImageResult {
+ImageBuffer::ImageBuffer(size_t size) {
+    resize(size);
+}
+
+ImageBuffer::~ImageBuffer() {
+    std::free(m_data);
+}
+
+ImageBuffer::ImageBuffer(ImageBuffer&& other) noexcept : m_data{std::exchange(other.m_data, nullptr)}, m_size{std::exchange(other.m_size, 0)} {
+}
+
+ImageBuffer& ImageBuffer::operator=(ImageBuffer&& other) noexcept {
+    if (this != &other) {
+        std::free(m_data);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+    }
+    return *this;
+}
+
+auto ImageBuffer::Adopt(void* data, size_t size) -> ImageBuffer {
+    ImageBuffer buf;
+    buf.m_data = static_cast<u8*>(data);
+    buf.m_size = size;
+    return buf;
+}
+
+void ImageBuffer::resize(size_t size) {
+    if (!size) {
+        clear();
+        return;
+    }
+
+    const auto data = static_cast<u8*>(std::realloc(m_data, size));
+    if (!data) {
+        log_write("[IMAGE] failed to alloc: %zu\n", size);
+        clear();
+        return;
+    }
+
+    m_data = data;
+    m_size = size;
+}
+
+void ImageBuffer::clear() {
+    std::free(m_data);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+auto ImageLoadFromMemory(std::span<const u8> data, u32 flags, int max_size) -> ImageResult {
+    if (max_size) {
+        if (auto result = LoadExifThumbnail(data, max_size); !result.data.empty()) {
+            return result;
+        }
+    }
+
 #ifdef USE_NVJPG
     if (flags & ImageFlag_JPEG) {
         auto shared_vec = std::make_shared<std::vector<u8>>(data.size());
         std::memcpy(shared_vec->data(), data.data(), shared_vec->size());
         // don't make const as it prevents RTO.
-        auto result = ImageLoadInternal(nj::Image{shared_vec});
+        auto result = ImageLoadInternal(nj::Image{shared_vec}, max_size);
         // if it failed, try again but without using oss-jpg.
-        return result.data.empty() ? ImageLoadFromMemory(data, 0) : result;
+        return result.data.empty() ? ImageLoadFromMemory(data, 0, max_size) : std::move(result);
     }
     else
 #endif
     {
         int x, y, channels;
-        return ImageLoadInternal(stbi_load_from_memory(data.data(), data.size(), &x, &y, &channels, BPP), x, y);
+        return ImageLoadInternal(stbi_load_from_memory(data.data(), data.size(), &x, &y, &channels, BPP), x, y, max_size);
     }
 }
 
-auto ImageLoadFromFile(const fs::FsPath& file, u32 flags) -> ImageResult {
+auto ImageLoadFromFile(const fs::FsPath& file, u32 flags, int max_size) -> ImageResult {
+    if (max_size) {
+        if (auto result = LoadExifThumbnail(file, max_size); !result.data.empty()) {
+            return result;
+        }
+    }
+
 #ifdef USE_NVJPG
     if (flags & ImageFlag_JPEG) {
         // don't make const as it prevents RTO.
-        auto result = ImageLoadInternal(nj::Image{file});
+        auto result = ImageLoadInternal(nj::Image{file}, max_size);
         // if it failed, try again but without using oss-jpg.
-        return result.data.empty() ? ImageLoadFromFile(file, 0) : result;
+        return result.data.empty() ? ImageLoadFromFile(file, 0, max_size) : std::move(result);
     }
     else
 #endif
     {
         int x, y, channels;
-        return ImageLoadInternal(stbi_load(file, &x, &y, &channels, BPP), x, y);
+        return ImageLoadInternal(stbi_load(file, &x, &y, &channels, BPP), x, y, max_size);
     }
 }
 
-auto ImageResize(std::span<const u8> data, int inx, int iny, int outx, int outy) -> ImageResult {
+auto ImageResize(std::span<const u8> data, int inx, int iny, int outx, int outy, int pitch) -> ImageResult {
     log_write("doing resize inx: %d iny: %d outx: %d outy: %d\n", inx, iny, outx, outy);
-    std::vector<u8> resized_data(outx*outy*BPP);
+    return ResizeInternal(data.data(), inx, iny, pitch ? pitch : inx * BPP, outx, outy);
+}
 
-    // if (stbir_resize_uint8(data.data(), inx, iny, inx * BPP, resized_data.data(), outx, outy, outx*BPP, BPP)) {
-    if (stbir_resize_uint8_linear(data.data(), inx, iny, inx * BPP, resized_data.data(), outx, outy, outx*BPP, (stbir_pixel_layout)BPP)) {
-        log_write("did resize\n");
-        return { resized_data, outx, outy };
+auto ImageScaleToFit(ImageResult&& image, int max_size) -> ImageResult {
+    if (image.data.empty() || max_size <= 0 || (image.w <= max_size && image.h <= max_size)) {
+        return std::move(image);
     }
-    log_write("failed resize\n");
-    return {};
+
+    int w = image.w, h = image.h, pitch = image.w * BPP, tw, th;
+    FitSize(w, h, max_size, tw, th);
+    HalveToFit(image.data.data(), w, h, pitch, tw, th);
+
+    if (w != tw || h != th) {
+        auto result = ResizeInternal(image.data.data(), w, h, pitch, tw, th);
+        if (!result.data.empty()) {
+            return result;
+        }
+    }
+
+    // either the halving was exact or the resize failed, so keep the halved image.
+    // this shrinks the buffer rather than allocating another one.
+    if (w != image.w) {
+        image.data.resize(w * h * BPP);
+        image.w = w;
+        image.h = h;
+    }
+
+    return std::move(image);
 }
 
 auto ImageConvertToJpg(std::span<const u8> data, int x, int y) -> ImageResult {
-    std::vector<u8> out;
-    out.reserve(x*y*BPP);
+    struct Context {
+        ImageBuffer buf;
+        bool failed;
+    } ctx{};
     log_write("doing jpeg convert\n");
 
     const auto cb = [](void *context, void *data, int size) -> void {
-        auto buf = static_cast<std::vector<u8>*>(context);
-        const auto offset = buf->size();
-        buf->resize(offset + size);
-        std::memcpy(buf->data() + offset, data, size);
+        auto ctx = static_cast<Context*>(context);
+        const auto offset = ctx->buf.size();
+        ctx->buf.resize(offset + size);
+        if (ctx->buf.empty()) {
+            ctx->failed = true;
+            return;
+        }
+        std::memcpy(ctx->buf.data() + offset, data, size);
     };
 
-    if (stbi_write_jpg_to_func(cb, &out, x, y, 4, data.data(), 93)) {
-        // out.shrink_to_fit();
+    if (stbi_write_jpg_to_func(cb, &ctx, x, y, 4, data.data(), 93) && !ctx.failed) {
         log_write("did jpg convert\n");
-        return { out, x, y };
+        return { std::move(ctx.buf), x, y };
     }
 
     log_write("failed jpg convert\n");
     return {};
 }
 
+ImageDecoder::~ImageDecoder() {
+    {
+        SCOPED_MUTEX(&m_mutex);
+        m_exit = true;
+        condvarWakeAll(&m_can_decode);
+    }
+
+    for (u32 i = 0; i < m_thread_count; i++) {
+        threadWaitForExit(&m_threads[i]);
+        threadClose(&m_threads[i]);
+    }
+}
+
+void ImageDecoder::Push(Loader&& loader, OnLoaded&& on_loaded) {
+    // threads are only started once needed, as most menus never load images.
+    if (!m_thread_count) {
+        Start();
+    }
+
+    // if no thread could be created, decode on the ui thread instead.
+    if (!m_thread_count) {
+        auto result = loader();
+        SCOPED_MUTEX(&m_mutex);
+        m_done.emplace_back(std::forward<Loader>(loader), std::forward<OnLoaded>(on_loaded), std::move(result), m_generation);
+        return;
+    }
+
+    SCOPED_MUTEX(&m_mutex);
+    m_pending.emplace_back(std::forward<Loader>(loader), std::forward<OnLoaded>(on_loaded), ImageResult{}, m_generation);
+    condvarWakeOne(&m_can_decode);
+}
+
+void ImageDecoder::Clear() {
+    SCOPED_MUTEX(&m_mutex);
+    m_pending.clear();
+    m_done.clear();
+    // images that are being decoded are dropped once done.
+    m_generation++;
+}
+
+void ImageDecoder::Upload(NVGcontext* vg, u64 budget_ns) {
+    TimeStamp ts;
+
+    // at least one image is uploaded per frame, so that large images still load.
+    do {
+        Request request;
+        {
+            SCOPED_MUTEX(&m_mutex);
+            if (m_done.empty()) {
+                return;
+            }
+
+            request = std::move(m_done.front());
+            m_done.pop_front();
+        }
+
+        int image{};
+        if (!request.result.data.empty()) {
+            image = nvgCreateImageRGBA(vg, request.result.w, request.result.h, 0, request.result.data.data());
+        }
+
+        request.on_loaded(image, request.result);
+    } while (ts.GetNs() < budget_ns);
+}
+
+void ImageDecoder::Start() {
+    for (u32 i = 0; i < MAX_THREADS; i++) {
+        if (R_FAILED(utils::CreateThread(&m_threads[m_thread_count], thread_func, this))) {
+            break;
+        }
+
+        if (R_FAILED(threadStart(&m_threads[m_thread_count]))) {
+            threadClose(&m_threads[m_thread_count]);
+            break;
+        }
+
+        m_thread_count++;
+    }
+}
+
+void ImageDecoder::thread_func(void* arg) {
+    auto self = static_cast<ImageDecoder*>(arg);
+
+    for (;;) {
+        Request request;
+        {
+            SCOPED_MUTEX(&self->m_mutex);
+            while (!self->m_exit && self->m_pending.empty()) {
+                condvarWait(&self->m_can_decode, &self->m_mutex);
+            }
+
+            if (self->m_exit) {
+                return;
+            }
+
+            request = std::move(self->m_pending.back());
+            self->m_pending.pop_back();
+        }
+
+        request.result = request.loader();
+
+        SCOPED_MUTEX(&self->m_mutex);
+        if (request.generation == self->m_generation) {
+            self->m_done.emplace_back(std::move(request));
+        }
+    }
+}
+
 } // namespace sphaira
@@ -3,6 +3,7 @@
 #include <minizip/zip.h>
 #include <cstring>
 #include <cstdio>
+#include <algorithm>
 
 #include "log.hpp"
 
@@ -13,6 +14,11 @@ namespace {
 #define LOCAL_HEADER_SIG 0x4034B50
 #define FILE_HEADER_SIG 0x2014B50
 #define END_RECORD_SIG 0x6054B50
+#define DATA_DESCRIPTOR_SIG 0x8074B50
+
+#define FLAG_ENCRYPTED (1 << 0)
+// crc32 and sizes are in a descriptor after the data.
+#define FLAG_DATA_DESCRIPTOR (1 << 3)
 
 // 30 bytes (0x1E)
 #pragma pack(push,1)
@@ -388,4 +394,356 @@ Result PeekFirstFileName(fs::Fs* fs, const fs::FsPath& path, fs::FsPath& name) {
     R_SUCCEED();
 }
 
+Result FindCentralDirectory(std::span<const u8> tail, s64& offset, s64& size) {
+    R_UNLESS(tail.size() >= sizeof(mmz_EndRecord), Result_MmzBadEndRecord);
+
+    // the end record is followed by a variable length comment, so search backwards.
+    for (s64 i = tail.size() - sizeof(mmz_EndRecord); i >= 0; i--) {
+        mmz_EndRecord end_record;
+        std::memcpy(&end_record, tail.data() + i, sizeof(end_record));
+
+        if (end_record.sig != END_RECORD_SIG || i + sizeof(end_record) + end_record.comment_len != tail.size()) {
+            continue;
+        }
+
+        if (end_record.file_hdr_off == 0xFFFFFFFF || end_record.central_directory_size == 0xFFFFFFFF || end_record.total_entries == 0xFFFF) {
+            log_write("[MZ] zip64 central directory is not supported\n");
+            R_THROW(Result_MmzUnsupportedEntry);
+        }
+
+        offset = end_record.file_hdr_off;
+        size = end_record.central_directory_size;
+        R_SUCCEED();
+    }
+
+    R_THROW(Result_MmzBadEndRecord);
+}
+
+Result ParseCentralDirectory(std::span<const u8> data, std::vector<CentralEntry>& out) {
+    out.clear();
+
+    for (size_t off = 0; off < data.size();) {
+        mmz_FileHeader file_hdr;
+        R_UNLESS(off + sizeof(file_hdr) <= data.size(), Result_MmzBadFileHeader);
+        std::memcpy(&file_hdr, data.data() + off, sizeof(file_hdr));
+
+        R_UNLESS(file_hdr.sig == FILE_HEADER_SIG, Result_MmzBadFileHeader);
+        R_UNLESS(off + sizeof(file_hdr) + file_hdr.filename_len <= data.size(), Result_MmzBadFileHeader);
+
+        CentralEntry entry{};
+        const auto name_len = std::min<u64>(file_hdr.filename_len, sizeof(entry.name) - 1);
+        std::memcpy(entry.name.s, data.data() + off + sizeof(file_hdr), name_len);
+        entry.name[name_len] = '\0';
+        entry.crc32 = file_hdr.crc32;
+        entry.compressed_size = file_hdr.compressed_size;
+        entry.uncompressed_size = file_hdr.uncompressed_size;
+        entry.offset = file_hdr.local_hdr_off;
+        out.emplace_back(entry);
+
+        off += sizeof(file_hdr) + file_hdr.filename_len + file_hdr.extrafield_len + file_hdr.filecomment_len;
+    }
+
+    R_SUCCEED();
+}
+
+StreamUnzip::StreamUnzip(const OnEntry& on_entry, const OnData& on_data, const OnEntryDone& on_done)
+: m_on_entry{on_entry}
+, m_on_data{on_data}
+, m_on_done{on_done} {
+    m_out.resize(1024 * 64);
+}
+
+StreamUnzip::~StreamUnzip() {
+    if (m_zs_init) {
+        inflateEnd(&m_zs);
+    }
+}
+
+Result StreamUnzip::Push(const void* _data, s64 size) {
+    auto data = static_cast<const u8*>(_data);
+
+    while (size > 0 && m_state != State::Done) {
+        switch (m_state) {
+            case State::LocalHeader:
+                if (Take(data, size, sizeof(mmz_LocalHeader))) {
+                    R_TRY(ParseLocalHeader());
+                }
+                break;
+
+            case State::Name:
+                if (Take(data, size, sizeof(mmz_LocalHeader) + m_filename_len + m_extrafield_len)) {
+                    R_TRY(StartEntry());
+                }
+                break;
+
+            case State::Data:
+                R_TRY(ReadData(data, size));
+                break;
+
+            case State::Descriptor:
+                if (Take(data, size, m_descriptor_size)) {
+                    u32 descriptor[4];
+                    std::memcpy(descriptor, m_buf.data(), m_buf.size());
+
+                    // the signature is optional, if present the descriptor is 4 bytes larger.
+                    if (m_descriptor_size == 12 && descriptor[0] == DATA_DESCRIPTOR_SIG) {
+                        m_descriptor_size = 16;
+                    } else {
+                        const auto d = m_descriptor_size == 16 ? descriptor + 1 : descriptor;
+                        R_TRY(EndEntry(d[0], d[1], d[2]));
+                    }
+                }
+                break;
+
+            case State::Done:
+                break;
+        }
+    }
+
+    R_SUCCEED();
+}
+
+Result StreamUnzip::Finish() {
+    if (m_state == State::Done) {
+        R_SUCCEED();
+    }
+
+    // an empty zip only has the end record, which is smaller than a local header.
+    if (m_state == State::LocalHeader && m_buf.size() >= sizeof(u32)) {
+        u32 sig;
+        std::memcpy(&sig, m_buf.data(), sizeof(sig));
+        if (sig == END_RECORD_SIG || sig == FILE_HEADER_SIG) {
+            R_SUCCEED();
+        }
+    }
+
+    log_write("[MZ] stream ended part way through an entry\n");
+    R_THROW(Result_MmzTruncated);
+}
+
+Result StreamUnzip::EndRange() {
+    if (m_state == State::LocalHeader && m_buf.empty()) {
+        R_SUCCEED();
+    }
+
+    log_write("[MZ] range ended part way through an entry\n");
+    R_THROW(Result_MmzTruncated);
+}
+
+void StreamUnzip::SetCentralDirectory(std::span<const CentralEntry> entries) {
+    m_central = entries;
+}
+
+auto StreamUnzip::Take(const u8*& data, s64& size, s64 want) -> bool {
+    const auto len = std::min<s64>(size, want - m_buf.size());
+    m_buf.insert(m_buf.end(), data, data + len);
+    data += len;
+    size -= len;
+    return (s64)m_buf.size() == want;
+}
+
+Result StreamUnzip::ParseLocalHeader() {
+    mmz_LocalHeader local_hdr;
+    std::memcpy(&local_hdr, m_buf.data(), sizeof(local_hdr));
+
+    // the central directory follows the last entry.
+    if (local_hdr.sig == FILE_HEADER_SIG || local_hdr.sig == END_RECORD_SIG) {
+        m_state = State::Done;
+        R_SUCCEED();
+    }
+
+    R_UNLESS(local_hdr.sig == LOCAL_HEADER_SIG, Result_MmzBadLocalHeaderSig);
+
+    const auto encrypted = local_hdr.flags & FLAG_ENCRYPTED;
+    const auto has_descriptor = local_hdr.flags & FLAG_DATA_DESCRIPTOR;
+    const auto zip64 = local_hdr.compressed_size == 0xFFFFFFFF || local_hdr.uncompressed_size == 0xFFFFFFFF;
+    const auto supported_compression = local_hdr.compression == 0 || local_hdr.compression == Z_DEFLATED;
+
+    // the end of stored data is only known from the size in the local header.
+    if (encrypted || zip64 || !supported_compression || (has_descriptor && local_hdr.compression == 0)) {
+        log_write("[MZ] unsupported entry, flags: 0x%X compression: %u\n", local_hdr.flags, local_hdr.compression);
+        R_THROW(Result_MmzUnsupportedEntry);
+    }
+
+    m_flags = local_hdr.flags;
+    m_compression = local_hdr.compression;
+    m_crc32 = local_hdr.crc32;
+    m_compressed_size = local_hdr.compressed_size;
+    m_uncompressed_size = local_hdr.uncompressed_size;
+    m_filename_len = local_hdr.filename_len;
+    m_extrafield_len = local_hdr.extrafield_len;
+    m_state = State::Name;
+    R_SUCCEED();
+}
+
+Result StreamUnzip::StartEntry() {
+    fs::FsPath name{};
+    const auto name_len = std::min<u64>(m_filename_len, sizeof(name) - 1);
+    std::memcpy(name.s, m_buf.data() + sizeof(mmz_LocalHeader), name_len);
+    name[name_len] = '\0';
+
+    // a zip64 entry with a data descriptor has sizes of 0 in the local header rather
+    // than 0xFFFFFFFF, the zip64 extra field is the only sign of the 24 byte descriptor.
+    const auto extra = m_buf.data() + sizeof(mmz_LocalHeader) + m_filename_len;
+    for (u32 off = 0; off + 4 <= m_extrafield_len;) {
+        u16 id, len;
+        std::memcpy(&id, extra + off, sizeof(id));
+        std::memcpy(&len, extra + off + 2, sizeof(len));
+
+        if (id == 0x0001) {
+            log_write("[MZ] unsupported zip64 entry: %s\n", name.s);
+            R_THROW(Result_MmzUnsupportedEntry);
+        }
+
+        off += 4 + len;
+    }
+
+    m_central_entry = nullptr;
+    if (!m_central.empty()) {
+        const auto it = std::ranges::find_if(m_central, [&name](auto& e){
+            return !std::strcmp(e.name, name);
+        });
+
+        if (it == m_central.end()) {
+            log_write("[MZ] entry not in central directory: %s\n", name.s);
+            R_THROW(Result_MmzCentralMismatch);
+        }
+
+        // with a data descriptor, the values are checked once the entry ends.
+        m_central_entry = &*it;
+        if (!(m_flags & FLAG_DATA_DESCRIPTOR)) {
+            R_TRY(CheckCentral(m_crc32, m_compressed_size, m_uncompressed_size));
+        }
+    }
+
+    m_buf.clear();
+    m_crc32_calc = 0;
+    m_remaining = m_compressed_size;
+    m_extract = false;
+    m_state = State::Data;
+
+    // directories are created along with the files inside them.
+    if (name_len && name[name_len - 1] != '/') {
+        const s64 size = (m_flags & FLAG_DATA_DESCRIPTOR) ? 0 : m_uncompressed_size;
+        R_TRY(m_on_entry(name, size, m_extract));
+    }
+
+    if (m_compression == Z_DEFLATED) {
+        if (!m_zs_init) {
+            // negative window bits for raw deflate, zip entries have no zlib header.
+            R_UNLESS(inflateInit2(&m_zs, -MAX_WBITS) == Z_OK, Result_MmzFailedInflate);
+            m_zs_init = true;
+        } else {
+            inflateReset(&m_zs);
+        }
+    } else if (!m_remaining) {
+        return EndData();
+    }
+
+    R_SUCCEED();
+}
+
+Result StreamUnzip::ReadData(const u8*& data, s64& size) {
+    if (m_compression != Z_DEFLATED) {
+        const auto len = std::min(size, m_remaining);
+        R_TRY(Write(data, len));
+        data += len;
+        size -= len;
+        m_remaining -= len;
+
+        if (!m_remaining) {
+            return EndData();
+        }
+
+        R_SUCCEED();
+    }
+
+    // the deflate stream marks its own end, so the compressed size isn't needed.
+    m_zs.next_in = const_cast<Bytef*>(data);
+    m_zs.avail_in = size;
+
+    while (true) {
+        m_zs.next_out = m_out.data();
+        m_zs.avail_out = m_out.size();
+
+        const auto ret = inflate(&m_zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            log_write("[MZ] failed to inflate: %d\n", ret);
+            R_THROW(Result_MmzFailedInflate);
+        }
+
+        R_TRY(Write(m_out.data(), m_out.size() - m_zs.avail_out));
+
+        if (ret == Z_STREAM_END) {
+            data += size - m_zs.avail_in;
+            size = m_zs.avail_in;
+            return EndData();
+        }
+
+        // output wasn't filled, so all the input has been used.
+        if (ret == Z_BUF_ERROR || m_zs.avail_out) {
+            break;
+        }
+    }
+
+    data += size;
+    size = 0;
+    R_SUCCEED();
+}
+
+Result StreamUnzip::EndData() {
+    if (m_flags & FLAG_DATA_DESCRIPTOR) {
+        m_descriptor_size = 12;
+        m_state = State::Descriptor;
+        R_SUCCEED();
+    }
+
+    return EndEntry(m_crc32, m_compressed_size, m_uncompressed_size);
+}
+
+Result StreamUnzip::EndEntry(u32 crc32, u32 compressed_size, u32 uncompressed_size) {
+    m_buf.clear();
+    m_state = State::LocalHeader;
+
+    if (m_central_entry) {
+        R_TRY(CheckCentral(crc32, compressed_size, uncompressed_size));
+
+        // the sizes of what was actually read, stored data is read up to its size.
+        if (m_compression == Z_DEFLATED) {
+            R_TRY(CheckCentral(crc32, m_zs.total_in, m_zs.total_out));
+        }
+    }
+
+    if (m_extract) {
+        if (m_crc32_calc != crc32) {
+            log_write("[MZ] bad crc32: 0x%08X vs 0x%08X\n", m_crc32_calc, crc32);
+            R_THROW(Result_MmzBadCrc32);
+        }
+
+        R_TRY(m_on_done());
+    }
+
+    R_SUCCEED();
+}
+
+Result StreamUnzip::CheckCentral(u32 crc32, u32 compressed_size, u32 uncompressed_size) const {
+    const auto& e = *m_central_entry;
+    if (crc32 != e.crc32 || compressed_size != e.compressed_size || uncompressed_size != e.uncompressed_size) {
+        log_write("[MZ] %s doesn't match central directory, crc32: 0x%08X vs 0x%08X size: %u/%u vs %u/%u\n",
+            e.name.s, crc32, e.crc32, compressed_size, uncompressed_size, e.compressed_size, e.uncompressed_size);
+        R_THROW(Result_MmzCentralMismatch);
+    }
+
+    R_SUCCEED();
+}
+
+Result StreamUnzip::Write(const void* data, s64 size) {
+    if (!m_extract || !size) {
+        R_SUCCEED();
+    }
+
+    m_crc32_calc = crc32CalculateWithSeed(m_crc32_calc, data, size);
+    return m_on_data(data, size);
+}
+
 } // namespace sphaira::mz
@@ -3,16 +3,128 @@
 #include "evman.hpp"
 #include "app.hpp"
 #include "log.hpp"
+#include "utils/thread.hpp"
 
 #include <switch.h>
 #include <vector>
 #include <cstring>
 #include <string_view>
+#include <string>
+#include <unordered_map>
+#include <type_traits>
+#include <memory>
+#include <atomic>
+#include <algorithm>
 #include <minIni.h>
 
 namespace sphaira {
 namespace {
 
+constexpr fs::FsPath INDEX_CACHE_PATH{"/switch/sphaira/cache/nro"};
+constexpr u32 INDEX_MAGIC = 0x49524F4E; // NORI
+constexpr u32 INDEX_VERSION = 1;
+
+// number of threads that scan folders, including the calling thread.
+constexpr u32 SCAN_THREADS = 3;
+
+struct IndexHeader {
+    u32 magic;
+    u32 version;
+    u32 count;
+};
+
+// everything that nro_parse_internal reads from the nro.
+struct IndexRecord {
+    char path[FS_MAX_PATH];
+    u64 created;
+    u64 modified;
+    s64 size;
+    u64 icon_size;
+    u64 icon_offset;
+    MiniNacp nacp;
+    bool is_nacp_valid;
+};
+static_assert(std::is_trivially_copyable_v<IndexRecord>);
+
+// index of the nros found by the last scan of a folder, an nro is only
+// opened if it's new or its timestamp changed since the last scan.
+// the lookup is read only during the scan, the mutex protects the rest.
+struct ScanIndex {
+    std::vector<IndexRecord> old_records{};
+    std::unordered_map<std::string_view, const IndexRecord*> lookup{};
+    Mutex mutex{};
+    std::vector<IndexRecord> records{};
+    u32 parsed{};
+};
+
+auto GetIndexPath(const fs::FsPath& path, bool nested, bool scan_all_dir) -> fs::FsPath {
+    const auto hash = std::hash<std::string_view>{}(path.s) ^ (nested << 1 | scan_all_dir);
+    fs::FsPath out;
+    std::snprintf(out, sizeof(out), "%s/%016lX.bin", INDEX_CACHE_PATH.s, (u64)hash);
+    return out;
+}
+
+void LoadIndex(fs::Fs* fs, const fs::FsPath& index_path, ScanIndex& index) {
+    std::vector<u8> data;
+    if (R_FAILED(fs->read_entire_file(index_path, data)) || data.size() < sizeof(IndexHeader)) {
+        return;
+    }
+
+    IndexHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != INDEX_MAGIC || header.version != INDEX_VERSION || data.size() != sizeof(header) + header.count * sizeof(IndexRecord)) {
+        log_write("[NRO] bad index, ignoring\n");
+        return;
+    }
+
+    index.old_records.resize(header.count);
+    std::memcpy(index.old_records.data(), data.data() + sizeof(header), header.count * sizeof(IndexRecord));
+
+    for (auto& e : index.old_records) {
+        e.path[sizeof(e.path) - 1] = '\0';
+        index.lookup.emplace(e.path, &e);
+    }
+}
+
+void SaveIndex(fs::Fs* fs, const fs::FsPath& index_path, const ScanIndex& index) {
+    // nothing was added, changed or removed.
+    if (!index.parsed && index.records.size() == index.old_records.size()) {
+        return;
+    }
+
+    const IndexHeader header{INDEX_MAGIC, INDEX_VERSION, (u32)index.records.size()};
+    std::vector<u8> data(sizeof(header) + index.records.size() * sizeof(IndexRecord));
+    std::memcpy(data.data(), &header, sizeof(header));
+    std::memcpy(data.data() + sizeof(header), index.records.data(), index.records.size() * sizeof(IndexRecord));
+
+    fs->CreateDirectoryRecursively(INDEX_CACHE_PATH);
+    fs->DeleteFile(index_path);
+    if (R_FAILED(fs->write_entire_file(index_path, data))) {
+        log_write("[NRO] failed to save index\n");
+    }
+}
+
+auto ToRecord(const NroEntry& entry) -> IndexRecord {
+    IndexRecord r{};
+    std::strncpy(r.path, entry.path, sizeof(r.path) - 1);
+    r.created = entry.timestamp.created;
+    r.modified = entry.timestamp.modified;
+    r.size = entry.size;
+    r.icon_size = entry.icon_size;
+    r.icon_offset = entry.icon_offset;
+    r.nacp = entry.nacp;
+    r.is_nacp_valid = entry.is_nacp_valid;
+    return r;
+}
+
+void FromRecord(const IndexRecord& r, NroEntry& entry) {
+    entry.size = r.size;
+    entry.icon_size = r.icon_size;
+    entry.icon_offset = r.icon_offset;
+    entry.nacp = r.nacp;
+    entry.is_nacp_valid = r.is_nacp_valid;
+}
+
 auto nro_parse_internal(fs::Fs* fs, const fs::FsPath& path, NroEntry& entry) -> Result {
     entry.path = path;
 
@@ -29,7 +141,7 @@ auto nro_parse_internal(fs::Fs* fs, const fs::FsPath& path, NroEntry& entry) ->
     fs::File f;
     R_TRY(fs->OpenFile(entry.path, FsOpenMode_Read, &f));
 
-    // todo: buffer reads to 16k to avoid 2 fs read calls per entry.
+    // the asset header is at the end of the code, so it can't be read with the header.
     NroData data;
     u64 bytes_read;
     R_TRY(f.Read(0, &data, sizeof(data), FsReadOption_None, &bytes_read));
@@ -59,8 +171,13 @@ auto nro_parse_internal(fs::Fs* fs, const fs::FsPath& path, NroEntry& entry) ->
         entry.is_nacp_valid = false;
     } else {
         entry.size += sizeof(asset) + asset.icon.size + asset.nacp.size + asset.romfs.size;
-        R_TRY(f.Read(data.header.size + asset.nacp.offset, &nacp.lang, sizeof(nacp.lang), FsReadOption_None, &bytes_read));
-        R_TRY(f.Read(data.header.size + asset.nacp.offset + offsetof(NacpStruct, display_version), nacp.display_version, sizeof(nacp.display_version), FsReadOption_None, &bytes_read));
+
+        // read the name and version in one go, rather than a read for each.
+        constexpr auto nacp_read_size = offsetof(NacpStruct, display_version) + sizeof(NacpStruct::display_version);
+        auto full_nacp = std::make_unique<NacpStruct>();
+        R_TRY(f.Read(data.header.size + asset.nacp.offset, full_nacp.get(), nacp_read_size, FsReadOption_None, &bytes_read));
+        std::memcpy(&nacp.lang, &full_nacp->lang[0], sizeof(nacp.lang));
+        std::memcpy(nacp.display_version, full_nacp->display_version, sizeof(nacp.display_version));
 
         // lazy load the icons
         entry.icon_size = asset.icon.size;
@@ -71,10 +188,80 @@ auto nro_parse_internal(fs::Fs* fs, const fs::FsPath& path, NroEntry& entry) ->
     R_SUCCEED();
 }
 
+// same as above, but uses the index if the nro hasn't changed since the last scan.
+auto nro_parse_internal(fs::Fs* fs, const fs::FsPath& path, NroEntry& entry, ScanIndex* index) -> Result {
+    // timestamps aren't available on 2.0.0, so the index can't be used.
+    if (!index || !hosversionAtLeast(3,0,0)) {
+        return nro_parse_internal(fs, path, entry);
+    }
+
+    // this also fails if the nro doesn't exist, which the fast path relies on.
+    FsTimeStampRaw timestamp{};
+    R_TRY(fs->GetFileTimeStampRaw(path, &timestamp));
+
+    const auto it = index->lookup.find(path.s);
+    if (it != index->lookup.end() && timestamp.is_valid && it->second->created == timestamp.created && it->second->modified == timestamp.modified) {
+        entry.path = path;
+        entry.timestamp = timestamp;
+        FromRecord(*it->second, entry);
+
+        SCOPED_MUTEX(&index->mutex);
+        index->records.emplace_back(*it->second);
+        R_SUCCEED();
+    }
+
+    R_TRY(nro_parse_internal(fs, path, entry));
+
+    SCOPED_MUTEX(&index->mutex);
+    index->records.emplace_back(ToRecord(entry));
+    index->parsed++;
+    R_SUCCEED();
+}
+
+auto nro_scan_internal(fs::Fs* fs, const fs::FsPath& path, std::vector<NroEntry>& nros, bool nested, bool scan_all_dir, bool root, ScanIndex* index) -> Result;
+
+// scans a single entry of a folder, returns true if it was an nro.
+auto nro_scan_entry(fs::Fs* fs, const fs::FsPath& path, const FsDirectoryEntry& e, std::vector<NroEntry>& nros, bool nested, bool scan_all_dir, ScanIndex* index) -> bool {
+    // skip hidden files / folders
+    if ('.' == e.name[0]) {
+        return false;
+    }
+
+    if (e.type == FsDirEntryType_Dir) {
+        // assert(!root && "dir should only be scanned on non-root!");
+        fs::FsPath fullpath;
+        std::snprintf(fullpath, sizeof(fullpath), "%s/%s/%s.nro", path.s, e.name, e.name);
+
+        // fast path for detecting an nro in a folder
+        NroEntry entry;
+        if (R_SUCCEEDED(nro_parse_internal(fs, fullpath, entry, index))) {
+            // log_write("NRO: fast path for: %s\n", fullpath);
+            nros.emplace_back(entry);
+        } else {
+            // slow path...
+            std::snprintf(fullpath, sizeof(fullpath), "%s/%s", path.s, e.name);
+            nro_scan_internal(fs, fullpath, nros, nested, scan_all_dir, false, index);
+        }
+    } else if (e.type == FsDirEntryType_File && std::string_view{e.name}.ends_with(".nro")) {
+        fs::FsPath fullpath;
+        std::snprintf(fullpath, sizeof(fullpath), "%s/%s", path.s, e.name);
+
+        NroEntry entry;
+        if (R_SUCCEEDED(nro_parse_internal(fs, fullpath, entry, index))) {
+            nros.emplace_back(entry);
+            return true;
+        } else {
+            log_write("error when trying to parse %s\n", fullpath.s);
+        }
+    }
+
+    return false;
+}
+
 // this function is recursive by 1 level deep
 // if the nro is in switch/folder/folder2/app.nro it will NOT be found
 // switch/folder/app.nro for example will work fine.
-auto nro_scan_internal(fs::Fs* fs, const fs::FsPath& path, std::vector<NroEntry>& nros, bool nested, bool scan_all_dir, bool root) -> Result {
+auto nro_scan_internal(fs::Fs* fs, const fs::FsPath& path, std::vector<NroEntry>& nros, bool nested, bool scan_all_dir, bool root, ScanIndex* index) -> Result {
     // we don't need to scan for folders if we are not root
     u32 dir_open_type = FsDirOpenMode_ReadFiles | FsDirOpenMode_NoFileSize;
     if (root) {
@@ -89,40 +276,8 @@ auto nro_scan_internal(fs::Fs* fs, const fs::FsPath& path, std::vector<NroEntry>
     R_TRY(d.ReadAll(entries));
 
     for (const auto& e : entries) {
-        // skip hidden files / folders
-        if ('.' == e.name[0]) {
-            continue;
-        }
-
-        if (e.type == FsDirEntryType_Dir) {
-            // assert(!root && "dir should only be scanned on non-root!");
-            fs::FsPath fullpath;
-            std::snprintf(fullpath, sizeof(fullpath), "%s/%s/%s.nro", path.s, e.name, e.name);
-
-            // fast path for detecting an nro in a folder
-            NroEntry entry;
-            if (R_SUCCEEDED(nro_parse_internal(fs, fullpath, entry))) {
-                // log_write("NRO: fast path for: %s\n", fullpath);
-                nros.emplace_back(entry);
-            } else {
-                // slow path...
-                std::snprintf(fullpath, sizeof(fullpath), "%s/%s", path.s, e.name);
-                nro_scan_internal(fs, fullpath, nros, nested, scan_all_dir, false);
-            }
-        } else if (e.type == FsDirEntryType_File && std::string_view{e.name}.ends_with(".nro")) {
-            fs::FsPath fullpath;
-            std::snprintf(fullpath, sizeof(fullpath), "%s/%s", path.s, e.name);
-
-            NroEntry entry;
-            if (R_SUCCEEDED(nro_parse_internal(fs, fullpath, entry))) {
-                nros.emplace_back(entry);
-                if (!root && !scan_all_dir) {
-                    // log_write("NRO: slow path for: %s\n", fullpath);
-                    R_SUCCEED();
-                }
-            } else {
-                log_write("error when trying to parse %s\n", fullpath.s);
-            }
+        if (nro_scan_entry(fs, path, e, nros, nested, scan_all_dir, index) && !root && !scan_all_dir) {
+            R_SUCCEED();
         }
     }
 
@@ -131,7 +286,58 @@ auto nro_scan_internal(fs::Fs* fs, const fs::FsPath& path, std::vector<NroEntry>
 
 auto nro_scan_internal(const fs::FsPath& path, std::vector<NroEntry>& nros, bool nested, bool scan_all_dir, bool root) -> Result {
     fs::FsNativeSd fs;
-    return nro_scan_internal(&fs, path, nros, nested, scan_all_dir, root);
+
+    ScanIndex index;
+    const auto index_path = GetIndexPath(path, nested, scan_all_dir);
+    LoadIndex(&fs, index_path, index);
+
+    u32 dir_open_type = FsDirOpenMode_ReadFiles | FsDirOpenMode_NoFileSize;
+    if (root) {
+        dir_open_type |= FsDirOpenMode_ReadDirs;
+    }
+
+    std::vector<FsDirectoryEntry> entries;
+    {
+        fs::Dir d;
+        R_TRY(fs.OpenDirectory(path, dir_open_type, &d));
+        R_TRY(d.ReadAll(entries));
+    }
+
+    // each entry of the folder is scanned by a pool of threads, as most of the
+    // time is spent waiting on the sd card rather than parsing.
+    // results are kept per entry so that the order is the same as a single thread.
+    std::vector<std::vector<NroEntry>> results(entries.size());
+    std::atomic<size_t> next{};
+
+    const auto worker = [&]() {
+        // each thread opens its own sd session, as the fs handles the requests
+        // of a session one at a time. falls back to the shared session on failure.
+        FsFileSystem sd_fs;
+        const auto own = R_SUCCEEDED(fsOpenSdCardFileSystem(&sd_fs));
+        fs::FsNative thread_fs{own ? &sd_fs : fsdevGetDeviceFileSystem("sdmc:"), own};
+        for (auto i = next++; i < entries.size(); i = next++) {
+            nro_scan_entry(&thread_fs, path, entries[i], results[i], nested, scan_all_dir, &index);
+        }
+    };
+
+    {
+        // the calling thread also scans, so the scan completes even if no thread could be created.
+        std::vector<std::unique_ptr<utils::Async>> threads;
+        for (u32 i = 0; i < std::min<size_t>(SCAN_THREADS - 1, entries.size()); i++) {
+            threads.emplace_back(std::make_unique<utils::Async>(worker));
+        }
+        worker();
+    }
+
+    for (auto& e : results) {
+        nros.insert(nros.end(), std::make_move_iterator(e.begin()), std::make_move_iterator(e.end()));
+    }
+
+    // the index only contains what was found, so deleted nros are dropped.
+    log_write("[NRO] scanned %zu nros, parsed: %u\n", nros.size(), index.parsed);
+
+    SaveIndex(&fs, index_path, index);
+    R_SUCCEED();
 }
 
 auto nro_get_icon_internal(fs::File* f, u64 size, u64 offset) -> std::vector<u8> {
@@ -16,6 +16,7 @@
 #include "yati/nx/crypto.hpp"
 
 #include "owo.hpp"
+#include "title_info.hpp"
 #include "defines.hpp"
 #include "app.hpp"
 #include "ui/progress_box.hpp"
@@ -975,6 +976,12 @@ auto install_forwader_internal(ui::ProgressBox* pbox, OwoConfig& config, NcmStor
     {
         pbox->NewTransfer("Pushing application record"_i18n).UpdateTransfer(5, 8);
 
+        // the records change from here on, even if the push below fails.
+        ON_SCOPE_EXIT(
+            title::InvalidateMetaEntries(old_tid);
+            title::InvalidateMetaEntries(tid);
+        )
+
         // remove old id for forwarders.
         const auto rc = nsDeleteApplicationCompletely(old_tid);
         if (R_FAILED(rc) && rc != 0x410) { // not found
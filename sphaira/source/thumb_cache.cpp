@@ -0,0 +1,431 @@
+#include "thumb_cache.hpp"
+#include "defines.hpp"
+#include "log.hpp"
+
+#include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+
+namespace sphaira::thumb {
+namespace {
+
+constexpr fs::FsPath CACHE_PATH{"/switch/sphaira/cache/thumbs"};
+constexpr fs::FsPath INDEX_PATH{"/switch/sphaira/cache/thumbs/thumbs.idx"};
+constexpr fs::FsPath INDEX_TEMP_PATH{"/switch/sphaira/cache/thumbs/thumbs.idx.tmp"};
+constexpr fs::FsPath DATA_PATH{"/switch/sphaira/cache/thumbs/thumbs.bin"};
+
+constexpr u32 INDEX_MAGIC = 0x42485453; // STHB
+constexpr u32 INDEX_VERSION = 1;
+constexpr int BPP = 4;
+
+// a full size icon is 256x256, which is 256KiB, so this holds 2048 of them.
+// that covers a large game library along with the appstore and homebrew icons.
+// once full, the least recently used images are evicted and their space is reused.
+constexpr s64 MAX_DATA_SIZE = 1024 * 1024 * 512;
+
+// the index is rewritten once it has this many records that are no longer used.
+constexpr size_t MAX_DEAD_RECORDS = 1024;
+
+struct IndexHeader {
+    u32 magic;
+    u32 version;
+};
+
+// appended to the index after the image data has been written.
+// the check detects a record that was only partly written.
+// later records replace earlier ones with the same key or that overlap the same data,
+// a record with a size of 0 removes the key.
+struct IndexRecord {
+    u64 key;
+    u64 offset;
+    u16 w;
+    u16 h;
+    u32 check;
+};
+
+struct Location {
+    u64 offset;
+    u16 w;
+    u16 h;
+    u64 last_used; // larger is more recent.
+};
+
+Mutex g_mutex{};
+std::unordered_map<u64, Location> g_index{};
+// space in the data file that can be reused, offset to size.
+// space at the end of the data is never in here, g_data_size is moved back instead.
+std::map<u64, u64> g_free{};
+s64 g_data_size{};
+size_t g_records{};
+u64 g_clock{};
+bool g_loaded{};
+
+auto Fnv1a(const void* data, size_t size, u64 hash = 0xCBF29CE484222325) -> u64 {
+    const auto p = static_cast<const u8*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+auto MakeCheck(const IndexRecord& r) -> u32 {
+    return Fnv1a(&r, offsetof(IndexRecord, check));
+}
+
+auto MakeRecord(u64 key, u64 offset, u16 w, u16 h) -> IndexRecord {
+    IndexRecord r{key, offset, w, h, 0};
+    r.check = MakeCheck(r);
+    return r;
+}
+
+auto GetDataSize(u16 w, u16 h) -> u64 {
+    return (u64)w * h * BPP;
+}
+
+void ResetInternal(fs::Fs& fs) {
+    g_index.clear();
+    g_free.clear();
+    g_data_size = 0;
+    g_records = 0;
+
+    fs.DeleteFile(INDEX_PATH);
+    fs.DeleteFile(DATA_PATH);
+    fs.CreateDirectoryRecursively(CACHE_PATH);
+
+    const IndexHeader header{INDEX_MAGIC, INDEX_VERSION};
+    fs.write_entire_file(INDEX_PATH, {(const u8*)&header, sizeof(header)});
+    fs.CreateFile(DATA_PATH);
+}
+
+void LoadInternal(fs::Fs& fs) {
+    if (g_loaded) {
+        return;
+    }
+    g_loaded = true;
+    g_index.clear();
+    g_free.clear();
+    g_data_size = 0;
+    g_records = 0;
+
+    std::vector<u8> data;
+    FsTimeStampRaw ts;
+    s64 file_size;
+    if (R_FAILED(fs.read_entire_file(INDEX_PATH, data)) || data.size() < sizeof(IndexHeader) ||
+        R_FAILED(fs.FileGetSizeAndTimestamp(DATA_PATH, &ts, &file_size))) {
+        ResetInternal(fs);
+        return;
+    }
+
+    IndexHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != INDEX_MAGIC || header.version != INDEX_VERSION) {
+        log_write("[THUMB] bad index header, resetting\n");
+        ResetInternal(fs);
+        return;
+    }
+
+    // images by offset, to find the ones whose data was reused by a later record.
+    std::map<u64, u64> live;
+
+    const auto count = (data.size() - sizeof(header)) / sizeof(IndexRecord);
+    for (size_t i = 0; i < count; i++) {
+        IndexRecord r;
+        std::memcpy(&r, data.data() + sizeof(header) + i * sizeof(r), sizeof(r));
+        g_records++;
+
+        const auto end = r.offset + GetDataSize(r.w, r.h);
+        if (r.check != MakeCheck(r) || end > (u64)file_size) {
+            log_write("[THUMB] skipping bad record: %zu\n", i);
+            continue;
+        }
+
+        if (auto it = g_index.find(r.key); it != g_index.end()) {
+            live.erase(it->second.offset);
+            g_index.erase(it);
+        }
+
+        if (!r.w || !r.h) {
+            continue;
+        }
+
+        auto it = live.lower_bound(r.offset);
+        if (it != live.begin()) {
+            const auto prev = std::prev(it);
+            const auto& loc = g_index[prev->second];
+            if (prev->first + GetDataSize(loc.w, loc.h) > r.offset) {
+                it = prev;
+            }
+        }
+
+        while (it != live.end() && it->first < end) {
+            g_index.erase(it->second);
+            it = live.erase(it);
+        }
+
+        // later records are more recent, as compacting writes them oldest first.
+        live[r.offset] = r.key;
+        g_index[r.key] = {r.offset, r.w, r.h, ++g_clock};
+    }
+
+    // the space between images is free, anything after the last image is reused by appending.
+    u64 off = 0;
+    for (const auto& [offset, key] : live) {
+        if (offset > off) {
+            g_free[off] = offset - off;
+        }
+
+        const auto& loc = g_index[key];
+        off = offset + GetDataSize(loc.w, loc.h);
+    }
+    g_data_size = off;
+
+    log_write("[THUMB] loaded %zu images, data size: %zd records: %zu\n", g_index.size(), g_data_size, g_records);
+}
+
+auto AppendRecordsInternal(fs::Fs& fs, std::span<const IndexRecord> records) -> bool {
+    fs::File file;
+    s64 index_size;
+    if (R_FAILED(fs.OpenFile(INDEX_PATH, FsOpenMode_Write|FsOpenMode_Append, &file)) ||
+        R_FAILED(file.GetSize(&index_size)) ||
+        R_FAILED(file.Write(index_size, records.data(), records.size_bytes(), FsWriteOption_None))) {
+        log_write("[THUMB] failed to write index\n");
+        return false;
+    }
+
+    g_records += records.size();
+    return true;
+}
+
+// rewrites the index with only the images that are in use, oldest first so that
+// the order they were used in is kept on the next load.
+void CompactInternal(fs::Fs& fs) {
+    if (g_records < g_index.size() + MAX_DEAD_RECORDS) {
+        return;
+    }
+
+    std::vector<std::pair<u64, const Location*>> entries;
+    entries.reserve(g_index.size());
+    for (const auto& [key, loc] : g_index) {
+        entries.emplace_back(key, &loc);
+    }
+
+    std::ranges::sort(entries, {}, [](auto& e) { return e.second->last_used; });
+
+    std::vector<u8> data(sizeof(IndexHeader) + entries.size() * sizeof(IndexRecord));
+    const IndexHeader header{INDEX_MAGIC, INDEX_VERSION};
+    std::memcpy(data.data(), &header, sizeof(header));
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const auto& [key, loc] = entries[i];
+        const auto r = MakeRecord(key, loc->offset, loc->w, loc->h);
+        std::memcpy(data.data() + sizeof(header) + i * sizeof(r), &r, sizeof(r));
+    }
+
+    if (R_FAILED(fs.write_entire_file(INDEX_TEMP_PATH, data))) {
+        log_write("[THUMB] failed to write index: %s\n", INDEX_TEMP_PATH.s);
+        return;
+    }
+
+    fs.DeleteFile(INDEX_PATH);
+    if (R_FAILED(fs.RenameFile(INDEX_TEMP_PATH, INDEX_PATH))) {
+        log_write("[THUMB] failed to rename index: %s\n", INDEX_PATH.s);
+        return;
+    }
+
+    log_write("[THUMB] compacted index from %zu to %zu records\n", g_records, entries.size());
+    g_records = entries.size();
+}
+
+void FreeInternal(u64 offset, u64 size) {
+    // merge with the space either side.
+    const auto next = g_free.lower_bound(offset);
+    if (next != g_free.begin()) {
+        const auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            g_free.erase(prev);
+        }
+    }
+
+    if (next != g_free.end() && offset + size == next->first) {
+        size += next->second;
+        g_free.erase(next);
+    }
+
+    if (offset + size == (u64)g_data_size) {
+        g_data_size = offset;
+    } else {
+        g_free[offset] = size;
+    }
+}
+
+// returns false if there's no space left without evicting.
+auto AllocInternal(u64 size, u64& offset) -> bool {
+    for (auto it = g_free.begin(); it != g_free.end(); it++) {
+        if (it->second >= size) {
+            offset = it->first;
+            const auto left = it->second - size;
+            g_free.erase(it);
+            if (left) {
+                g_free[offset + size] = left;
+            }
+            return true;
+        }
+    }
+
+    if (g_data_size + size > (u64)MAX_DATA_SIZE) {
+        return false;
+    }
+
+    offset = g_data_size;
+    g_data_size += size;
+    return true;
+}
+
+// removes the least recently used image, returns the record that removes it from the index.
+auto EvictInternal() -> IndexRecord {
+    const auto it = std::ranges::min_element(g_index, {}, [](auto& e) { return e.second.last_used; });
+    const auto key = it->first;
+    const auto loc = it->second;
+
+    g_index.erase(it);
+    FreeInternal(loc.offset, GetDataSize(loc.w, loc.h));
+    return MakeRecord(key, loc.offset, 0, 0);
+}
+
+} // namespace
+
+auto MakeKey(std::string_view id, int size) -> u64 {
+    return Fnv1a(id.data(), id.size(), Fnv1a(&size, sizeof(size)));
+}
+
+auto MakeKey(std::span<const u8> data, int size) -> u64 {
+    return Fnv1a(data.data(), data.size(), Fnv1a(&size, sizeof(size)));
+}
+
+auto Get(u64 key, ImageResult& out) -> bool {
+    SCOPED_MUTEX(&g_mutex);
+    fs::FsNativeSd fs;
+    LoadInternal(fs);
+
+    const auto it = g_index.find(key);
+    if (it == g_index.end()) {
+        return false;
+    }
+
+    auto& loc = it->second;
+    fs::File file;
+    if (R_FAILED(fs.OpenFile(DATA_PATH, FsOpenMode_Read, &file))) {
+        return false;
+    }
+
+    out.w = loc.w;
+    out.h = loc.h;
+    out.data.resize(GetDataSize(loc.w, loc.h));
+    if (out.data.empty()) {
+        return false;
+    }
+
+    u64 bytes_read;
+    if (R_FAILED(file.Read(loc.offset, out.data.data(), out.data.size(), 0, &bytes_read)) || bytes_read != out.data.size()) {
+        out.data.clear();
+        return false;
+    }
+
+    // the record is appended again so that the image is seen as recently used on the
+    // next load, to limit writes this is only done if it hasn't been used for a while.
+    if (g_clock - loc.last_used > g_index.size() / 2) {
+        const auto r = MakeRecord(key, loc.offset, loc.w, loc.h);
+        AppendRecordsInternal(fs, {&r, 1});
+        CompactInternal(fs);
+    }
+
+    loc.last_used = ++g_clock;
+    return true;
+}
+
+void Put(u64 key, const ImageResult& image) {
+    if (image.data.empty() || image.w > 0xFFFF || image.h > 0xFFFF || (s64)image.data.size() > MAX_DATA_SIZE) {
+        return;
+    }
+
+    SCOPED_MUTEX(&g_mutex);
+    fs::FsNativeSd fs;
+    LoadInternal(fs);
+
+    if (g_index.contains(key)) {
+        return;
+    }
+
+    u64 offset;
+    std::vector<IndexRecord> evicted;
+    while (!AllocInternal(image.data.size(), offset)) {
+        if (g_index.empty()) {
+            return;
+        }
+        evicted.emplace_back(EvictInternal());
+    }
+
+    // the evicted images are removed from the index before their data is reused.
+    if (!evicted.empty()) {
+        log_write("[THUMB] evicted %zu images\n", evicted.size());
+        // their space can't be reused until they are, so reload the index as it was.
+        if (!AppendRecordsInternal(fs, evicted)) {
+            g_loaded = false;
+            return;
+        }
+    }
+
+    // the data is written first, so the index never points to missing data.
+    {
+        fs::File file;
+        if (R_FAILED(fs.OpenFile(DATA_PATH, FsOpenMode_Write|FsOpenMode_Append, &file)) ||
+            R_FAILED(file.Write(offset, image.data.data(), image.data.size(), FsWriteOption_None))) {
+            log_write("[THUMB] failed to write data\n");
+            FreeInternal(offset, image.data.size());
+            return;
+        }
+    }
+
+    const auto r = MakeRecord(key, offset, image.w, image.h);
+    if (!AppendRecordsInternal(fs, {&r, 1})) {
+        FreeInternal(offset, image.data.size());
+        return;
+    }
+
+    g_index[key] = {r.offset, r.w, r.h, ++g_clock};
+    CompactInternal(fs);
+}
+
+auto Load(u64 key, const std::function<ImageResult()>& loader, int size) -> ImageResult {
+    ImageResult image;
+    if (Get(key, image)) {
+        return image;
+    }
+
+    image = ImageScaleToFit(loader(), size);
+    Put(key, image);
+    return image;
+}
+
+auto LoadFromFile(const fs::FsPath& path, u32 flags, int size) -> ImageResult {
+    FsTimeStampRaw ts;
+    s64 file_size;
+    if (R_FAILED(fs::FsNativeSd().FileGetSizeAndTimestamp(path, &ts, &file_size))) {
+        return {};
+    }
+
+    char id[FS_MAX_PATH + 64];
+    std::snprintf(id, sizeof(id), "%s:%zd:%lu", path.s, file_size, ts.modified);
+
+    return Load(MakeKey(id, size), [&path, flags, size]() {
+        return ImageLoadFromFile(path, flags, size);
+    }, size);
+}
+
+} // namespace sphaira::thumb
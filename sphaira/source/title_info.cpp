@@ -14,6 +14,11 @@
 #include <atomic>
 #include <ranges>
 #include <algorithm>
+#include <bit>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <nxtc.h>
 #include <minIni.h>
@@ -21,12 +26,27 @@
 namespace sphaira::title {
 namespace {
 
+// ns and ncm are ipc, so most of the time fetching is spent waiting rather
+// than using the cpu, so a few threads fetch at once.
+constexpr u32 WORKER_THREADS = 3;
+
+// results are split by app_id so that a lookup from the ui thread only
+// contends with a worker inserting into the same shard.
+constexpr u32 SHARD_COUNT = 16;
+
+struct ResultShard {
+    Mutex mutex{};
+    std::unordered_map<u64, std::unique_ptr<ThreadResultData>> map{};
+};
+
 struct ThreadData {
     ThreadData(bool title_cache);
 
     void Run();
     void Close();
     void Clear();
+    // closes the title cache, call once all threads have exited.
+    void ExitCache();
 
     void PushAsync(u64 id);
     void PushAsync(const std::span<const NsApplicationRecord> app_ids);
@@ -41,26 +61,51 @@ struct ThreadData {
         return m_title_cache;
     }
 
+private:
+    auto GetShard(u64 app_id) -> ResultShard& {
+        // app_ids share their low bits, so they're mixed before picking a shard.
+        return m_shards[(app_id * 0x9E3779B97F4A7C15ULL) >> (64 - std::countr_zero(SHARD_COUNT))];
+    }
+
+    // must be called with m_mutex_id locked.
+    auto PushInternal(u64 id) -> bool;
+    // must be called with m_mutex_nxtc locked.
+    void InitCache();
+
 private:
     fs::FsNativeSd m_fs{};
-    UEvent m_uevent{};
     Mutex m_mutex_id{};
-    Mutex m_mutex_result{};
+    CondVar m_can_fetch{};
+    // nxtc isn't thread safe, so every call to it is done with this locked.
+    Mutex m_mutex_nxtc{};
     bool m_title_cache{};
+    bool m_nxtc_init{};
 
-    // app_ids pushed to the queue, signal uevent when pushed.
-    std::vector<u64> m_ids{};
-    // control data pushed to the queue.
-    std::vector<std::unique_ptr<ThreadResultData>> m_result{};
+    // app_ids pushed to the queue, fetched in the order pushed.
+    std::deque<u64> m_ids{};
+    // app_ids that are queued or being fetched, so that they're not pushed twice.
+    std::unordered_set<u64> m_pending{};
+    // control data that has been fetched.
+    ResultShard m_shards[SHARD_COUNT]{};
 
     std::atomic_bool m_running{};
 };
 
+static_assert(std::has_single_bit(SHARD_COUNT));
+
 Mutex g_mutex{};
-Thread g_thread{};
+Thread g_threads[WORKER_THREADS]{};
+u32 g_thread_count{};
 u32 g_ref_count{};
 std::unique_ptr<ThreadData> g_thread_data{};
 
+// app_id -> every installed meta entry, filled on first lookup of each id.
+Mutex g_meta_mutex{};
+std::unordered_map<u64, MetaEntries> g_meta_index{};
+// bumped on every invalidate, so that a lookup that raced with an
+// install / delete doesn't store what it read before the change.
+u64 g_meta_generation{};
+
 struct NcmEntry {
     const NcmStorageId storage_id;
     NcmContentStorage cs{};
@@ -135,115 +180,136 @@ Result LoadControlManual(u64 id, NacpStruct& nacp, ThreadResultData* data) {
 }
 
 ThreadData::ThreadData(bool title_cache) : m_title_cache{title_cache} {
-    ueventCreate(&m_uevent, true);
     mutexInit(&m_mutex_id);
-    mutexInit(&m_mutex_result);
+    mutexInit(&m_mutex_nxtc);
+    condvarInit(&m_can_fetch);
     m_running = true;
 }
 
 void ThreadData::Run() {
     TimeStamp ts{};
     bool cached{true};
-    const auto waiter = waiterForUEvent(&m_uevent);
 
     while (IsRunning()) {
-        const auto rc = waitSingle(waiter, 3e+9);
+        std::optional<u64> id;
+        bool timed_out{};
+        {
+            SCOPED_MUTEX(&m_mutex_id);
+            if (m_ids.empty()) {
+                timed_out = R_FAILED(condvarWaitTimeout(&m_can_fetch, &m_mutex_id, 3e+9));
+            } else {
+                id = m_ids.front();
+                m_ids.pop_front();
+            }
+        }
 
         // if we timed out, flush the cache and poll again.
-        if (R_FAILED(rc)) {
-            nxtcFlushCacheFile();
+        if (timed_out) {
+            SCOPED_MUTEX(&m_mutex_nxtc);
+            if (m_nxtc_init) {
+                nxtcFlushCacheFile();
+            }
             continue;
         }
 
-        if (!IsRunning()) {
-            return;
+        if (!id || !IsRunning()) {
+            continue;
         }
 
-        std::vector<u64> ids;
-        {
-            SCOPED_MUTEX(&m_mutex_id);
-            std::swap(ids, m_ids);
+        // sleep after every other entry loaded.
+        const auto elapsed = (s64)2e+6 - (s64)ts.GetNs();
+        if (!cached && elapsed > 0) {
+            svcSleepThread(elapsed);
         }
 
-        for (u64 i = 0; i < std::size(ids); i++) {
-            if (!IsRunning()) {
-                return;
-            }
+        // loads new entry into cache.
+        std::ignore = Get(*id, &cached);
+        ts.Update();
 
-            // sleep after every other entry loaded.
-            const auto elapsed = (s64)2e+6 - (s64)ts.GetNs();
-            if (!cached && elapsed > 0) {
-                svcSleepThread(elapsed);
-            }
-
-            // loads new entry into cache.
-            std::ignore = Get(ids[i], &cached);
-            ts.Update();
-        }
+        SCOPED_MUTEX(&m_mutex_id);
+        m_pending.erase(*id);
     }
 }
 
 void ThreadData::Close() {
+    SCOPED_MUTEX(&m_mutex_id);
     m_running = false;
-    ueventSignal(&m_uevent);
+    condvarWakeAll(&m_can_fetch);
 }
 
 void ThreadData::Clear() {
     SCOPED_MUTEX(&m_mutex_id);
-    SCOPED_MUTEX(&m_mutex_result);
-    m_result.clear();
+    for (auto& shard : m_shards) {
+        SCOPED_MUTEX(&shard.mutex);
+        shard.map.clear();
+    }
+
+    SCOPED_MUTEX(&m_mutex_nxtc);
+    InitCache();
     nxtcWipeCache();
 }
 
-void ThreadData::PushAsync(u64 id) {
-    SCOPED_MUTEX(&m_mutex_id);
-    SCOPED_MUTEX(&m_mutex_result);
+void ThreadData::ExitCache() {
+    SCOPED_MUTEX(&m_mutex_nxtc);
+    if (m_nxtc_init) {
+        nxtcExit();
+        m_nxtc_init = false;
+    }
+}
 
-    const auto it_id = std::ranges::find(m_ids, id);
-    const auto it_result = std::ranges::find_if(m_result, [id](auto& e){
-        return id == e->id;
-    });
+void ThreadData::InitCache() {
+    // the cache is read from the sd card, so it's loaded by whichever thread
+    // needs it first rather than on init.
+    if (!m_nxtc_init) {
+        m_nxtc_init = true;
+        if (IsTitleCacheEnabled() && !nxtcInitialize()) {
+            log_write("[NXTC] failed to init cache\n");
+        }
+    }
+}
 
-    if (it_id == m_ids.end() && it_result == m_result.end()) {
-        m_ids.emplace_back(id);
-        ueventSignal(&m_uevent);
+auto ThreadData::PushInternal(u64 id) -> bool {
+    if (m_pending.contains(id) || GetAsync(id)) {
+        return false;
+    }
+
+    m_pending.emplace(id);
+    m_ids.emplace_back(id);
+    return true;
+}
+
+void ThreadData::PushAsync(u64 id) {
+    SCOPED_MUTEX(&m_mutex_id);
+    if (PushInternal(id)) {
+        condvarWakeOne(&m_can_fetch);
     }
 }
 
 void ThreadData::PushAsync(const std::span<const NsApplicationRecord> app_ids) {
     SCOPED_MUTEX(&m_mutex_id);
-    SCOPED_MUTEX(&m_mutex_result);
     bool added_at_least_one = false;
 
     for (auto& record : app_ids) {
-        const auto id = record.application_id;
-
-        const auto it_id = std::ranges::find(m_ids, id);
-        const auto it_result = std::ranges::find_if(m_result, [id](auto& e){
-            return id == e->id;
-        });
-
-        if (it_id == m_ids.end() && it_result == m_result.end()) {
-            m_ids.emplace_back(id);
+        if (PushInternal(record.application_id)) {
             added_at_least_one = true;
         }
     }
 
     if (added_at_least_one) {
-        ueventSignal(&m_uevent);
+        condvarWakeAll(&m_can_fetch);
     }
 }
 
 auto ThreadData::GetAsync(u64 app_id) -> ThreadResultData* {
-    SCOPED_MUTEX(&m_mutex_result);
+    auto& shard = GetShard(app_id);
+    SCOPED_MUTEX(&shard.mutex);
 
-    for (s64 i = 0; i < std::size(m_result); i++) {
-        if (app_id == m_result[i]->id) {
-            return m_result[i].get();
-        }
+    const auto it = shard.map.find(app_id);
+    if (it == shard.map.end()) {
+        return {};
     }
 
-    return {};
+    return it->second.get();
 }
 
 auto ThreadData::Get(u64 app_id, bool* cached) -> ThreadResultData* {
@@ -259,19 +325,28 @@ auto ThreadData::Get(u64 app_id, bool* cached) -> ThreadResultData* {
     auto result = std::make_unique<ThreadResultData>(app_id);
     result->status = NacpLoadStatus::Error;
 
-    if (auto data = nxtcGetApplicationMetadataEntryById(app_id)) {
-        log_write("[NXTC] loaded from cache time taken: %.2fs %zums %zuns\n", ts.GetSecondsD(), ts.GetMs(), ts.GetNs());
-        ON_SCOPE_EXIT(nxtcFreeApplicationMetadata(&data));
+    bool in_cache{};
+    {
+        SCOPED_MUTEX(&m_mutex_nxtc);
+        InitCache();
+
+        if (auto data = nxtcGetApplicationMetadataEntryById(app_id)) {
+            log_write("[NXTC] loaded from cache time taken: %.2fs %zums %zuns\n", ts.GetSecondsD(), ts.GetMs(), ts.GetNs());
+            ON_SCOPE_EXIT(nxtcFreeApplicationMetadata(&data));
 
+            in_cache = true;
+            result->status = NacpLoadStatus::Loaded;
+            std::strcpy(result->lang.name, data->name);
+            std::strcpy(result->lang.author, data->publisher);
+            result->icon.resize(data->icon_size);
+            std::memcpy(result->icon.data(), data->icon_data, result->icon.size());
+        }
+    }
+
+    if (in_cache) {
         if (cached) {
             *cached = true;
         }
-
-        result->status = NacpLoadStatus::Loaded;
-        std::strcpy(result->lang.name, data->name);
-        std::strcpy(result->lang.author, data->publisher);
-        result->icon.resize(data->icon_size);
-        std::memcpy(result->icon.data(), data->icon_data, result->icon.size());
     } else {
         if (cached) {
             *cached = false;
@@ -322,6 +397,7 @@ auto ThreadData::Get(u64 app_id, bool* cached) -> ThreadResultData* {
 
             // add new entry to cache, if valid.
             if (valid) {
+                SCOPED_MUTEX(&m_mutex_nxtc);
                 nxtcAddEntry(app_id, &control->nacp, result->icon.size(), result->icon.data(), true);
             }
 
@@ -376,18 +452,15 @@ auto ThreadData::Get(u64 app_id, bool* cached) -> ThreadResultData* {
         }
     }
 
-    SCOPED_MUTEX(&m_mutex_result);
-    return m_result.emplace_back(std::move(result)).get();
+    // if the same id was fetched by another thread whilst this one was, keep the first.
+    auto& shard = GetShard(app_id);
+    SCOPED_MUTEX(&shard.mutex);
+    return shard.map.try_emplace(app_id, std::move(result)).first->second.get();
 }
 
 void ThreadFunc(void* user) {
     auto data = static_cast<ThreadData*>(user);
 
-    if (data->IsTitleCacheEnabled() && !nxtcInitialize()) {
-        log_write("[NXTC] failed to init cache\n");
-    }
-    ON_SCOPE_EXIT(nxtcExit());
-
     while (data->IsRunning()) {
         data->Run();
     }
@@ -408,8 +481,24 @@ Result Init() {
         }
 
         g_thread_data = std::make_unique<ThreadData>(true);
-        R_TRY(utils::CreateThread(&g_thread, ThreadFunc, g_thread_data.get(), 1024*32));
-        R_TRY(threadStart(&g_thread));
+
+        // the first thread is required, the others only make fetching faster.
+        R_TRY(utils::CreateThread(&g_threads[0], ThreadFunc, g_thread_data.get(), 1024*32));
+        R_TRY(threadStart(&g_threads[0]));
+        g_thread_count = 1;
+
+        for (u32 i = 1; i < WORKER_THREADS; i++) {
+            if (R_FAILED(utils::CreateThread(&g_threads[i], ThreadFunc, g_thread_data.get(), 1024*32))) {
+                break;
+            }
+
+            if (R_FAILED(threadStart(&g_threads[i]))) {
+                threadClose(&g_threads[i]);
+                break;
+            }
+
+            g_thread_count++;
+        }
     }
 
     g_ref_count++;
@@ -427,8 +516,13 @@ void Exit() {
     if (!g_ref_count) {
         g_thread_data->Close();
 
-        threadWaitForExit(&g_thread);
-        threadClose(&g_thread);
+        for (u32 i = 0; i < g_thread_count; i++) {
+            threadWaitForExit(&g_threads[i]);
+            threadClose(&g_threads[i]);
+        }
+        g_thread_count = 0;
+
+        g_thread_data->ExitCache();
         g_thread_data.reset();
 
         for (auto& e : ncm_entries) {
@@ -437,6 +531,8 @@ void Exit() {
 
         ns::Exit();
         ncmExit();
+
+        InvalidateMetaEntries();
     }
 }
 
@@ -445,6 +541,8 @@ void Clear() {
     if (g_thread_data) {
         g_thread_data->Clear();
     }
+
+    InvalidateMetaEntries();
 }
 
 void PushAsync(u64 app_id) {
@@ -486,12 +584,32 @@ auto GetNcmDb(u8 storage_id) -> NcmContentMetaDatabase& {
 }
 
 Result GetMetaEntries(u64 id, MetaEntries& out, u32 flags) {
-    s32 count;
-    R_TRY(nsCountApplicationContentMeta(id, &count));
+    MetaEntries entries;
+    u64 generation;
+    bool found{};
 
-    std::vector<NsApplicationContentMetaStatus> entries(count);
-    R_TRY(nsListApplicationContentMetaStatus(id, 0, entries.data(), entries.size(), &count));
-    entries.resize(count);
+    {
+        SCOPED_MUTEX(&g_meta_mutex);
+        generation = g_meta_generation;
+        if (const auto it = g_meta_index.find(id); it != g_meta_index.end()) {
+            entries = it->second;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        s32 count;
+        R_TRY(nsCountApplicationContentMeta(id, &count));
+
+        entries.resize(count);
+        R_TRY(nsListApplicationContentMetaStatus(id, 0, entries.data(), entries.size(), &count));
+        entries.resize(count);
+
+        SCOPED_MUTEX(&g_meta_mutex);
+        if (generation == g_meta_generation) {
+            g_meta_index.try_emplace(id, entries);
+        }
+    }
 
     for (const auto& e : entries) {
         if (flags & ContentMetaTypeToContentFlag(e.meta_type)) {
@@ -502,6 +620,18 @@ Result GetMetaEntries(u64 id, MetaEntries& out, u32 flags) {
     R_SUCCEED();
 }
 
+void InvalidateMetaEntries(u64 id) {
+    SCOPED_MUTEX(&g_meta_mutex);
+    g_meta_index.erase(id);
+    g_meta_generation++;
+}
+
+void InvalidateMetaEntries() {
+    SCOPED_MUTEX(&g_meta_mutex);
+    g_meta_index.clear();
+    g_meta_generation++;
+}
+
 Result GetControlPathFromStatus(const NsApplicationContentMetaStatus& status, u64* out_program_id, fs::FsPath* out_path) {
     const auto& ee = status;
     if (ee.storageID != NcmStorageId_SdCard && ee.storageID != NcmStorageId_BuiltInUser && ee.storageID != NcmStorageId_GameCard) {
@@ -19,8 +19,10 @@
 #include "nro.hpp"
 #include "web.hpp"
 #include "minizip_helper.hpp"
+#include "thumb_cache.hpp"
 
 #include "utils/utils.hpp"
+#include "utils/thread.hpp"
 
 #include <minIni.h>
 #include <string>
@@ -28,7 +30,9 @@
 #include <yyjson.h>
 #include <stb_image.h>
 #include <minizip/unzip.h>
+#include <zlib.h>
 #include <algorithm>
+#include <atomic>
 #include <ranges>
 #include <utility>
 
@@ -36,6 +40,7 @@ namespace sphaira::ui::menu::appstore {
 namespace {
 
 constexpr fs::FsPath REPO_PATH{"/switch/sphaira/cache/appstore/repo.json"};
+constexpr fs::FsPath REPO_SNAPSHOT_PATH{"/switch/sphaira/cache/appstore/repo.bin"};
 constexpr fs::FsPath CACHE_PATH{"/switch/sphaira/cache/appstore"};
 constexpr auto URL_BASE = "https://switch.cdn.fortheusers.org";
 constexpr auto URL_JSON = "https://switch.cdn.fortheusers.org/repo.json";
@@ -172,6 +177,148 @@ void from_json(const fs::FsPath& path, std::vector<appstore::Entry>& e) {
     );
 }
 
+// binary snapshot of the parsed repo.json, loaded in a single read rather than
+// parsing the json on every open. it's rebuilt whenever the json changes,
+// which is detected from the size and modified time of the json.
+// layout: header, records, then the string arena that the records point into.
+constexpr u32 SNAPSHOT_MAGIC = 0x53525053; // SPRS
+constexpr u32 SNAPSHOT_VERSION = 1;
+
+constexpr std::string Entry::* SNAPSHOT_STRINGS[] = {
+    &Entry::category, &Entry::binary, &Entry::updated, &Entry::name,
+    &Entry::license, &Entry::title, &Entry::url, &Entry::description,
+    &Entry::author, &Entry::changelog, &Entry::version, &Entry::details,
+    &Entry::md5,
+};
+
+struct SnapshotHeader {
+    u32 magic;
+    u32 version;
+    u64 json_size;
+    u64 json_modified;
+    u32 count;
+    u32 arena_size;
+};
+
+struct SnapshotString {
+    u32 off;
+    u32 len;
+};
+
+struct SnapshotRecord {
+    SnapshotString strings[std::size(SNAPSHOT_STRINGS)];
+    u64 screens;
+    u64 extracted;
+    u64 filesize;
+    u64 app_dls;
+};
+
+auto GetSnapshotKey(fs::Fs& fs, SnapshotHeader& header) -> bool {
+    FsTimeStampRaw ts{};
+    s64 size{};
+    if (R_FAILED(fs.FileGetSizeAndTimestamp(REPO_PATH, &ts, &size))) {
+        return false;
+    }
+
+    header.json_size = size;
+    header.json_modified = ts.modified;
+    return true;
+}
+
+auto LoadSnapshot(fs::Fs& fs, std::vector<Entry>& out) -> bool {
+    SnapshotHeader expected{};
+    if (!GetSnapshotKey(fs, expected)) {
+        return false;
+    }
+
+    std::vector<u8> data;
+    if (R_FAILED(fs.read_entire_file(REPO_SNAPSHOT_PATH, data)) || data.size() < sizeof(SnapshotHeader)) {
+        return false;
+    }
+
+    SnapshotHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+        header.json_size != expected.json_size || header.json_modified != expected.json_modified) {
+        log_write("[APPSTORE] repo snapshot is stale\n");
+        return false;
+    }
+
+    const auto records_size = (u64)header.count * sizeof(SnapshotRecord);
+    if (data.size() != sizeof(header) + records_size + header.arena_size) {
+        log_write("[APPSTORE] repo snapshot has bad size\n");
+        return false;
+    }
+
+    const auto records = data.data() + sizeof(header);
+    const auto arena = (const char*)records + records_size;
+
+    out.resize(header.count);
+    for (u32 i = 0; i < header.count; i++) {
+        SnapshotRecord record;
+        std::memcpy(&record, records + i * sizeof(record), sizeof(record));
+
+        auto& e = out[i];
+        for (size_t j = 0; j < std::size(SNAPSHOT_STRINGS); j++) {
+            const auto& str = record.strings[j];
+            if ((u64)str.off + str.len > header.arena_size) {
+                out.clear();
+                return false;
+            }
+            (e.*SNAPSHOT_STRINGS[j]).assign(arena + str.off, str.len);
+        }
+
+        e.screens = record.screens;
+        e.extracted = record.extracted;
+        e.filesize = record.filesize;
+        e.app_dls = record.app_dls;
+    }
+
+    return true;
+}
+
+void SaveSnapshot(fs::Fs& fs, const std::vector<Entry>& entries) {
+    SnapshotHeader header{};
+    if (!GetSnapshotKey(fs, header)) {
+        return;
+    }
+
+    std::vector<SnapshotRecord> records(entries.size());
+    std::string arena;
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const auto& e = entries[i];
+        auto& record = records[i];
+
+        for (size_t j = 0; j < std::size(SNAPSHOT_STRINGS); j++) {
+            const auto& str = e.*SNAPSHOT_STRINGS[j];
+            record.strings[j] = {(u32)arena.size(), (u32)str.size()};
+            arena += str;
+        }
+
+        record.screens = e.screens;
+        record.extracted = e.extracted;
+        record.filesize = e.filesize;
+        record.app_dls = e.app_dls;
+    }
+
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.count = records.size();
+    header.arena_size = arena.size();
+
+    const auto records_size = records.size() * sizeof(SnapshotRecord);
+    std::vector<u8> data(sizeof(header) + records_size + arena.size());
+    std::memcpy(data.data(), &header, sizeof(header));
+    std::memcpy(data.data() + sizeof(header), records.data(), records_size);
+    std::memcpy(data.data() + sizeof(header) + records_size, arena.data(), arena.size());
+
+    if (R_FAILED(fs.write_entire_file(REPO_SNAPSHOT_PATH, data))) {
+        log_write("[APPSTORE] failed to write repo snapshot\n");
+    }
+}
+
 auto ParseManifest(std::span<const char> view) -> ManifestEntries {
     ManifestEntries entries;
     // auto view = std::string_view{manifest_data.data(), manifest_data.size()};
@@ -370,12 +517,482 @@ auto UninstallApp(ProgressBox* pbox, const Entry& entry) -> Result {
 // 2. md5 check the zip
 // 3. parse manifest and unzip everything to placeholder
 // 4. move everything from placeholder to normal location
-auto InstallApp(ProgressBox* pbox, const Entry& entry) -> Result {
-    static const fs::FsPath zip_out{"/switch/sphaira/cache/appstore/temp.zip"};
-    std::vector<u8> buf(1024 * 512); // 512KiB
+// removes files that are no longer in the manifest.
+void RemoveOldFiles(fs::Fs& fs, const ManifestEntries& old_manifest, const ManifestEntries& new_manifest) {
+    for (auto& old_entry : old_manifest) {
+        bool found = false;
+        for (auto& new_entry : new_manifest) {
+            if (!strcasecmp(old_entry.path, new_entry.path)) {
+                found = true;
+                break;
+            }
+        }
 
-    fs::FsNativeSd fs;
-    R_TRY(fs.GetFsOpenResult());
+        if (!found) {
+            const auto safe_buf = fs::AppendPath("/", old_entry.path);
+            // std::strcat(safe_buf, old_entry.path);
+            if (R_FAILED(fs.DeleteFile(safe_buf))) {
+                log_write("failed to delete: %s\n", safe_buf.s);
+            } else {
+                log_write("deleted file: %s\n", safe_buf.s);
+                svcSleepThread(1e+5);
+            }
+        }
+    }
+}
+
+// serialises moving files into place, so that batch installs don't all hit the sd at once.
+Mutex g_commit_mutex{};
+
+// entries closer than this are fetched in a single request, along with the entries between them.
+constexpr s64 DELTA_MAX_GAP = 1024 * 64;
+
+// returns true if the installed file doesn't match the entry in the zip.
+auto FileDiffers(fs::Fs& fs, const mz::CentralEntry& e) -> bool {
+    const auto path = fs::AppendPath("/", e.name);
+
+    fs::File file;
+    if (R_FAILED(fs.OpenFile(path, FsOpenMode_Read, &file))) {
+        return true;
+    }
+
+    s64 size;
+    if (R_FAILED(file.GetSize(&size)) || size != e.uncompressed_size) {
+        return true;
+    }
+
+    std::vector<u8> buf(1024 * 256);
+    u32 crc = crc32(0, nullptr, 0);
+    for (s64 off = 0; off < size;) {
+        u64 bytes_read;
+        if (R_FAILED(file.Read(off, buf.data(), buf.size(), 0, &bytes_read)) || !bytes_read) {
+            return true;
+        }
+
+        crc = crc32(crc, buf.data(), bytes_read);
+        off += bytes_read;
+    }
+
+    return crc != e.crc32;
+}
+
+// fetches a range of whole entries and pushes them to the unzip.
+// if_range pins the request to the version of the zip that the central directory came from.
+auto DownloadRange(const std::string& url, const std::string& if_range, s64 off, s64 size, mz::StreamUnzip& unzip, const curl::OnProgress& on_progress, s64 max_speed) -> Result {
+    Result stream_rc{};
+    s64 received{};
+
+    const auto api_result = curl::Api().ToMemory(
+        curl::Url{url},
+        curl::Header{
+            { "If-Range", if_range },
+        },
+        curl::Range{off, size},
+        curl::MaxSpeed{max_speed},
+        curl::OnProgress{on_progress},
+        curl::OnDownloadData{[&](const void* data, size_t data_size) -> bool {
+            // the server ignored the range and is sending the whole zip.
+            received += data_size;
+            if (received > size) {
+                return false;
+            }
+
+            stream_rc = unzip.Push(data, data_size);
+            return R_SUCCEEDED(stream_rc);
+        }}
+    );
+
+    R_TRY(stream_rc);
+    R_UNLESS(api_result.success && api_result.code == 206 && received == size, Result_AppstoreFailedDeltaDownload);
+    return unzip.EndRange();
+}
+
+// rather than downloading the whole zip, fetches the central directory and then
+// only the entries whose crc32 doesn't match the installed file.
+// the manifest and info are always fetched, so that the commit works as normal.
+// fails if the server doesn't support ranges, or if the delta isn't worth it,
+// in which case the whole zip should be downloaded instead.
+auto DownloadAppDelta(fs::Fs& fs, const Entry& entry, const fs::FsPath& staging, mz::StreamUnzip& unzip, std::vector<fs::FsPath>& wanted, const curl::OnProgress& on_progress, s64 max_speed) -> Result {
+    const auto url = BuildZipUrl(entry);
+
+    // 1. fetch the end of the zip, which usually contains the whole central directory.
+    const auto tail_result = curl::Api().ToMemory(
+        curl::Url{url},
+        curl::Range{-1, mz::END_RECORD_SEARCH_SIZE}
+    );
+    R_UNLESS(tail_result.success && tail_result.code == 206, Result_AppstoreFailedDeltaDownload);
+
+    // Content-Range: bytes 123-456/789
+    const auto it = tail_result.header.Find("content-range");
+    R_UNLESS(it != tail_result.header.m_map.end(), Result_AppstoreFailedDeltaDownload);
+    const auto slash = it->second.rfind('/');
+    R_UNLESS(slash != std::string::npos, Result_AppstoreFailedDeltaDownload);
+
+    const s64 zip_size = std::strtoll(it->second.c_str() + slash + 1, nullptr, 10);
+    const s64 tail_off = zip_size - tail_result.data.size();
+    R_UNLESS(tail_off >= 0, Result_AppstoreFailedDeltaDownload);
+
+    // if the zip changes between requests, the server sends the whole zip with
+    // a 200 rather than the range, so the entries can't come from different versions.
+    // a weak etag can't be used with If-Range.
+    std::string if_range;
+    if (auto v = tail_result.header.Find("etag"); v != tail_result.header.m_map.end() && !v->second.starts_with("W/")) {
+        if_range = v->second;
+    } else if (auto v = tail_result.header.Find("last-modified"); v != tail_result.header.m_map.end()) {
+        if_range = v->second;
+    }
+    R_UNLESS(!if_range.empty(), Result_AppstoreFailedDeltaDownload);
+
+    s64 cd_off, cd_size;
+    R_TRY(mz::FindCentralDirectory(tail_result.data, cd_off, cd_size));
+    R_UNLESS(cd_off + cd_size <= zip_size, Result_MmzBadEndRecord);
+
+    std::vector<mz::CentralEntry> entries;
+    if (cd_off >= tail_off) {
+        R_TRY(mz::ParseCentralDirectory(std::span{tail_result.data}.subspan(cd_off - tail_off, cd_size), entries));
+    } else {
+        const auto cd_result = curl::Api().ToMemory(
+            curl::Url{url},
+            curl::Header{
+                { "If-Range", if_range },
+            },
+            curl::Range{cd_off, cd_size}
+        );
+        R_UNLESS(cd_result.success && cd_result.code == 206 && (s64)cd_result.data.size() == cd_size, Result_AppstoreFailedDeltaDownload);
+        R_TRY(mz::ParseCentralDirectory(cd_result.data, entries));
+    }
+
+    std::ranges::sort(entries, {}, &mz::CentralEntry::offset);
+
+    // each local header is checked against the central directory, as the delta
+    // isn't covered by the md5 of the zip.
+    unzip.SetCentralDirectory(entries);
+    ON_SCOPE_EXIT(unzip.SetCentralDirectory({}));
+
+    // each entry runs up to the next local header, which includes any data descriptor.
+    const auto get_end = [&](size_t i) -> s64 {
+        return i + 1 < entries.size() ? entries[i + 1].offset : cd_off;
+    };
+
+    // fetches the entries, merging those that are close together into a single request.
+    // progress carries on from the previous fetch, so that it only grows.
+    s64 total{}, done{};
+    const auto fetch = [&](const std::vector<size_t>& indices) -> Result {
+        for (const auto i : indices) {
+            total += get_end(i) - entries[i].offset;
+        }
+
+        for (size_t i = 0; i < indices.size();) {
+            const auto start = entries[indices[i]].offset;
+            auto end = get_end(indices[i]);
+
+            for (i++; i < indices.size() && entries[indices[i]].offset - end <= DELTA_MAX_GAP; i++) {
+                end = get_end(indices[i]);
+            }
+
+            log_write("[APPSTORE] delta fetching range: %zd-%zd\n", start, end);
+            R_TRY(DownloadRange(url, if_range, start, end - start, unzip, [&, done](s64 dltotal, s64 dlnow, s64 ultotal, s64 ulnow) {
+                return on_progress(total, done + dlnow, 0, 0);
+            }, max_speed));
+            done += end - start;
+        }
+
+        R_SUCCEED();
+    };
+
+    // 2. fetch the manifest and info.
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!std::strcmp(entries[i].name, "info.json") || !std::strcmp(entries[i].name, "manifest.install")) {
+            indices.emplace_back(i);
+            wanted.emplace_back(entries[i].name);
+        }
+    }
+
+    R_UNLESS(indices.size() == 2, Result_UnzLocateFile);
+    R_TRY(fetch(indices));
+
+    std::vector<u8> manifest_data;
+    R_TRY(fs.read_entire_file(fs::AppendPath(staging, "manifest.install"), manifest_data));
+    const auto manifest = ParseManifest(std::span{(const char*)manifest_data.data(), manifest_data.size()});
+    R_UNLESS(!manifest.empty(), Result_AppstoreFailedParseManifest);
+
+    // 3. fetch the entries that have changed.
+    indices.clear();
+    wanted.clear();
+    s64 delta_size{};
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const auto& e = entries[i];
+        const auto m = std::ranges::find_if(manifest, [&e](auto& m){
+            return !strcasecmp(e.name, m.path);
+        });
+
+        if (m == manifest.end()) {
+            continue;
+        }
+
+        const auto needed = m->command == 'G' ? !fs.FileExists(fs::AppendPath("/", e.name)) : FileDiffers(fs, e);
+        if (needed) {
+            indices.emplace_back(i);
+            wanted.emplace_back(e.name);
+            delta_size += get_end(i) - e.offset;
+        }
+    }
+
+    // downloading the whole zip also checks its md5, so prefer that if little would be saved.
+    if (delta_size >= zip_size / 2) {
+        log_write("[APPSTORE] delta of %zd bytes is not worth it for %zd zip\n", delta_size, zip_size);
+        R_THROW(Result_AppstoreFailedDeltaDownload);
+    }
+
+    log_write("[APPSTORE] delta update: %zu of %zu files, %zd of %zd bytes\n", indices.size(), entries.size(), delta_size, zip_size);
+    return fetch(indices);
+}
+
+// downloads, hashes and extracts the zip in a single pass, rather than writing
+// the zip to the sd card and then reading it back to hash and again to extract.
+// files are extracted to a staging folder and only moved into place once the
+// md5 of the whole zip has matched, replaced files are restored if that fails.
+// if on_progress is set, progress is reported through it rather than the pbox,
+// this is used by batch installs which report the total progress of all installs.
+// max_speed limits the download in bytes per second, 0 is unlimited.
+auto InstallAppStream(ProgressBox* pbox, const Entry& entry, fs::Fs& fs, const curl::OnProgress& on_progress = {}, s64 max_speed = 0) -> Result {
+    const auto root = fs::AppendPath("/switch/sphaira/cache/appstore/staging", entry.name);
+    const auto staging = fs::AppendPath(root, "files");
+    const auto backup = fs::AppendPath(root, "backup");
+    const auto batch = on_progress != nullptr;
+
+    fs.DeleteDirectoryRecursively(root);
+    ON_SCOPE_EXIT(fs.DeleteDirectoryRecursively(root));
+
+    auto md5 = hash::Create(hash::Type::Md5);
+    std::vector<fs::FsPath> staged; // names of the extracted entries.
+    std::vector<fs::FsPath> wanted; // if not empty, only these entries are extracted.
+    fs::FsPath name{};
+    fs::File file{};
+    s64 file_off{};
+    Result stream_rc{};
+
+    const auto make_unzip = [&]() {
+        return mz::StreamUnzip{
+            [&](const fs::FsPath& _name, s64 size, bool& extract) -> Result {
+                if (!wanted.empty() && std::ranges::find(wanted, _name) == wanted.end()) {
+                    extract = false;
+                    R_SUCCEED();
+                }
+
+                // the manifest may come last, so everything is extracted and filtered on commit.
+                extract = !std::strstr(_name, "..");
+                if (!extract) {
+                    log_write("[APPSTORE] skipping bad path: %s\n", _name.s);
+                    R_SUCCEED();
+                }
+
+                name = _name;
+                file_off = 0;
+
+                const auto path = fs::AppendPath(staging, name);
+                fs.CreateDirectoryRecursivelyWithPath(path);
+                R_TRY(fs.CreateFile(path, size, 0));
+                return fs.OpenFile(path, FsOpenMode_Write|FsOpenMode_Append, &file);
+            },
+            [&](const void* data, s64 size) -> Result {
+                R_TRY(file.Write(file_off, data, size, FsWriteOption_None));
+                file_off += size;
+                R_SUCCEED();
+            },
+            [&]() -> Result {
+                file.Close();
+                staged.emplace_back(name);
+                R_SUCCEED();
+            }
+        };
+    };
+
+    const auto report = batch ? on_progress : pbox->OnDownloadProgressCallback();
+    bool is_delta{};
+
+    // if the delta fails, the whole zip is downloaded from the start, that download
+    // is reported after what the delta fetched so that progress only grows.
+    s64 progress_base{}, progress_now{};
+    const auto progress = [&](s64 dltotal, s64 dlnow, s64 ultotal, s64 ulnow) -> bool {
+        progress_now = progress_base + dlnow;
+        return report(progress_base + dltotal, progress_now, ultotal, ulnow);
+    };
+
+    // 1. if the app is installed, try to only fetch the files that have changed.
+    if (!pbox->ShouldExit() && entry.status == EntryStatus::Update) {
+        if (!batch) {
+            pbox->NewTransfer(i18n::Reorder("Downloading ", entry.title));
+        }
+        log_write("starting delta download\n");
+
+        auto unzip = make_unzip();
+        const auto rc = DownloadAppDelta(fs, entry, staging, unzip, wanted, progress, max_speed);
+        file.Close();
+
+        if (R_SUCCEEDED(rc)) {
+            is_delta = true;
+        } else {
+            log_write("[APPSTORE] delta update failed: 0x%X, downloading the whole zip\n", rc);
+            fs.DeleteDirectoryRecursively(staging);
+            staged.clear();
+            wanted.clear();
+            progress_base = progress_now;
+        }
+    }
+
+    // 2. download, hash and extract the zip.
+    if (!pbox->ShouldExit() && !is_delta) {
+        if (!batch) {
+            pbox->NewTransfer(i18n::Reorder("Downloading ", entry.title));
+        }
+        log_write("starting stream download\n");
+
+        auto unzip = make_unzip();
+        const auto api_result = curl::Api().ToMemory(
+            curl::Url{BuildZipUrl(entry)},
+            curl::MaxSpeed{max_speed},
+            curl::OnProgress{progress},
+            curl::OnDownloadData{[&](const void* data, size_t size) -> bool {
+                md5->Update(data, size, 0);
+                stream_rc = unzip.Push(data, size);
+                return R_SUCCEEDED(stream_rc);
+            }}
+        );
+
+        file.Close();
+        R_TRY(stream_rc);
+        R_UNLESS(api_result.success, Result_AppstoreFailedZipDownload);
+        R_TRY(unzip.Finish());
+    }
+
+    // 3. md5 check the zip, a delta is checked against the central directory instead.
+    if (!pbox->ShouldExit() && !is_delta) {
+        std::string hash_out;
+        md5->Get(hash_out);
+
+        if (strncasecmp(hash_out.data(), entry.md5.data(), entry.md5.length())) {
+            log_write("bad md5: %.*s vs %.*s\n", 32, hash_out.data(), 32, entry.md5.c_str());
+            R_THROW(Result_AppstoreFailedMd5);
+        }
+    }
+
+    // 4. move the extracted files into place.
+    // nothing has been moved yet, so a cancelled install leaves the app as it was.
+    R_TRY(pbox->ShouldExitResult());
+    {
+        std::vector<u8> manifest_data;
+        if (R_FAILED(fs.read_entire_file(fs::AppendPath(staging, "manifest.install"), manifest_data))) {
+            log_write("failed to find manifest.install\n");
+            R_THROW(Result_UnzLocateFile);
+        }
+
+        const auto new_manifest = ParseManifest(std::span{(const char*)manifest_data.data(), manifest_data.size()});
+        if (new_manifest.empty()) {
+            log_write("manifest is empty!\n");
+            R_THROW(Result_AppstoreFailedParseManifest);
+        }
+
+        const auto old_manifest = LoadAndParseManifest(entry);
+
+        SCOPED_MUTEX(&g_commit_mutex);
+        TimeStamp ts;
+
+        struct Replaced {
+            fs::FsPath path;
+            fs::FsPath backup;
+            bool existed;
+        };
+
+        // files moved into place so far, undone if the commit fails part way.
+        std::vector<Replaced> replaced;
+
+        const auto commit = [&]() -> Result {
+            for (const auto& staged_name : staged) {
+                const auto it = std::ranges::find_if(new_manifest, [&staged_name](auto& e){
+                    return !strcasecmp(staged_name, e.path);
+                });
+
+                if (it == new_manifest.end()) {
+                    continue;
+                }
+
+                const auto path = fs::AppendPath("/", it->path);
+                switch (it->command) {
+                    case 'E': // both are the same?
+                    case 'U':
+                        break;
+
+                    case 'G': // checks if file exists, if not, extract
+                        if (fs.FileExists(path)) {
+                            continue;
+                        }
+                        break;
+
+                    default:
+                        log_write("bad command: %c\n", it->command);
+                        continue;
+                }
+
+                if (!batch) {
+                    pbox->NewTransfer(it->path);
+                }
+
+                // keep the old file around until the whole app has been committed.
+                const auto backup_path = fs::AppendPath(backup, staged_name);
+                const auto existed = fs.FileExists(path);
+                if (existed) {
+                    fs.CreateDirectoryRecursivelyWithPath(backup_path);
+                    R_TRY(fs.RenameFile(path, backup_path));
+                }
+                replaced.emplace_back(path, backup_path, existed);
+
+                fs.CreateDirectoryRecursivelyWithPath(path);
+                R_TRY(fs.RenameFile(fs::AppendPath(staging, staged_name), path));
+            }
+
+            R_SUCCEED();
+        };
+
+        if (const auto rc = commit(); R_FAILED(rc)) {
+            log_write("[APPSTORE] failed to commit %s, restoring %zu files\n", entry.name.c_str(), replaced.size());
+            for (const auto& e : std::views::reverse(replaced)) {
+                fs.DeleteFile(e.path);
+                if (e.existed) {
+                    fs.RenameFile(e.backup, e.path);
+                }
+            }
+            return rc;
+        }
+
+        log_write("\n\t[APPSTORE] finished commit, time taken: %.2fs %zums\n\n", ts.GetSecondsD(), ts.GetMs());
+
+        RemoveOldFiles(fs, old_manifest, new_manifest);
+
+        // written once every file is in place, so that a failed commit keeps the old manifest.
+        // the files are installed at this point, so a failure here isn't rolled back, the
+        // app will just be listed as needing an update.
+        // the folder doesn't exist if the app was never installed, or was uninstalled.
+        fs.CreateDirectoryRecursively(BuildPackageCachePath(entry));
+        if (const auto rc = fs.copy_entire_file(BuildInfoCachePath(entry), fs::AppendPath(staging, "info.json")); R_FAILED(rc)) {
+            log_write("[APPSTORE] failed to save info for %s: 0x%X\n", entry.name.c_str(), rc);
+            return rc;
+        }
+        if (const auto rc = fs.copy_entire_file(BuildManifestCachePath(entry), fs::AppendPath(staging, "manifest.install")); R_FAILED(rc)) {
+            log_write("[APPSTORE] failed to save manifest for %s: 0x%X\n", entry.name.c_str(), rc);
+            return rc;
+        }
+    }
+
+    log_write("finished install :)\n");
+    R_SUCCEED();
+}
+
+// downloads the zip and extracts it using the central directory.
+auto InstallAppFromZip(ProgressBox* pbox, const Entry& entry, fs::Fs& fs) -> Result {
+    static const fs::FsPath zip_out{"/switch/sphaira/cache/appstore/temp.zip"};
 
     // check if we can download the entire zip to mem for faster download / extract times.
     // current limit is 300MiB, or disabled for applet mode.
@@ -395,6 +1012,7 @@ auto InstallApp(ProgressBox* pbox, const Entry& entry) -> Result {
 
         if (file_download) {
             api.SetOption(curl::Path{zip_out});
+            api.SetOption(curl::Flags{curl::Flag_Resume});
             api_result = curl::ToFile(api);
         } else {
             api_result = curl::ToMemory(api);
@@ -432,7 +1050,9 @@ auto InstallApp(ProgressBox* pbox, const Entry& entry) -> Result {
     }
 
     // 3. extract the zip
-    if (!pbox->ShouldExit()) {
+    // nothing has been extracted yet, so a cancelled install leaves the app as it was.
+    R_TRY(pbox->ShouldExitResult());
+    {
         auto zfile = unzOpen2_64(zip_out, &file_func);
         R_UNLESS(zfile, Result_UnzOpen2_64);
         ON_SCOPE_EXIT(unzClose(zfile));
@@ -534,40 +1154,108 @@ auto InstallApp(ProgressBox* pbox, const Entry& entry) -> Result {
         log_write("\n\t[APPSTORE] finished extract new, time taken: %.2fs %zums\n\n", ts.GetSecondsD(), ts.GetMs());
 
         // finally finally, remove files no longer in the manifest
-        for (auto& old_entry : old_manifest) {
-            bool found = false;
-            for (auto& new_entry : new_manifest) {
-                if (!strcasecmp(old_entry.path, new_entry.path)) {
-                    found = true;
-                    break;
-                }
+        RemoveOldFiles(fs, old_manifest, new_manifest);
+    }
+
+    log_write("finished install :)\n");
+    R_SUCCEED();
+}
+
+auto InstallApp(ProgressBox* pbox, const Entry& entry) -> Result {
+    fs::FsNativeSd fs;
+    R_TRY(fs.GetFsOpenResult());
+
+    const auto rc = InstallAppStream(pbox, entry, fs);
+    if (rc != Result_MmzUnsupportedEntry) {
+        return rc;
+    }
+
+    log_write("[APPSTORE] zip can't be streamed, extracting with the central directory\n");
+    return InstallAppFromZip(pbox, entry, fs);
+}
+
+// installs several apps at once, each install streams its zip so one app is
+// extracting whilst the others are still downloading.
+// apps that can't be streamed are installed one at a time afterwards.
+// the result of each install is written to results.
+// max_speed is the combined download limit in bytes per second, 0 is unlimited.
+auto InstallApps(ProgressBox* pbox, std::span<const Entry* const> entries, u32 jobs, s64 max_speed, std::span<Result> results) -> Result {
+    fs::FsNativeSd fs;
+    R_TRY(fs.GetFsOpenResult());
+
+    Mutex mutex{};
+    std::vector<s64> downloaded(entries.size());
+    std::atomic<u32> next{};
+    s64 total_now{};
+    s64 total{};
+    u32 done{};
+
+    for (const auto e : entries) {
+        total += e->filesize * 1024;
+    }
+
+    // the limit is shared between the downloads running at once.
+    jobs = std::min<u32>(jobs, entries.size());
+    if (jobs) {
+        max_speed /= jobs;
+    }
+
+    // anything not started, ie, cancelled, is reported as failed.
+    std::ranges::fill(results, Result_TransferCancelled);
+    pbox->NewTransfer("Downloading "_i18n);
+
+    const auto worker = [&]() {
+        for (;;) {
+            const auto i = next++;
+            if (i >= entries.size() || pbox->ShouldExit()) {
+                break;
             }
 
-            if (!found) {
-                const auto safe_buf = fs::AppendPath("/", old_entry.path);
-                // std::strcat(safe_buf, old_entry.path);
-                if (R_FAILED(fs.DeleteFile(safe_buf))) {
-                    log_write("failed to delete: %s\n", safe_buf.s);
-                } else {
-                    log_write("deleted file: %s\n", safe_buf.s);
-                    svcSleepThread(1e+5);
+            const auto on_progress = [&, i](s64 dltotal, s64 dlnow, s64 ultotal, s64 ulnow) -> bool {
+                if (pbox->ShouldExit()) {
+                    return false;
                 }
-            }
+
+                SCOPED_MUTEX(&mutex);
+                total_now += dlnow - downloaded[i];
+                downloaded[i] = dlnow;
+                pbox->UpdateTransfer(total_now, std::max(total, total_now));
+                return true;
+            };
+
+            results[i] = InstallAppStream(pbox, *entries[i], fs, on_progress, max_speed);
+
+            SCOPED_MUTEX(&mutex);
+            pbox->SetTitle(std::to_string(++done) + " / " + std::to_string(entries.size()));
+        }
+    };
+
+    {
+        // the calling thread is one of the jobs, so the installs run even if no thread could be created.
+        std::vector<std::unique_ptr<utils::Async>> threads;
+        for (u32 i = 1; i < jobs; i++) {
+            threads.emplace_back(std::make_unique<utils::Async>(worker));
         }
+        worker();
     }
 
-    log_write("finished install :)\n");
-    R_SUCCEED();
-}
+    for (size_t i = 0; i < entries.size() && !pbox->ShouldExit(); i++) {
+        if (results[i] == Result_MmzUnsupportedEntry) {
+            log_write("[APPSTORE] zip can't be streamed, extracting with the central directory\n");
+            results[i] = InstallAppFromZip(pbox, *entries[i], fs);
+        }
+    }
 
-// case-insensitive version of str.find()
-auto FindCaseInsensitive(std::string_view base, std::string_view term) -> bool {
-    const auto it = std::search(base.cbegin(), base.cend(), term.cbegin(), term.cend(), [](char a, char b){
-        return std::toupper(a) == std::toupper(b);
-    });
-    return it != base.cend();
+    return pbox->ShouldExitResult();
 }
 
+// fields added to the search index, in order of rank.
+enum SearchField : u32 {
+    SearchField_Title,
+    SearchField_Author,
+    SearchField_Description,
+};
+
 } // namespace
 
 EntryMenu::EntryMenu(Entry& entry, const LazyImage& default_icon, Menu& menu)
@@ -976,6 +1664,10 @@ Menu::Menu(u32 flags) : grid::Menu{"AppStore"_i18n, flags} {
                     log_write("got %s\n", out.c_str());
                 }
             });
+
+            options->Add<SidebarEntryCallback>("Update all"_i18n, [this](){
+                UpdateAll();
+            });
         }})
     );
 
@@ -1029,23 +1721,27 @@ void Menu::Draw(NVGcontext* vg, Theme* theme) {
         return;
     }
 
-    // max images per frame, in order to not hit io / gpu too hard.
-    const int image_load_max = 2;
-    int image_load_count = 0;
+    // upload the images that finished decoding since the last frame.
+    m_decoder.Upload(vg);
+
+    s64 visible_start = -1;
+    s64 visible_end = -1;
 
-    m_list->Draw(vg, theme, m_entries_current.size(), [this, &image_load_count](auto* vg, auto* theme, auto v, auto pos) {
+    m_list->Draw(vg, theme, m_entries_current.size(), [this, &visible_start, &visible_end](auto* vg, auto* theme, auto v, auto pos) {
         const auto& [x, y, w, h] = v;
         const auto index = m_entries_current[pos];
         auto& e = m_entries[index];
         auto& image = e.image;
 
+        if (visible_start < 0) {
+            visible_start = pos;
+        }
+        visible_end = pos;
+
         // try and load cached image.
-        if (image_load_count < image_load_max && !image.image && !image.tried_cache) {
+        if (!image.image && !image.tried_cache && !image.decoding) {
             image.tried_cache = true;
-            image.cached = EntryLoadImageFile(BuildIconCachePath(e), image);
-            if (image.cached) {
-                image_load_count++;
-            }
+            LoadImageAsync(index, true);
         }
 
         // lazy load image
@@ -1055,12 +1751,15 @@ void Menu::Draw(NVGcontext* vg, Theme* theme) {
                     const auto path = BuildIconCachePath(e);
                     const auto url = BuildIconUrl(e);
                     image.state = ImageDownloadState::Progress;
+                    image.handle = curl::AsyncHandle::Create();
                     curl::Api().ToFileAsync(
                         curl::Url{url},
                         curl::Path{path},
                         curl::Flags{curl::Flag_Cache},
                         curl::StopToken{this->GetToken()},
+                        curl::AsyncHandle{image.handle},
                         curl::OnComplete{[this, &image](auto& result) {
+                            image.handle = {};
                             if (result.success) {
                                 image.state = ImageDownloadState::Done;
                                 // data hasn't changed
@@ -1078,13 +1777,8 @@ void Menu::Draw(NVGcontext* vg, Theme* theme) {
 
                 }   break;
                 case ImageDownloadState::Done: {
-                    if (image_load_count < image_load_max) {
-                        image.cached = false;
-                        if (!EntryLoadImageFile(BuildIconCachePath(e), e.image)) {
-                            image.state = ImageDownloadState::Failed;
-                        } else {
-                            image_load_count++;
-                        }
+                    if (!image.decoding) {
+                        LoadImageAsync(index, false);
                     }
                 }   break;
                 case ImageDownloadState::Failed: {
@@ -1116,6 +1810,65 @@ void Menu::Draw(NVGcontext* vg, Theme* theme) {
                 break;
         }
     });
+
+    UpdateImageDownloads(visible_start, visible_end);
+}
+
+void Menu::LoadImageAsync(u32 index, bool from_cache) {
+    m_entries[index].image.decoding = true;
+
+    m_decoder.Push([path = BuildIconCachePath(m_entries[index])]() {
+        return thumb::LoadFromFile(path);
+    }, [this, index, from_cache](int new_image, const ImageResult& result) {
+        auto& image = m_entries[index].image;
+        image.decoding = false;
+
+        if (!new_image) {
+            // a missing cache is expected, the image is then downloaded.
+            if (!from_cache) {
+                image.state = ImageDownloadState::Failed;
+            }
+            return;
+        }
+
+        if (image.image) {
+            nvgDeleteImage(App::GetVg(), image.image);
+        }
+
+        image.image = new_image;
+        image.w = result.w;
+        image.h = result.h;
+        std::memcpy(image.first_pixel, result.data.data(), sizeof(image.first_pixel));
+        image.cached = from_cache;
+    });
+}
+
+void Menu::UpdateImageDownloads(s64 start, s64 end) {
+    if (start < 0) {
+        return;
+    }
+
+    // downloads within a page of the screen are kept so that scrolling
+    // back and forth doesn't keep restarting them.
+    const auto margin = m_list->GetPage();
+
+    for (s64 pos = 0; pos < std::ssize(m_entries_current); pos++) {
+        auto& image = GetEntry(pos).image;
+        if (image.state != ImageDownloadState::Progress) {
+            continue;
+        }
+
+        if (pos >= start && pos <= end) {
+            image.handle.SetPriority(curl::Priority::High);
+        } else if (pos >= start - margin && pos <= end + margin) {
+            image.handle.SetPriority(curl::Priority::Normal);
+        } else {
+            // downloaded again if it comes back into view.
+            image.handle.Cancel();
+            image.handle = {};
+            image.state = ImageDownloadState::None;
+        }
+    }
 }
 
 void Menu::OnFocusGained() {
@@ -1175,7 +1928,8 @@ void Menu::ScanHomebrew() {
     App::SetBoostMode(true);
     ON_SCOPE_EXIT(App::SetBoostMode(false));
 
-    from_json(REPO_PATH, m_entries);
+    // drop any images still being decoded for the old entries.
+    m_decoder.Clear();
 
     fs::FsNativeSd fs;
     if (R_FAILED(fs.GetFsOpenResult())) {
@@ -1183,16 +1937,35 @@ void Menu::ScanHomebrew() {
         return;
     }
 
+    TimeStamp ts;
+    if (LoadSnapshot(fs, m_entries)) {
+        log_write("[APPSTORE] loaded repo snapshot, time taken: %.2fs %zums\n", ts.GetSecondsD(), ts.GetMs());
+    } else {
+        m_entries.clear();
+        from_json(REPO_PATH, m_entries);
+        log_write("[APPSTORE] parsed repo json, time taken: %.2fs %zums\n", ts.GetSecondsD(), ts.GetMs());
+
+        if (!m_entries.empty()) {
+            SaveSnapshot(fs, m_entries);
+        }
+    }
+
     // pre-allocate the max size, can shrink later if needed
     for (auto& index : m_entries_index) {
         index.reserve(m_entries.size());
     }
 
+    m_search_index.Clear();
+
     for (u32 i = 0; i < m_entries.size(); i++) {
         auto& e = m_entries[i];
 
         m_entries_index[Filter_All].push_back(i);
 
+        m_search_index.Add(i, SearchField_Title, e.title);
+        m_search_index.Add(i, SearchField_Author, e.author);
+        m_search_index.Add(i, SearchField_Description, e.description);
+
         if (e.category == std::string_view{"game"}) {
             m_entries_index[Filter_GAMES].push_back(i);
         } else if (e.category == std::string_view{"emu"}) {
@@ -1339,6 +2112,11 @@ void Menu::Sort() {
     std::snprintf(subheader, sizeof(subheader), "Filter: %s | Sort: %s | Order: %s"_i18n.c_str(), i18n::get(FILTER_STR[filter]).c_str(), i18n::get(SORT_STR[sort]).c_str(), i18n::get(ORDER_STR[order]).c_str());
     SetTitleSubHeading(subheader);
 
+    // search results are already ranked by how well they matched.
+    if (m_is_search && !m_is_author) {
+        return;
+    }
+
     std::sort(m_entries_current.begin(), m_entries_current.end(), sorter);
 }
 
@@ -1383,15 +2161,7 @@ void Menu::SetSearch(const std::string& term) {
     }
 
     m_search_term = term;
-    m_entries_index_search.clear();
-    const auto query = m_search_term;
-
-    for (u64 i = 0; i < m_entries.size(); i++) {
-        const auto& e = m_entries[i];
-        if (FindCaseInsensitive(e.title, query) || FindCaseInsensitive(e.author, query) || FindCaseInsensitive(e.description, query)) {
-            m_entries_index_search.emplace_back(i);
-        }
-    }
+    m_entries_index_search = m_search_index.Search(m_search_term);
 
     m_is_search = true;
     m_entries_current = m_entries_index_search;
@@ -1405,15 +2175,7 @@ void Menu::SetAuthor() {
     }
 
     m_author_term = m_entries[m_entries_current[m_index]].author;
-    m_entries_index_author.clear();
-    const auto query = m_author_term;
-
-    for (u64 i = 0; i < m_entries.size(); i++) {
-        const auto& e = m_entries[i];
-        if (FindCaseInsensitive(e.author, query)) {
-            m_entries_index_author.emplace_back(i);
-        }
-    }
+    m_entries_index_author = m_search_index.Search(m_author_term, 1U << SearchField_Author);
 
     m_is_author = true;
     m_entries_current = m_entries_index_author;
@@ -1421,6 +2183,54 @@ void Menu::SetAuthor() {
     Sort();
 }
 
+void Menu::UpdateAll() {
+    std::vector<u32> indices;
+    for (u32 i = 0; i < m_entries.size(); i++) {
+        if (m_entries[i].status == EntryStatus::Update) {
+            indices.emplace_back(i);
+        }
+    }
+
+    if (indices.empty()) {
+        App::Notify("No updates available"_i18n);
+        return;
+    }
+
+    auto results = std::make_shared<std::vector<Result>>(indices.size());
+    const auto title = "0 / " + std::to_string(indices.size());
+
+    App::Push<ProgressBox>(m_update.image, "Updating "_i18n, title, [this, indices, results](auto pbox) -> Result {
+        std::vector<const Entry*> entries;
+        for (const auto i : indices) {
+            entries.emplace_back(&m_entries[i]);
+        }
+
+        const auto jobs = std::clamp<s64>(m_update_jobs.Get(), 1, 4);
+        const auto max_speed = std::max<s64>(m_update_max_speed.Get(), 0) * 1024;
+        return InstallApps(pbox, entries, jobs, max_speed, *results);
+    }, [this, indices, results](Result rc){
+        homebrew::SignalChange();
+
+        u32 updated{};
+        for (size_t i = 0; i < indices.size(); i++) {
+            const auto& result = (*results)[i];
+            if (R_SUCCEEDED(result)) {
+                m_entries[indices[i]].status = EntryStatus::Installed;
+                updated++;
+            } else if (R_SUCCEEDED(rc)) {
+                rc = result;
+            }
+        }
+
+        App::PushErrorBox(rc, "Failed to update all apps"_i18n);
+
+        if (updated) {
+            App::Notify(i18n::Reorder("Updated ", std::to_string(updated)));
+            SetDirty();
+        }
+    });
+}
+
 void Menu::OnLayoutChange() {
     m_index = 0;
     grid::Menu::OnLayoutChange(m_list, m_layout.Get());
@@ -20,6 +20,7 @@
 #include "nro.hpp"
 #include "defines.hpp"
 #include "image.hpp"
+#include "thumb_cache.hpp"
 #include "download.hpp"
 #include "owo.hpp"
 #include "swkbd.hpp"
@@ -94,6 +95,9 @@ constexpr std::string_view VIDEO_EXTENSIONS[] = {
 constexpr std::string_view IMAGE_EXTENSIONS[] = {
     "png", "jpg", "jpeg", "bmp", "gif",
 };
+// previews are drawn at 50x50, this leaves room for the exif thumbnail to be used.
+constexpr int PREVIEW_SIZE = 128;
+
 constexpr std::string_view INSTALL_EXTENSIONS[] = {
     "nsp", "xci", "nsz", "xcz",
 };
@@ -524,6 +528,8 @@ FsView::~FsView() {
         ini_puts("paths", "last_path", m_path, App::CONFIG_PATH);
         ini_puts("paths", "last_file", GetEntry().name, App::CONFIG_PATH);
     }
+
+    FreeImages();
 }
 
 void FsView::Update(Controller* controller, TouchInfo* touch) {
@@ -558,6 +564,7 @@ void FsView::Update(Controller* controller, TouchInfo* touch) {
 
 void FsView::Draw(NVGcontext* vg, Theme* theme) {
     const auto& text_col = theme->GetColour(ThemeEntryID_TEXT);
+    m_decoder.Upload(vg);
 
     if (m_entries_current.empty()) {
         gfx::drawTextArgs(vg, GetX() + GetW() / 2.f, GetY() + GetH() / 2.f, 36.f, NVG_ALIGN_CENTER | NVG_ALIGN_MIDDLE, theme->GetColour(ThemeEntryID_TEXT_INFO), "Empty..."_i18n.c_str());
@@ -593,6 +600,10 @@ void FsView::Draw(NVGcontext* vg, Theme* theme) {
                 icon = ThemeEntryID_ICON_VIDEO;
             } else if (IsExtension(ext, IMAGE_EXTENSIONS)) {
                 icon = ThemeEntryID_ICON_IMAGE;
+                // the path is opened with stdio on the decode thread, so only do this for the sd card.
+                if (IsSd() && !e.image_requested) {
+                    LoadPreview(m_entries_current[i]);
+                }
             } else if (IsExtension(ext, INSTALL_EXTENSIONS)) {
                 // todo: maybe replace this icon with something else?
                 icon = ThemeEntryID_ICON_NRO;
@@ -602,7 +613,17 @@ void FsView::Draw(NVGcontext* vg, Theme* theme) {
                 icon = ThemeEntryID_ICON_NRO;
             }
 
-            DrawElement(x + text_xoffset, y + 5, 50, 50, icon);
+            if (e.image) {
+                // keep the aspect ratio of the preview, centered in the icon.
+                int iw, ih;
+                nvgImageSize(vg, e.image, &iw, &ih);
+                const auto scale = 50.f / std::max(iw, ih);
+                const auto pw = iw * scale;
+                const auto ph = ih * scale;
+                gfx::drawImage(vg, x + text_xoffset + (50 - pw) / 2, y + 5 + (50 - ph) / 2, pw, ph, e.image);
+            } else {
+                DrawElement(x + text_xoffset, y + 5, 50, 50, icon);
+            }
         }
 
         if (e.IsSelected()) {
@@ -800,6 +821,33 @@ void FsView::OnClick() {
     }
 }
 
+void FsView::LoadPreview(u32 index) {
+    auto& e = m_entries[index];
+    e.image_requested = true;
+
+    const auto ext = e.GetExtension();
+    const auto flags = IsExtension(ext, "jpg") || IsExtension(ext, "jpeg") ? ImageFlag_JPEG : ImageFlag_None;
+
+    // album screenshots have an exif thumbnail, which is loaded instead of the full image.
+    m_decoder.Push([path = GetNewPath(e), flags]() {
+        return thumb::LoadFromFile(path, flags, PREVIEW_SIZE);
+    }, [this, index](int image, const ImageResult& result) {
+        m_entries[index].image = image;
+    });
+}
+
+void FsView::FreeImages() {
+    // pending previews are dropped, so their index is never used once the entries change.
+    m_decoder.Clear();
+
+    for (auto& e : m_entries) {
+        if (e.image) {
+            nvgDeleteImage(App::GetVg(), e.image);
+            e.image = 0;
+        }
+    }
+}
+
 void FsView::SetIndex(s64 index) {
     m_index = index;
     if (!m_index) {
@@ -1041,6 +1089,7 @@ auto FsView::Scan(fs::FsPath new_path, bool is_walk_up) -> Result {
 
     g_change_signalled = false;
     m_path = new_path;
+    FreeImages();
     m_entries.clear();
     m_entries_index.clear();
     m_entries_index_hidden.clear();
@@ -1565,6 +1614,7 @@ void FsView::SetFs(const std::shared_ptr<fs::Fs>& fs, const fs::FsPath& new_path
 
     // m_fs.reset();
     m_path = new_path;
+    FreeImages();
     m_entries.clear();
     m_entries_index.clear();
     m_entries_index_hidden.clear();
@@ -5,6 +5,7 @@
 #include "defines.hpp"
 #include "i18n.hpp"
 #include "image.hpp"
+#include "thumb_cache.hpp"
 #include "swkbd.hpp"
 
 #include "utils/utils.hpp"
@@ -165,7 +166,9 @@ Result Notify(Result rc, const std::string& error_message) {
 bool LoadControlImage(Entry& e, title::ThreadResultData* result) {
     if (!e.image && result && !result->icon.empty()) {
         TimeStamp ts;
-        const auto image = ImageLoadFromMemory(result->icon, ImageFlag_JPEG);
+        const auto image = thumb::Load(thumb::MakeKey(result->icon), [result]() {
+            return ImageLoadFromMemory(result->icon, ImageFlag_JPEG);
+        });
         if (!image.data.empty()) {
             e.image = nvgCreateImageRGBA(App::GetVg(), image.w, image.h, 0, image.data.data());
             log_write("\t[image load] time taken: %.2fs %zums\n", ts.GetSecondsD(), ts.GetMs());
@@ -486,6 +489,7 @@ void Menu::Update(Controller* controller, TouchInfo* touch) {
     }
 
     if (R_SUCCEEDED(eventWait(&m_gc_event, 0))) {
+        title::InvalidateMetaEntries();
         m_dirty = true;
     }
 
@@ -686,6 +690,7 @@ void Menu::DeleteGAMES() {
             pbox->SetTitle(e.GetName());
             pbox->UpdateTransfer(i + 1, std::size(targets));
             R_TRY(nsDeleteApplicationCompletely(e.app_id));
+            title::InvalidateMetaEntries(e.app_id);
         }
 
         R_SUCCEED();
@@ -838,7 +843,9 @@ void DeleteMetaEntries(u64 app_id, int image, const std::string& name, const tit
         }
 
         R_SUCCEED();
-    }, [](Result rc){
+    }, [app_id](Result rc){
+        // some entries may have been deleted even on error.
+        title::InvalidateMetaEntries(app_id);
         App::PushErrorBox(rc, "Failed to delete meta entry"_i18n);
     });
 }
@@ -18,6 +18,7 @@
 #include "defines.hpp"
 #include "i18n.hpp"
 #include "image.hpp"
+#include "thumb_cache.hpp"
 
 #include <minIni.h>
 #include <utility>
@@ -105,35 +106,42 @@ void Menu::Update(Controller* controller, TouchInfo* touch) {
 void Menu::Draw(NVGcontext* vg, Theme* theme) {
     MenuBase::Draw(vg, theme);
 
-    // max images per frame, in order to not hit io / gpu too hard.
-    const int image_load_max = 2;
-    int image_load_count = 0;
+    // upload the icons that finished decoding since the last frame.
+    m_decoder.Upload(vg);
 
-    m_list->Draw(vg, theme, m_entries_current.size(), [this, &image_load_count](auto* vg, auto* theme, auto v, auto pos) {
+    m_list->Draw(vg, theme, m_entries_current.size(), [this](auto* vg, auto* theme, auto v, auto pos) {
         const auto index = m_entries_current[pos];
         auto& e = m_entries[index];
 
         // lazy load image
-        if (image_load_count < image_load_max) {
-            if (!e.image && e.icon_size && e.icon_offset) {
-                // NOTE: it seems that images can be any size. SuperTux uses a 1024x1024
-                // ~300Kb image, which takes a few frames to completely load.
-                // really, switch-tools should handle this by resizing the image before
-                // adding it to the nro, as well as validate its a valid jpeg.
-                const auto icon = nro_get_icon(e.path, e.icon_size, e.icon_offset);
-                TimeStamp ts;
-                if (!icon.empty()) {
-                    const auto image = ImageLoadFromMemory(icon, ImageFlag_JPEG);
-                    if (!image.data.empty()) {
-                        e.image = nvgCreateImageRGBA(vg, image.w, image.h, 0, image.data.data());
-                        log_write("\t[image load] time taken: %.2fs %zums\n", ts.GetSecondsD(), ts.GetMs());
-                        image_load_count++;
-                    } else {
-                        // prevent loading of this icon again as it's already failed.
-                        e.icon_offset = e.icon_size = 0;
+        if (!e.image && !e.is_image_loading && e.icon_size && e.icon_offset) {
+            // NOTE: it seems that images can be any size. SuperTux uses a 1024x1024
+            // ~300Kb image, which takes a few frames to completely load.
+            // really, switch-tools should handle this by resizing the image before
+            // adding it to the nro, as well as validate its a valid jpeg.
+            e.is_image_loading = true;
+            // the nro is only read if the icon isn't already cached.
+            char id[FS_MAX_PATH + 64];
+            std::snprintf(id, sizeof(id), "%s:%zd:%lu:%lu:%lu", e.path.s, e.size, e.timestamp.modified, e.icon_offset, e.icon_size);
+
+            m_decoder.Push([key = thumb::MakeKey(id), path = e.path, icon_size = e.icon_size, icon_offset = e.icon_offset]() {
+                return thumb::Load(key, [&]() -> ImageResult {
+                    const auto icon = nro_get_icon(path, icon_size, icon_offset);
+                    if (icon.empty()) {
+                        return {};
                     }
+                    return ImageLoadFromMemory(icon, ImageFlag_JPEG, thumb::DEFAULT_SIZE);
+                });
+            }, [this, index](int image, const ImageResult& result) {
+                auto& e = m_entries[index];
+                e.is_image_loading = false;
+                if (image) {
+                    e.image = image;
+                } else {
+                    // prevent loading of this icon again as it's already failed.
+                    e.icon_offset = e.icon_size = 0;
                 }
-            }
+            });
         }
 
 
@@ -404,6 +412,8 @@ void Menu::FreeEntries() {
         FreeEntry(vg, p);
     }
 
+    // drop any icons still being decoded for the old entries.
+    m_decoder.Clear();
     m_entries.clear();
     m_entries_current = {};
     for (auto& e : m_entries_index) {
@@ -3,11 +3,22 @@
 #include "ui/nvg_util.hpp"
 #include "app.hpp"
 #include "i18n.hpp"
-#include "image.hpp"
+#include "log.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
 
 namespace sphaira::ui::menu::imageview {
 namespace {
 
+constexpr int BPP = 4;
+
+// size of a tile once halved level times.
+auto LevelSize(int size, int level) -> int {
+    return (size + (1 << level) - 1) >> level;
+}
+
 } // namespace
 
 Menu::Menu(fs::Fs* fs, const fs::FsPath& path) : m_path{path} {
@@ -29,20 +40,60 @@ Menu::Menu(fs::Fs* fs, const fs::FsPath& path) : m_path{path} {
         flags = ImageFlag_JPEG;
     }
 
-    const auto result = ImageLoadFromMemory(m_image_buf, flags);
-    if (result.data.empty()) {
-        SetPop();
-        return;
+    // decode in the background, the full size image is kept in memory and only
+    // the parts that are on screen are uploaded, so large images can still be viewed.
+    m_decoder.Push([this, buf = std::move(m_image_buf), flags]() -> ImageResult {
+        TimeStamp ts;
+        auto full = ImageLoadFromMemory(buf, flags);
+        if (full.data.empty()) {
+            return {};
+        }
+
+        const auto scale = std::min({1.f, SCREEN_WIDTH / full.w, SCREEN_HEIGHT / full.h});
+        if (scale >= 1.f) {
+            return full;
+        }
+
+        const auto w = std::max(1, (int)(full.w * scale));
+        const auto h = std::max(1, (int)(full.h * scale));
+        auto preview = ImageResize(full.data, full.w, full.h, w, h);
+        if (preview.data.empty()) {
+            return {};
+        }
+
+        log_write("[IMAGE] decoded %dx%d preview %dx%d time taken: %.2fs\n", full.w, full.h, w, h, ts.GetSecondsD());
+        m_full = std::move(full);
+        return preview;
+    }, [this](int image, const ImageResult& result) {
+        OnLoaded(image, result);
+    });
+}
+
+Menu::~Menu() {
+    nvgDeleteImage(App::GetVg(), m_image);
+    for (const auto& tile : m_tiles) {
+        if (tile.image) {
+            nvgDeleteImage(App::GetVg(), tile.image);
+        }
     }
+}
 
-    m_image = nvgCreateImageRGBA(App::GetVg(), result.w, result.h, 0, result.data.data());
-    if (m_image <= 0) {
+void Menu::OnLoaded(int image, const ImageResult& result) {
+    if (!image) {
         SetPop();
         return;
     }
 
-    m_image_width = result.w;
-    m_image_height = result.h;
+    m_image = image;
+    m_loaded = true;
+
+    if (m_full.data.empty()) {
+        m_image_width = result.w;
+        m_image_height = result.h;
+    } else {
+        m_image_width = m_full.w;
+        m_image_height = m_full.h;
+    }
 
     // scale to fit.
     const auto ws = SCREEN_WIDTH / m_image_width;
@@ -52,13 +103,13 @@ Menu::Menu(fs::Fs* fs, const fs::FsPath& path) : m_path{path} {
     UpdateSize();
 }
 
-Menu::~Menu() {
-    nvgDeleteImage(App::GetVg(), m_image);
-}
-
 void Menu::Update(Controller* controller, TouchInfo* touch) {
     Widget::Update(controller, touch);
 
+    if (!m_loaded) {
+        return;
+    }
+
     const auto kdown = controller->m_kdown | controller->m_kheld;
 
     // pan support.
@@ -94,8 +145,18 @@ void Menu::Update(Controller* controller, TouchInfo* touch) {
 }
 
 void Menu::Draw(NVGcontext* vg, Theme* theme) {
+    m_frame++;
+    m_decoder.Upload(vg);
+
     gfx::drawRect(vg, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, nvgRGB(0, 0, 0));
+    if (!m_loaded) {
+        gfx::drawText(vg, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, 36, nvgRGB(255, 255, 255), "Loading..."_i18n.c_str(), NVG_ALIGN_CENTER | NVG_ALIGN_MIDDLE);
+        return;
+    }
+
+    // the preview is drawn under the tiles, so that it's shown until they load.
     gfx::drawImage(vg, m_xoff + GetX(), m_yoff + GetY(), GetW(), GetH(), m_image);
+    DrawTiles(vg);
 
     // todo: when pan/zoom, show image info to the screen.
     // todo: maybe show image info by default and option to hide it.
@@ -131,4 +192,110 @@ void Menu::UpdateSize() {
     }
 }
 
+void Menu::DrawTiles(NVGcontext* vg) {
+    // tiles are only needed once the preview would be scaled up.
+    const auto scale = m_zoom;
+    if (m_full.data.empty() || scale <= std::min(SCREEN_WIDTH / m_image_width, SCREEN_HEIGHT / m_image_height)) {
+        return;
+    }
+
+    // pick the smallest level that still has at least one pixel per screen pixel.
+    const auto level = std::max(0, (int)std::floor(std::log2(1.0 / scale)));
+    const auto tile_size = TILE_SIZE << level;
+
+    const auto ox = m_xoff + GetX();
+    const auto oy = m_yoff + GetY();
+
+    // the part of the image that's on screen, in image pixels.
+    const auto x0 = std::clamp((int)(-ox / scale), 0, m_full.w - 1);
+    const auto y0 = std::clamp((int)(-oy / scale), 0, m_full.h - 1);
+    const auto x1 = std::clamp((int)std::ceil((SCREEN_WIDTH - ox) / scale), 1, m_full.w);
+    const auto y1 = std::clamp((int)std::ceil((SCREEN_HEIGHT - oy) / scale), 1, m_full.h);
+
+    for (auto ty = y0 / tile_size; ty <= (y1 - 1) / tile_size; ty++) {
+        for (auto tx = x0 / tile_size; tx <= (x1 - 1) / tile_size; tx++) {
+            auto it = std::ranges::find_if(m_tiles, [level, tx, ty](const Tile& e) {
+                return e.level == level && e.x == tx && e.y == ty;
+            });
+
+            if (it == m_tiles.end()) {
+                LoadTile(level, tx, ty);
+                it = m_tiles.end() - 1;
+            }
+
+            it->last_used = m_frame;
+            if (it->image) {
+                const auto sx = tx * tile_size;
+                const auto sy = ty * tile_size;
+                const auto sw = std::min(tile_size, m_full.w - sx);
+                const auto sh = std::min(tile_size, m_full.h - sy);
+                gfx::drawImage(vg, ox + sx * scale, oy + sy * scale, sw * scale, sh * scale, it->image);
+            }
+        }
+    }
+
+    EvictTiles(vg);
+}
+
+void Menu::LoadTile(int level, int x, int y) {
+    const auto seq = ++m_tile_seq;
+    m_tiles.emplace_back(level, x, y, 0, m_frame, seq);
+
+    m_decoder.Push([this, level, x, y]() -> ImageResult {
+        const auto tile_size = TILE_SIZE << level;
+        const auto sx = x * tile_size;
+        const auto sy = y * tile_size;
+        const auto sw = std::min(tile_size, m_full.w - sx);
+        const auto sh = std::min(tile_size, m_full.h - sy);
+        const auto pitch = m_full.w * BPP;
+        const auto offset = (size_t)sy * pitch + (size_t)sx * BPP;
+        const auto data = std::span<const u8>{m_full.data}.subspan(offset);
+
+        if (level) {
+            return ImageResize(data, sw, sh, LevelSize(sw, level), LevelSize(sh, level), pitch);
+        }
+
+        ImageResult result{ImageBuffer(sw * sh * BPP), sw, sh};
+        if (!result.data.empty()) {
+            for (int i = 0; i < sh; i++) {
+                std::memcpy(result.data.data() + i * sw * BPP, data.data() + i * pitch, sw * BPP);
+            }
+        }
+        return result;
+    }, [this, seq](int image, const ImageResult& result) {
+        OnTileLoaded(seq, image);
+    });
+}
+
+void Menu::OnTileLoaded(u64 seq, int image) {
+    const auto it = std::ranges::find(m_tiles, seq, &Tile::seq);
+
+    // the tile was evicted whilst loading, it may have since been requested again
+    // with a new seq, in which case that load will set the image.
+    if (it == m_tiles.end()) {
+        if (image) {
+            nvgDeleteImage(App::GetVg(), image);
+        }
+        return;
+    }
+
+    // on failure the tile is kept without an image, so that it isn't loaded again.
+    it->image = image;
+}
+
+void Menu::EvictTiles(NVGcontext* vg) {
+    while (m_tiles.size() > MAX_TILES) {
+        // evict the least recently used tile, unless it's on screen.
+        const auto it = std::ranges::min_element(m_tiles, {}, &Tile::last_used);
+        if (it->last_used == m_frame) {
+            break;
+        }
+
+        if (it->image) {
+            nvgDeleteImage(vg, it->image);
+        }
+        m_tiles.erase(it);
+    }
+}
+
 } // namespace sphaira::ui::menu::imageview
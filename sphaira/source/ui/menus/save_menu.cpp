@@ -6,6 +6,7 @@
 #include "i18n.hpp"
 #include "location.hpp"
 #include "image.hpp"
+#include "thumb_cache.hpp"
 #include "threaded_file_transfer.hpp"
 #include "minizip_helper.hpp"
 #include "dumper.hpp"
@@ -260,7 +261,9 @@ void FakeNacpEntryForSystem(Entry& e) {
 bool LoadControlImage(Entry& e, title::ThreadResultData* result) {
     if (!e.image && result && !result->icon.empty()) {
         TimeStamp ts;
-        const auto image = ImageLoadFromMemory(result->icon, ImageFlag_JPEG);
+        const auto image = thumb::Load(thumb::MakeKey(result->icon), [result]() {
+            return ImageLoadFromMemory(result->icon, ImageFlag_JPEG);
+        });
         if (!image.data.empty()) {
             e.image = nvgCreateImageRGBA(App::GetVg(), image.w, image.h, 0, image.data.data());
             log_write("\t[image load] time taken: %.2fs %zums\n", ts.GetSecondsD(), ts.GetMs());
@@ -15,6 +15,7 @@
 #include "i18n.hpp"
 #include "threaded_file_transfer.hpp"
 #include "image.hpp"
+#include "thumb_cache.hpp"
 #include "title_info.hpp"
 #include "nro.hpp"
 
@@ -151,35 +152,6 @@ auto apiBuildIconCache(const ThemeEntry& e) -> fs::FsPath {
     return path;
 }
 
-auto loadThemeImage(ThemeEntry& e) -> bool {
-    auto& image = e.preview.lazy_image;
-
-    // already have the image
-    if (e.preview.lazy_image.image) {
-        // log_write("warning, tried to load image: %s when already loaded\n", path.c_str());
-        return true;
-    }
-    auto vg = App::GetVg();
-
-    const auto path = apiBuildIconCache(e);
-    TimeStamp ts;
-    const auto data = ImageLoadFromFile(path, ImageFlag_JPEG);
-    if (!data.data.empty()) {
-        image.w = data.w;
-        image.h = data.h;
-        image.image = nvgCreateImageRGBA(vg, data.w, data.h, 0, data.data.data());
-        log_write("\t[image load] time taken: %.2fs %zums\n", ts.GetSecondsD(), ts.GetMs());
-    }
-
-    if (!image.image) {
-        log_write("failed to load image from file: %s\n", path.s);
-        return false;
-    } else {
-        // log_write("loaded image from file: %s\n", path);
-        return true;
-    }
-}
-
 void from_json(yyjson_val* json, Creator& e) {
     JSON_OBJ_ITR(
         JSON_SET_STR(id);
@@ -475,14 +447,21 @@ void Menu::Draw(NVGcontext* vg, Theme* theme) {
             return;
     }
 
-    // max images per frame, in order to not hit io / gpu too hard.
-    const int image_load_max = 2;
-    int image_load_count = 0;
+    // upload the images that finished decoding since the last frame.
+    m_decoder.Upload(vg);
+
+    s64 visible_start = -1;
+    s64 visible_end = -1;
 
-    m_list->Draw(vg, theme, page.m_packList.size(), [this, &page, &image_load_count](auto* vg, auto* theme, auto v, auto pos) {
+    m_list->Draw(vg, theme, page.m_packList.size(), [this, &page, &visible_start, &visible_end](auto* vg, auto* theme, auto v, auto pos) {
         const auto& [x, y, w, h] = v;
         auto& e = page.m_packList[pos];
 
+        if (visible_start < 0) {
+            visible_start = pos;
+        }
+        visible_end = pos;
+
         auto text_id = ThemeEntryID_TEXT;
         const auto selected = pos == m_index;
         if (selected) {
@@ -500,12 +479,9 @@ void Menu::Draw(NVGcontext* vg, Theme* theme) {
             auto& image = e.themes[0].preview.lazy_image;
 
             // try and load cached image.
-            if (image_load_count < image_load_max && !image.image && !image.tried_cache) {
+            if (!image.image && !image.tried_cache && !image.decoding) {
                 image.tried_cache = true;
-                image.cached = loadThemeImage(theme);
-                if (image.cached) {
-                    image_load_count++;
-                }
+                LoadImageAsync(m_page_index, pos, true);
             }
 
             if (!image.image || image.cached) {
@@ -517,12 +493,15 @@ void Menu::Draw(NVGcontext* vg, Theme* theme) {
                         const auto url = theme.preview.thumb;
                         log_write("downloading url: %s\n", url.c_str());
                         image.state = ImageDownloadState::Progress;
+                        image.handle = curl::AsyncHandle::Create();
                         curl::Api().ToFileAsync(
                             curl::Url{url},
                             curl::Path{path},
                             curl::Flags{curl::Flag_Cache},
                             curl::StopToken{this->GetToken()},
+                            curl::AsyncHandle{image.handle},
                             curl::OnComplete{[this, &image](auto& result) {
+                                image.handle = {};
                                 if (result.success) {
                                     image.state = ImageDownloadState::Done;
                                     // data hasn't changed
@@ -540,11 +519,8 @@ void Menu::Draw(NVGcontext* vg, Theme* theme) {
 
                     }   break;
                     case ImageDownloadState::Done: {
-                        image.cached = false;
-                        if (!loadThemeImage(theme)) {
-                            image.state = ImageDownloadState::Failed;
-                        } else {
-                            image_load_count++;
+                        if (!image.decoding) {
+                            LoadImageAsync(m_page_index, pos, false);
                         }
                     }   break;
                     case ImageDownloadState::Failed: {
@@ -561,6 +537,80 @@ void Menu::Draw(NVGcontext* vg, Theme* theme) {
         m_scroll_name.Draw(vg, selected, text_x, y + 180 + 20, text_clip_w, font_size, NVG_ALIGN_LEFT, theme->GetColour(text_id), e.details.name.c_str());
         m_scroll_author.Draw(vg, selected, text_x, y + 180 + 55, text_clip_w, font_size, NVG_ALIGN_LEFT, theme->GetColour(text_id), e.creator.display_name.c_str());
     });
+
+    UpdateImageDownloads(visible_start, visible_end);
+}
+
+void Menu::LoadImageAsync(s64 page_index, s64 pos, bool from_cache) {
+    auto& theme = m_pages[page_index].m_packList[pos].themes[0];
+    theme.preview.lazy_image.decoding = true;
+
+    // previews are drawn at 320x180, so keep them at that size.
+    m_decoder.Push([path = apiBuildIconCache(theme)]() {
+        return thumb::LoadFromFile(path, ImageFlag_JPEG, 320);
+    }, [this, page_index, pos, from_cache](int new_image, const ImageResult& result) {
+        // the page may have been reloaded whilst decoding.
+        if (page_index >= std::ssize(m_pages) || pos >= std::ssize(m_pages[page_index].m_packList) || m_pages[page_index].m_packList[pos].themes.empty()) {
+            if (new_image) {
+                nvgDeleteImage(App::GetVg(), new_image);
+            }
+            return;
+        }
+
+        auto& image = m_pages[page_index].m_packList[pos].themes[0].preview.lazy_image;
+        image.decoding = false;
+
+        if (!new_image) {
+            // a missing cache is expected, the image is then downloaded.
+            if (!from_cache) {
+                image.state = ImageDownloadState::Failed;
+            }
+            return;
+        }
+
+        if (image.image) {
+            nvgDeleteImage(App::GetVg(), image.image);
+        }
+
+        image.image = new_image;
+        image.w = result.w;
+        image.h = result.h;
+        image.cached = from_cache;
+    });
+}
+
+void Menu::UpdateImageDownloads(s64 start, s64 end) {
+    if (start < 0) {
+        return;
+    }
+
+    // downloads within a page of the screen are kept so that scrolling
+    // back and forth doesn't keep restarting them.
+    const auto margin = m_list->GetPage();
+    auto& page = m_pages[m_page_index];
+
+    for (s64 pos = 0; pos < std::ssize(page.m_packList); pos++) {
+        auto& e = page.m_packList[pos];
+        if (e.themes.empty()) {
+            continue;
+        }
+
+        auto& image = e.themes[0].preview.lazy_image;
+        if (image.state != ImageDownloadState::Progress) {
+            continue;
+        }
+
+        if (pos >= start && pos <= end) {
+            image.handle.SetPriority(curl::Priority::High);
+        } else if (pos >= start - margin && pos <= end + margin) {
+            image.handle.SetPriority(curl::Priority::Normal);
+        } else {
+            // downloaded again if it comes back into view.
+            image.handle.Cancel();
+            image.handle = {};
+            image.state = ImageDownloadState::None;
+        }
+    }
 }
 
 void Menu::OnFocusGained() {
@@ -590,6 +640,8 @@ void Menu::OnFocusGained() {
 }
 
 void Menu::InvalidateAllPages() {
+    // drop any images still being decoded for the old pages.
+    m_decoder.Clear();
     m_pages.clear();
     m_pages.resize(1);
     m_page_index = 0;
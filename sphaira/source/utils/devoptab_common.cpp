@@ -112,12 +112,18 @@ int devoptab_close(struct _reent *r, void *fd) {
     SCOPED_RWLOCK(&g_rwlock, false);
     SCOPED_MUTEX(&file->device->mutex);
 
+    int ret = 0;
     if (file->fd) {
-        file->device->mount_device->devoptab_close(file->fd);
+        // close may fail if buffered data failed to be written.
+        ret = file->device->mount_device->devoptab_close(file->fd);
         free(file->fd);
     }
 
     std::memset(file, 0, sizeof(*file));
+    if (ret) {
+        return set_errno(r, -ret);
+    }
+
     return r->_errno = 0;
 }
 
@@ -949,7 +955,7 @@ Result MountNetworkDevice(const CreateDeviceCallback& create_device, size_t file
     R_SUCCEED();
 }
 
-PushPullThreadData::PushPullThreadData(CURL* _curl) : curl{_curl} {
+PushPullThreadData::PushPullThreadData(CURL* _curl, size_t _max_buffer_size) : curl{_curl}, max_buffer_size{_max_buffer_size} {
     mutexInit(&mutex);
     condvarInit(&can_push);
     condvarInit(&can_pull);
@@ -994,6 +1000,35 @@ bool PushPullThreadData::IsRunning() {
     return !finished && !error;
 }
 
+bool PushPullThreadData::FinishAndWait() {
+    Cancel();
+
+    // the thread is closed in the destructor.
+    if (started) {
+        threadWaitForExit(&thread);
+    }
+
+    SCOPED_MUTEX(&mutex);
+    // treat http / ftp error responses as a failure as well.
+    return !error && code < 400;
+}
+
+size_t PushPullThreadData::ConsumeBuffer(char* data, size_t size) {
+    const auto rsize = std::min(size, BufferedSize());
+    std::memcpy(data, buffer.data() + buffer_off, rsize);
+    buffer_off += rsize;
+
+    if (buffer_off == buffer.size()) {
+        buffer.clear();
+        buffer_off = 0;
+    } else if (buffer_off >= max_buffer_size / 2) {
+        buffer.erase(buffer.begin(), buffer.begin() + buffer_off);
+        buffer_off = 0;
+    }
+
+    return rsize;
+}
+
 size_t PushPullThreadData::PullData(char* data, size_t total_size, bool curl) {
     if (!data || !total_size) {
         return 0;
@@ -1005,7 +1040,7 @@ size_t PushPullThreadData::PullData(char* data, size_t total_size, bool curl) {
     if (curl) {
         // this should be handled in the progress function.
         // however i handle it here as well just in case.
-        if (buffer.empty()) {
+        if (!BufferedSize()) {
             if (finished) {
                 log_write("[PUSH:PULL] PullData: finished and no data\n");
                 return 0;
@@ -1015,15 +1050,12 @@ size_t PushPullThreadData::PullData(char* data, size_t total_size, bool curl) {
         }
 
         // read what we can.
-        const auto rsize = std::min(total_size, buffer.size());
-        std::memcpy(data, buffer.data(), rsize);
-        buffer.erase(buffer.begin(), buffer.begin() + rsize);
-        return rsize;
+        return ConsumeBuffer(data, total_size);
     } else {
         // if we are not in a curl callback, then we can block until we have data.
         size_t bytes_read = 0;
         while (bytes_read < total_size && !error) {
-            if (buffer.empty()) {
+            if (!BufferedSize()) {
                 if (finished) {
                     break;
                 }
@@ -1033,10 +1065,7 @@ size_t PushPullThreadData::PullData(char* data, size_t total_size, bool curl) {
                 continue;
             }
 
-            const auto rsize = std::min(total_size - bytes_read, buffer.size());
-            std::memcpy(data + bytes_read, buffer.data(), rsize);
-            buffer.erase(buffer.begin(), buffer.begin() + rsize);
-            bytes_read += rsize;
+            bytes_read += ConsumeBuffer(data + bytes_read, total_size - bytes_read);
         }
 
         return bytes_read;
@@ -1054,7 +1083,7 @@ size_t PushPullThreadData::PushData(const char* data, size_t total_size, bool cu
     if (curl) {
         // this should be handled in the progress function.
         // however i handle it here as well just in case.
-        if (buffer.size() + total_size > MAX_BUFFER_SIZE) {
+        if (BufferedSize() + total_size > max_buffer_size) {
             return CURL_WRITEFUNC_PAUSE;
         }
 
@@ -1067,7 +1096,7 @@ size_t PushPullThreadData::PushData(const char* data, size_t total_size, bool cu
         // if we are not in a curl callback, then we can block until we have space.
         size_t bytes_written = 0;
         while (bytes_written < total_size && !error && !finished) {
-            const size_t space_left = MAX_BUFFER_SIZE - buffer.size();
+            const size_t space_left = max_buffer_size - std::min(max_buffer_size, BufferedSize());
             if (space_left == 0) {
                 condvarWakeOne(&can_pull);
                 condvarWait(&can_push, &mutex);
@@ -1131,11 +1160,11 @@ size_t PushPullThreadData::progress_callback(void *clientp, curl_off_t dltotal,
             }
 
             // pause if the buffer is full, otherwise continue.
-            should_pause = data->buffer.size() >= MAX_BUFFER_SIZE;
+            should_pause = data->BufferedSize() >= data->max_buffer_size;
         } else {
             // pause if we have no data to send, otherwise continue.
             // do not pause if finished as curl may have internal data pending to send.
-            should_pause = !data->finished && data->buffer.empty();
+            should_pause = !data->finished && !data->BufferedSize();
         }
     }
 
@@ -1174,21 +1203,26 @@ void PushPullThreadData::thread_func(void* arg) {
 
 MountCurlDevice::~MountCurlDevice() {
     log_write("[CURL] Cleaning up mount device\n");
+    if (m_range_multi) {
+        curl_multi_cleanup(m_range_multi);
+    }
+
+    for (auto range_curl : m_range_curls) {
+        curl::PoolRelease(m_pool_url, range_curl);
+    }
+
     if (curlu) {
         curl_url_cleanup(curlu);
     }
 
     if (curl) {
-        curl_easy_cleanup(curl);
+        curl::PoolRelease(m_pool_url, curl);
     }
 
     if (transfer_curl) {
-        curl_easy_cleanup(transfer_curl);
+        curl::PoolRelease(m_pool_url, transfer_curl);
     }
 
-    if (m_curl_share) {
-        curl_share_cleanup(m_curl_share);
-    }
     log_write("[CURL] Cleaned up mount device\n");
 }
 
@@ -1197,8 +1231,19 @@ bool MountCurlDevice::Mount() {
         return true;
     }
 
+    if (m_pool_url.empty()) {
+        m_pool_url = config.url;
+        if (m_pool_url.starts_with("webdav://") || m_pool_url.starts_with("webdavs://")) {
+            log_write("[CURL] updating host: %s\n", m_pool_url.c_str());
+            m_pool_url.replace(0, std::strlen("webdav"), "http");
+            log_write("[CURL] updated host: %s\n", m_pool_url.c_str());
+        }
+    }
+
+    // handles come from the global pool, so connections and tls sessions
+    // are shared with every other mount and the downloader.
     if (!curl) {
-        curl = curl_easy_init();
+        curl = curl::PoolAcquire(m_pool_url);
         if (!curl) {
             log_write("[CURL] curl_easy_init() failed\n");
             return false;
@@ -1206,13 +1251,24 @@ bool MountCurlDevice::Mount() {
     }
 
     if (!transfer_curl) {
-        transfer_curl = curl_easy_init();
+        transfer_curl = curl::PoolAcquire(m_pool_url);
         if (!transfer_curl) {
             log_write("[CURL] transfer curl_easy_init() failed\n");
             return false;
         }
     }
 
+    const auto connections = config.extra.find("connections");
+    if (connections != config.extra.end()) {
+        const auto connections_val = ini_parse_getl(connections->second.c_str(), -1);
+        if (connections_val < 1 || connections_val > RANGE_MAX_CONNECTIONS) {
+            log_write("[CURL] Invalid connections value: %s\n", connections->second.c_str());
+        } else {
+            log_write("[CURL] Setting connections: %ld\n", connections_val);
+            m_range_connections = connections_val;
+        }
+    }
+
     // setup url, only the path is updated at runtime.
     if (!curlu) {
         curlu = curl_url();
@@ -1221,13 +1277,6 @@ bool MountCurlDevice::Mount() {
             return false;
         }
 
-        auto url = config.url;
-        if (url.starts_with("webdav://") || url.starts_with("webdavs://")) {
-            log_write("[CURL] updating host: %s\n", url.c_str());
-            url.replace(0, std::strlen("webdav"), "http");
-            log_write("[CURL] updated host: %s\n", url.c_str());
-        }
-
         // if (url.starts_with("sftp://")) {
         //     log_write("[CURL] updating host: %s\n", url.c_str());
         //     url.replace(0, std::strlen("sftp"), ""); // what should this be?
@@ -1235,7 +1284,7 @@ bool MountCurlDevice::Mount() {
         // }
 
         const auto flags = CURLU_GUESS_SCHEME|CURLU_URLENCODE;
-        CURLUcode rc = curl_url_set(curlu, CURLUPART_URL, url.c_str(), flags);
+        CURLUcode rc = curl_url_set(curlu, CURLUPART_URL, m_pool_url.c_str(), flags);
         if (rc != CURLUE_OK) {
             log_write("[CURL] curl_url_set() failed: %s\n", curl_url_strerror_wrap(rc));
             return false;
@@ -1273,50 +1322,57 @@ bool MountCurlDevice::Mount() {
         }
     }
 
-    // create share handle, used to share info between curl and transfer_curl.
-    if (!m_curl_share) {
-        m_curl_share = curl_share_init();
-        if (!m_curl_share) {
-            log_write("[CURL] curl_share_init() failed\n");
-            return false;
-        }
-
-        // todo: use a mutex instead.
-        for (auto& e : m_rwlocks) {
-            rwlockInit(&e);
-        }
+    return m_mounted = true;
+}
 
-        static const auto lock_func = [](CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
-            auto rwlocks = static_cast<RwLock*>(userptr);
-            rwlockWriteLock(&rwlocks[data]);
+ssize_t WriteBackData::Write(const char* ptr, size_t len) {
+    // report any errors from the previous chunk.
+    if (!data->IsRunning()) {
+        log_write("[WRITEBACK] upload stopped, failing write\n");
+        return -EIO;
+    }
 
-            #if 0
-            if (access == CURL_LOCK_ACCESS_SHARED) {
-                rwlockReadLock(&rwlocks[data]);
-            } else {
-                rwlockWriteLock(&rwlocks[data]);
+    size_t amount = 0;
+    while (amount < len) {
+        const auto wsize = std::min(len - amount, CHUNK_SIZE - pending.size());
+        pending.insert(pending.end(), ptr + amount, ptr + amount + wsize);
+        amount += wsize;
+
+        if (pending.size() >= CHUNK_SIZE) {
+            if (const auto ret = Flush()) {
+                return ret;
             }
-            #endif
-        };
-
-        static const auto unlock_func = [](CURL* handle, curl_lock_data data, void* userptr) {
-            auto rwlocks = static_cast<RwLock*>(userptr);
-            rwlockWriteUnlock(&rwlocks[data]);
-        };
-
-        if (m_curl_share) {
-            curl_share_setopt(m_curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
-            curl_share_setopt(m_curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
-            curl_share_setopt(m_curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
-            curl_share_setopt(m_curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
-            curl_share_setopt(m_curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_PSL);
-            curl_share_setopt(m_curl_share, CURLSHOPT_USERDATA, m_rwlocks);
-            curl_share_setopt(m_curl_share, CURLSHOPT_LOCKFUNC, lock_func);
-            curl_share_setopt(m_curl_share, CURLSHOPT_UNLOCKFUNC, unlock_func);
         }
     }
 
-    return m_mounted = true;
+    return amount;
+}
+
+int WriteBackData::Flush() {
+    if (pending.empty()) {
+        return data->IsRunning() ? 0 : -EIO;
+    }
+
+    // this only blocks if the previous chunk has yet to be uploaded.
+    const auto ret = data->PushData(pending.data(), pending.size());
+    if (ret != pending.size()) {
+        log_write("[WRITEBACK] failed to push chunk: %zu vs %zu\n", ret, pending.size());
+        pending.clear();
+        return -EIO;
+    }
+
+    pending.clear();
+    return 0;
+}
+
+int WriteBackData::Close() {
+    const auto ret = Flush();
+    if (!data->FinishAndWait()) {
+        log_write("[WRITEBACK] upload failed, code: %ld\n", data->code);
+        return -EIO;
+    }
+
+    return ret;
 }
 
 PushThreadData* MountCurlDevice::CreatePushData(CURL* curl, const std::string& url, size_t offset) {
@@ -1346,8 +1402,8 @@ PushThreadData* MountCurlDevice::CreatePushData(CURL* curl, const std::string& u
     return data;
 }
 
-PullThreadData* MountCurlDevice::CreatePullData(CURL* curl, const std::string& url, bool append) {
-    auto data = new PullThreadData{curl};
+PullThreadData* MountCurlDevice::CreatePullData(CURL* curl, const std::string& url, bool append, size_t max_buffer_size) {
+    auto data = new PullThreadData{curl, max_buffer_size};
     if (!data) {
         log_write("[PUSH:PULL] Failed to allocate PullThreadData\n");
         return nullptr;
@@ -1372,6 +1428,16 @@ PullThreadData* MountCurlDevice::CreatePullData(CURL* curl, const std::string& u
     return data;
 }
 
+WriteBackData* MountCurlDevice::CreateWriteBackData(CURL* curl, const std::string& url, bool append) {
+    // room for the chunk being uploaded and the next one being handed off.
+    auto data = CreatePullData(curl, url, append, WriteBackData::CHUNK_SIZE * 2);
+    if (!data) {
+        return nullptr;
+    }
+
+    return new WriteBackData{data};
+}
+
 void MountCurlDevice::curl_set_common_options(CURL* curl, const std::string& url) {
     // NOTE: port, user and pass are set in the curl_url.
     curl_easy_reset(curl);
@@ -1394,9 +1460,8 @@ void MountCurlDevice::curl_set_common_options(CURL* curl, const std::string& url
         curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, config.timeout);
     }
 
-    if (m_curl_share) {
-        curl_easy_setopt(curl, CURLOPT_SHARE, m_curl_share);
-    }
+    // shares the connection cache, tls sessions and dns with every other handle.
+    curl_easy_setopt(curl, CURLOPT_SHARE, curl::GetShareHandle());
 }
 
 size_t MountCurlDevice::write_memory_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
@@ -1538,6 +1603,163 @@ std::string MountCurlDevice::build_url(const std::string& _path, bool is_dir) {
     return encoded_url;
 }
 
+ssize_t MountCurlDevice::ParallelRangeRead(RangeReadBuffer& buf, const std::string& url, char* ptr, u64 off, size_t len, u64 file_size) {
+    size_t amount = 0;
+
+    while (amount < len && off < file_size) {
+        // serve what we can from the read-ahead buffer.
+        if (buf.size && off >= buf.off && off < buf.off + buf.size) {
+            const auto rsize = std::min<u64>(len - amount, buf.off + buf.size - off);
+            std::memcpy(ptr + amount, buf.data.data() + (off - buf.off), rsize);
+            amount += rsize;
+            off += rsize;
+            continue;
+        }
+
+        // sequential (or large) reads fill the whole window using every connection.
+        // random reads only fetch what was requested on a single connection, as
+        // fetching a large window for a small read would destroy random access.
+        const auto sequential = (buf.size && off == buf.off + buf.size) || len - amount >= RANGE_SEGMENT_SIZE;
+        const auto connections = sequential ? m_range_connections : 1;
+        const auto window = sequential ? RANGE_SEGMENT_SIZE * connections : std::max<u64>(len - amount, RANGE_MIN_SIZE);
+        const auto fetch_size = std::min<u64>(window, file_size - off);
+
+        if (buf.data.size() < fetch_size) {
+            buf.data.resize(fetch_size);
+        }
+
+        buf.size = 0;
+        const auto ret = FetchRanges(url, buf.data.data(), off, fetch_size, connections);
+        if (ret < 0) {
+            return amount ? amount : ret;
+        }
+
+        if (!ret) {
+            break;
+        }
+
+        buf.off = off;
+        buf.size = ret;
+    }
+
+    return amount;
+}
+
+ssize_t MountCurlDevice::FetchRanges(const std::string& url, char* dst, u64 off, u64 size, size_t connections) {
+    struct Segment {
+        CURL* curl{};
+        std::span<char> data{};
+        u64 off{};
+        CURLcode result{};
+        bool done{};
+    };
+
+    if (!size) {
+        return 0;
+    }
+
+    if (!m_range_multi) {
+        m_range_multi = curl_multi_init();
+        if (!m_range_multi) {
+            log_write("[CURL] curl_multi_init() failed\n");
+            return -EIO;
+        }
+    }
+
+    // don't split into ranges smaller than the min size, the overhead isn't worth it.
+    connections = std::min<u64>(connections, std::max<u64>(1, size / RANGE_MIN_SIZE));
+    connections = std::clamp<size_t>(connections, 1, RANGE_MAX_CONNECTIONS);
+
+    while (m_range_curls.size() < connections) {
+        auto range_curl = curl::PoolAcquire(m_pool_url);
+        if (!range_curl) {
+            log_write("[CURL] range curl_easy_init() failed\n");
+            return -EIO;
+        }
+
+        m_range_curls.emplace_back(range_curl);
+    }
+
+    const auto segment_size = (size + connections - 1) / connections;
+    Segment segments[RANGE_MAX_CONNECTIONS]{};
+    size_t count = 0;
+
+    for (u64 seg_off = 0; seg_off < size; seg_off += segment_size, count++) {
+        auto& e = segments[count];
+        e.curl = m_range_curls[count];
+        e.data = std::span{dst + seg_off, std::min<u64>(segment_size, size - seg_off)};
+        e.off = off + seg_off;
+
+        char range[64];
+        std::snprintf(range, sizeof(range), "%lu-%lu", e.off, e.off + e.data.size() - 1);
+
+        curl_set_common_options(e.curl, url);
+        curl_easy_setopt(e.curl, CURLOPT_NOPROGRESS, 1L);
+        curl_easy_setopt(e.curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        // ranges apply to the encoded data, so compression must be disabled.
+        curl_easy_setopt(e.curl, CURLOPT_ACCEPT_ENCODING, nullptr);
+        curl_easy_setopt(e.curl, CURLOPT_RANGE, range);
+        curl_easy_setopt(e.curl, CURLOPT_WRITEFUNCTION, write_data_callback);
+        curl_easy_setopt(e.curl, CURLOPT_WRITEDATA, (void *)&e.data);
+        curl_multi_add_handle(m_range_multi, e.curl);
+    }
+
+    int running = 0;
+    do {
+        const auto mc = curl_multi_perform(m_range_multi, &running);
+        if (mc != CURLM_OK) {
+            log_write("[CURL] curl_multi_perform() failed: %s\n", curl_multi_strerror(mc));
+            break;
+        }
+
+        if (running) {
+            curl_multi_wait(m_range_multi, nullptr, 0, 1000, nullptr);
+        }
+    } while (running);
+
+    CURLMsg* msg;
+    int msgs_left;
+    while ((msg = curl_multi_info_read(m_range_multi, &msgs_left))) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (segments[i].curl == msg->easy_handle) {
+                segments[i].result = msg->data.result;
+                segments[i].done = true;
+            }
+        }
+    }
+
+    bool failed = false;
+    for (size_t i = 0; i < count; i++) {
+        auto& e = segments[i];
+        curl_multi_remove_handle(m_range_multi, e.curl);
+
+        long response_code = 0;
+        curl_easy_getinfo(e.curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+        if (!e.done || e.result != CURLE_OK) {
+            log_write("[CURL] range %lu failed: %s\n", e.off, curl_easy_strerror(e.result));
+            failed = true;
+        } else if (!e.data.empty()) {
+            log_write("[CURL] range %lu short read, %zu bytes missing\n", e.off, e.data.size());
+            failed = true;
+        } else if (response_code == 200 && e.off && url.starts_with("http")) {
+            // server ignored the range and sent the file from the start.
+            log_write("[CURL] range %lu ignored by server\n", e.off);
+            failed = true;
+        }
+    }
+
+    if (failed) {
+        return -EIO;
+    }
+
+    return size;
+}
+
 } // sphaira::devoptab::common
 
 namespace sphaira::devoptab {
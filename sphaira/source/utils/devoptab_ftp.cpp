@@ -11,6 +11,8 @@
 #include <vector>
 #include <memory>
 #include <cstring>
+#include <cctype>
+#include <strings.h>
 #include <optional>
 #include <ctime>
 #include <ranges>
@@ -27,6 +29,7 @@ using DirEntries = std::vector<DirEntry>;
 
 struct FileEntry {
     std::string path{};
+    std::string url{};
     struct stat st{};
 };
 
@@ -69,11 +72,15 @@ private:
 
 private:
     bool mounted{};
+    // set if the server supports REST, needed for parallel ranged reads.
+    bool rest_support{};
 };
 
 struct File {
     FileEntry* entry;
     common::PushPullThreadData* push_pull_thread_data;
+    common::WriteBackData* write_back;
+    common::RangeReadBuffer* range_buffer;
     size_t off;
     size_t last_off;
     bool write_mode;
@@ -436,6 +443,31 @@ bool Device::Mount() {
         return false;
     }
 
+    // REST is needed to start a download at an offset, which is how
+    // reads are split over multiple data connections.
+    // NOTE: RFC 3659 states that REST STREAM must be listed in FEAT.
+    // each feature is on its own line, so only a line of "REST STREAM" counts.
+    rest_support = false;
+    for (size_t pos = 0; pos < view.size() && !rest_support;) {
+        auto end = view.find('\n', pos);
+        if (end == std::string_view::npos) {
+            end = view.size();
+        }
+
+        auto line = view.substr(pos, end - pos);
+        pos = end + 1;
+
+        while (!line.empty() && std::isspace((unsigned char)line.front())) {
+            line.remove_prefix(1);
+        }
+        while (!line.empty() && std::isspace((unsigned char)line.back())) {
+            line.remove_suffix(1);
+        }
+
+        rest_support = line.size() == std::strlen("REST STREAM") && !strncasecmp(line.data(), "REST STREAM", line.size());
+    }
+    log_write("[FTP] Server REST support: %s\n", rest_support ? "yes" : "no");
+
     // if we support UTF8, enable it.
     if (view.find("UTF8") != std::string_view::npos) {
         // it doesn't matter if this fails tbh.
@@ -463,7 +495,7 @@ int Device::devoptab_open(void *fileStruct, const char *path, int flags, int mod
         }
     }
 
-    file->entry = new FileEntry{path, st};
+    file->entry = new FileEntry{path, build_url(path, false), st};
     file->write_mode = (flags & (O_WRONLY | O_RDWR));
     file->append_mode = (flags & O_APPEND);
 
@@ -478,9 +510,17 @@ int Device::devoptab_open(void *fileStruct, const char *path, int flags, int mod
 int Device::devoptab_close(void *fd) {
     auto file = static_cast<File*>(fd);
 
+    // any pending data is uploaded here, so report if that failed.
+    int ret = 0;
+    if (file->write_back) {
+        ret = file->write_back->Close();
+        delete file->write_back;
+    }
+
     delete file->push_pull_thread_data;
+    delete file->range_buffer;
     delete file->entry;
-    return 0;
+    return ret;
 }
 
 ssize_t Device::devoptab_read(void *fd, char *ptr, size_t len) {
@@ -496,6 +536,20 @@ ssize_t Device::devoptab_read(void *fd, char *ptr, size_t len) {
         return 0;
     }
 
+    if (rest_support) {
+        if (!file->range_buffer) {
+            file->range_buffer = new common::RangeReadBuffer();
+        }
+
+        const auto ret = ParallelRangeRead(*file->range_buffer, file->entry->url, ptr, file->off, len, file->entry->st.st_size);
+        if (ret > 0) {
+            file->off += ret;
+            file->last_off = file->off;
+        }
+
+        return ret;
+    }
+
     if (file->off != file->last_off) {
         log_write("[FTP] File offset changed from %zu to %zu, resetting download thread\n", file->last_off, file->off);
         file->last_off = file->off;
@@ -505,7 +559,7 @@ ssize_t Device::devoptab_read(void *fd, char *ptr, size_t len) {
 
     if (!file->push_pull_thread_data) {
         log_write("[FTP] Creating download thread data for file: %s\n", file->entry->path.c_str());
-        file->push_pull_thread_data = CreatePushData(this->transfer_curl, build_url(file->entry->path, false), file->off);
+        file->push_pull_thread_data = CreatePushData(this->transfer_curl, file->entry->url, file->off);
         if (!file->push_pull_thread_data) {
             log_write("[FTP] Failed to create download thread data for file: %s\n", file->entry->path.c_str());
             return -EIO;
@@ -531,16 +585,19 @@ ssize_t Device::devoptab_write(void *fd, const char *ptr, size_t len) {
         return 0;
     }
 
-    if (!file->push_pull_thread_data) {
+    if (!file->write_back) {
         log_write("[FTP] Creating upload thread data for file: %s\n", file->entry->path.c_str());
-        file->push_pull_thread_data = CreatePullData(this->transfer_curl, build_url(file->entry->path, false), file->append_mode);
-        if (!file->push_pull_thread_data) {
+        file->write_back = CreateWriteBackData(this->transfer_curl, file->entry->url, file->append_mode);
+        if (!file->write_back) {
             log_write("[FTP] Failed to create upload thread data for file: %s\n", file->entry->path.c_str());
             return -EIO;
         }
     }
 
-    const auto ret = file->push_pull_thread_data->PushData(ptr, len);
+    const auto ret = file->write_back->Write(ptr, len);
+    if (ret < 0) {
+        return ret;
+    }
 
     file->off += ret;
     file->entry->st.st_size = std::max<off_t>(file->entry->st.st_size, file->off);
@@ -700,7 +757,11 @@ int Device::devoptab_fsync(void *fd) {
         return -EBADF;
     }
 
-    return 0;
+    if (!file->write_back) {
+        return 0;
+    }
+
+    return file->write_back->Flush();
 }
 
 } // namespace
@@ -30,16 +30,24 @@ using DirEntries = std::vector<DirEntry>;
 
 struct FileEntry {
     std::string path{};
+    std::string url{};
     struct stat st{};
 };
 
 struct File {
     FileEntry* entry;
     common::PushPullThreadData* push_pull_thread_data;
+    common::RangeReadBuffer* range_buffer;
     size_t off;
     size_t last_off;
 };
 
+enum class RangeSupport {
+    Unknown,
+    Yes,
+    No,
+};
+
 struct Dir {
     DirEntries* entries;
     size_t index;
@@ -63,9 +71,12 @@ private:
 
     int http_dirlist(const std::string& path, DirEntries& out);
     int http_stat(const std::string& path, struct stat* st, bool is_dir);
+    bool http_probe_ranges(const std::string& url);
 
 private:
     bool mounted{};
+    // probed once per server on the first file open.
+    RangeSupport range_support{};
 };
 
 int Device::http_dirlist(const std::string& path, DirEntries& out) {
@@ -268,6 +279,33 @@ int Device::http_stat(const std::string& path, struct stat* st, bool is_dir) {
     return 0;
 }
 
+// requests the first byte of the file, a server that supports ranges will reply
+// with 206, otherwise it'll attempt to send the entire file, which is aborted.
+// this is used rather than OPTIONS as many servers don't report Accept-Ranges.
+bool Device::http_probe_ranges(const std::string& url) {
+    char byte;
+    std::span<char> data{&byte, 1};
+
+    curl_set_common_options(this->curl, url);
+    curl_easy_setopt(this->curl, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(this->curl, CURLOPT_ACCEPT_ENCODING, nullptr);
+    curl_easy_setopt(this->curl, CURLOPT_RANGE, "0-0");
+    curl_easy_setopt(this->curl, CURLOPT_WRITEFUNCTION, write_data_callback);
+    curl_easy_setopt(this->curl, CURLOPT_WRITEDATA, (void *)&data);
+
+    const auto res = curl_easy_perform(this->curl);
+    if (res != CURLE_OK) {
+        log_write("[HTTP] range probe failed: %s\n", curl_easy_strerror(res));
+        return false;
+    }
+
+    long response_code = 0;
+    curl_easy_getinfo(this->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    log_write("[HTTP] range probe response code: %ld\n", response_code);
+
+    return response_code == 206;
+}
+
 bool Device::Mount() {
     if (mounted) {
         return true;
@@ -277,9 +315,7 @@ bool Device::Mount() {
         return false;
     }
 
-    // todo: query server with OPTIONS to see if it supports range requests.
-    // todo: see ftp for example.
-
+    // NOTE: range support is probed on the first file open as it needs a file url.
     return mounted = true;
 }
 
@@ -298,7 +334,13 @@ int Device::devoptab_open(void *fileStruct, const char *path, int flags, int mod
         return -EISDIR;
     }
 
-    file->entry = new FileEntry{path, st};
+    file->entry = new FileEntry{path, build_url(path, false), st};
+
+    if (range_support == RangeSupport::Unknown && st.st_size > 1) {
+        range_support = http_probe_ranges(file->entry->url) ? RangeSupport::Yes : RangeSupport::No;
+        log_write("[HTTP] Server range support: %s\n", range_support == RangeSupport::Yes ? "yes" : "no");
+    }
+
     return 0;
 }
 
@@ -306,6 +348,7 @@ int Device::devoptab_close(void *fd) {
     auto file = static_cast<File*>(fd);
 
     delete file->push_pull_thread_data;
+    delete file->range_buffer;
     delete file->entry;
     return 0;
 }
@@ -318,6 +361,20 @@ ssize_t Device::devoptab_read(void *fd, char *ptr, size_t len) {
         return 0;
     }
 
+    if (range_support == RangeSupport::Yes) {
+        if (!file->range_buffer) {
+            file->range_buffer = new common::RangeReadBuffer();
+        }
+
+        const auto ret = ParallelRangeRead(*file->range_buffer, file->entry->url, ptr, file->off, len, file->entry->st.st_size);
+        if (ret > 0) {
+            file->off += ret;
+            file->last_off = file->off;
+        }
+
+        return ret;
+    }
+
     if (file->off != file->last_off) {
         log_write("[HTTP] File offset changed from %zu to %zu, resetting download thread\n", file->last_off, file->off);
         file->last_off = file->off;
@@ -327,7 +384,7 @@ ssize_t Device::devoptab_read(void *fd, char *ptr, size_t len) {
 
     if (!file->push_pull_thread_data) {
         log_write("[HTTP] Creating download thread data for file: %s\n", file->entry->path.c_str());
-        file->push_pull_thread_data = CreatePushData(this->transfer_curl, build_url(file->entry->path, false), file->off);
+        file->push_pull_thread_data = CreatePushData(this->transfer_curl, file->entry->url, file->off);
         if (!file->push_pull_thread_data) {
             log_write("[HTTP] Failed to create download thread data for file: %s\n", file->entry->path.c_str());
             return -EIO;
@@ -9,6 +9,13 @@
 // it would read the first 4mb, then read another 1kb.
 // disabling buffering fixed the issue, and i have disabled buffering by default.
 // buffering is now enabled only when requested.
+
+// NOTE: libssh2 only pipelines FXP_READ requests up to 4x the size passed to
+// libssh2_sftp_read(), so small reads would stall on a round trip each time.
+// reads are now always made in large windows sized to the channel, which keeps
+// enough requests in flight to saturate the link.
+// zlib compression is also disabled by default, as it was where most of the
+// cpu time went when transferring (already compressed) game files.
 #include "utils/devoptab_common.hpp"
 #include "utils/profile.hpp"
 #include "defines.hpp"
@@ -22,6 +29,7 @@
 
 #include <libssh2.h>
 #include <libssh2_sftp.h>
+#include <minIni.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
@@ -30,6 +38,16 @@
 namespace sphaira::devoptab {
 namespace {
 
+// size of each read made to libssh2, which will have up to 4x this in flight.
+// matches the default channel window so that the window never stalls requests.
+constexpr u64 READ_AHEAD_SIZE = LIBSSH2_CHANNEL_WINDOW_DEFAULT;
+
+// ciphers in order of preference, cheapest to compute first.
+// libssh2 drops any that the crypto backend does not support.
+constexpr const char* CIPHER_PREFS =
+    "aes128-gcm@openssh.com,aes256-gcm@openssh.com,chacha20-poly1305@openssh.com,"
+    "aes128-ctr,aes192-ctr,aes256-ctr";
+
 struct Device final : common::MountDevice {
     using MountDevice::MountDevice;
     ~Device();
@@ -67,6 +85,9 @@ private:
 
 struct File {
     LIBSSH2_SFTP_HANDLE* fd{};
+    common::RangeReadBuffer* read_buffer{};
+    u64 off{}; // offset of the file as seen by the caller.
+    u64 fd_off{}; // offset of the handle, ahead of off when reading ahead.
 };
 
 struct Dir {
@@ -246,7 +267,18 @@ bool Device::Mount() {
         }
 
         libssh2_session_set_blocking(m_session, 1);
-        libssh2_session_flag(m_session, LIBSSH2_FLAG_COMPRESS, 1);
+
+        const auto compress = this->config.extra.find("compress");
+        if (compress != this->config.extra.end() && ini_parse_getbool(compress->second.c_str(), false)) {
+            log_write("[SFTP] Enabling compression\n");
+            libssh2_session_flag(m_session, LIBSSH2_FLAG_COMPRESS, 1);
+        }
+
+        // not fatal, the server may still agree on one of the defaults.
+        if (libssh2_session_method_pref(m_session, LIBSSH2_METHOD_CRYPT_CS, CIPHER_PREFS) ||
+            libssh2_session_method_pref(m_session, LIBSSH2_METHOD_CRYPT_SC, CIPHER_PREFS)) {
+            log_write("[SFTP] Failed to set cipher preference\n");
+        }
 
         if (this->config.timeout > 0) {
             libssh2_session_set_timeout(m_session, this->config.timeout);
@@ -270,6 +302,7 @@ bool Device::Mount() {
         }
 
         m_is_handshake_done = true;
+        log_write("[SFTP] Using cipher: %s\n", libssh2_session_methods(m_session, LIBSSH2_METHOD_CRYPT_SC));
     }
 
     if (!m_is_auth_done) {
@@ -315,6 +348,15 @@ int Device::devoptab_open(void *fileStruct, const char *path, int flags, int mod
         return -EIO;
     }
 
+    // the handle starts at the end of the file when appending.
+    if (flags & O_APPEND) {
+        LIBSSH2_SFTP_ATTRIBUTES attrs{};
+        if (!libssh2_sftp_fstat(file->fd, &attrs) && (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE)) {
+            file->off = file->fd_off = attrs.filesize;
+            libssh2_sftp_seek64(file->fd, file->fd_off);
+        }
+    }
+
     return 0;
 }
 
@@ -322,6 +364,7 @@ int Device::devoptab_close(void *fd) {
     auto file = static_cast<File*>(fd);
 
     libssh2_sftp_close(file->fd);
+    delete file->read_buffer;
     return 0;
 }
 
@@ -335,30 +378,78 @@ ssize_t Device::devoptab_read(void *fd, char *ptr, size_t len) {
     SCOPED_TIMESTAMP(name);
     #endif
 
-    const auto ret = libssh2_sftp_read(file->fd, ptr, len);
-    if (ret < 0) {
-        log_write("[SFTP] libssh2_sftp_read() failed: %ld\n", libssh2_sftp_last_error(m_sftp_session));
-        return -EIO;
+    if (!file->read_buffer) {
+        file->read_buffer = new common::RangeReadBuffer();
+        file->read_buffer->data.resize(READ_AHEAD_SIZE);
     }
 
-    return ret;
+    auto& buf = *file->read_buffer;
+    size_t amount = 0;
+
+    while (amount < len) {
+        // serve what we can from the read-ahead buffer.
+        if (buf.size && file->off >= buf.off && file->off < buf.off + buf.size) {
+            const auto rsize = std::min<u64>(len - amount, buf.off + buf.size - file->off);
+            std::memcpy(ptr + amount, buf.data.data() + (file->off - buf.off), rsize);
+            amount += rsize;
+            file->off += rsize;
+            continue;
+        }
+
+        // seeking discards any requests in flight, so only do so if needed.
+        if (file->fd_off != file->off) {
+            log_write("[SFTP] Seeking to %lu old: %lu\n", file->off, file->fd_off);
+            libssh2_sftp_seek64(file->fd, file->off);
+            file->fd_off = file->off;
+        }
+
+        const auto ret = libssh2_sftp_read(file->fd, buf.data.data(), buf.data.size());
+        if (ret < 0) {
+            log_write("[SFTP] libssh2_sftp_read() failed: %ld\n", libssh2_sftp_last_error(m_sftp_session));
+            buf.size = 0;
+            return amount ? amount : -EIO;
+        }
+
+        buf.off = file->fd_off;
+        buf.size = ret;
+        file->fd_off += ret;
+
+        // eof.
+        if (!ret) {
+            break;
+        }
+    }
+
+    return amount;
 }
 
 ssize_t Device::devoptab_write(void *fd, const char *ptr, size_t len) {
     auto file = static_cast<File*>(fd);
 
+    // any buffered data is now stale.
+    if (file->read_buffer) {
+        file->read_buffer->size = 0;
+    }
+
+    if (file->fd_off != file->off) {
+        libssh2_sftp_seek64(file->fd, file->off);
+        file->fd_off = file->off;
+    }
+
     const auto ret = libssh2_sftp_write(file->fd, ptr, len);
     if (ret < 0) {
         log_write("[SFTP] libssh2_sftp_write() failed: %ld\n", libssh2_sftp_last_error(m_sftp_session));
         return -EIO;
     }
 
+    file->off += ret;
+    file->fd_off += ret;
     return ret;
 }
 
 ssize_t Device::devoptab_seek(void *fd, off_t pos, int dir) {
     auto file = static_cast<File*>(fd);
-    const auto current_pos = libssh2_sftp_tell64(file->fd);
+    const auto current_pos = file->off;
 
     if (dir == SEEK_CUR) {
         pos += current_pos;
@@ -372,14 +463,9 @@ ssize_t Device::devoptab_seek(void *fd, off_t pos, int dir) {
         }
     }
 
-    // libssh2 already does this internally, but handle just in case this changes.
-    if (pos == current_pos) {
-        return pos;
-    }
-
-    log_write("[SFTP] Seeking to %ld dir: %d old: %llu\n", pos, dir, current_pos);
-    libssh2_sftp_seek64(file->fd, pos);
-    return libssh2_sftp_tell64(file->fd);
+    // the handle is only seeked on the next read / write, as seeking discards
+    // the read-ahead, which may still contain the new position.
+    return file->off = pos;
 }
 
 int Device::devoptab_fstat(void *fd, struct stat *st) {
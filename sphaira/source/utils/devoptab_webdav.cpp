@@ -40,6 +40,7 @@ struct FileEntry {
 struct File {
     FileEntry* entry;
     common::PushPullThreadData* push_pull_thread_data;
+    common::WriteBackData* write_back;
     size_t off;
     size_t last_off;
     bool write_mode;
@@ -415,9 +416,16 @@ int Device::devoptab_close(void *fd) {
     auto file = static_cast<File*>(fd);
 
     log_write("[WEBDAV] Closing file: %s\n", file->entry->path.c_str());
+    // any pending data is uploaded here, so report if that failed.
+    int ret = 0;
+    if (file->write_back) {
+        ret = file->write_back->Close();
+        delete file->write_back;
+    }
+
     delete file->push_pull_thread_data;
     delete file->entry;
-    return 0;
+    return ret;
 }
 
 ssize_t Device::devoptab_read(void *fd, char *ptr, size_t len) {
@@ -468,16 +476,19 @@ ssize_t Device::devoptab_write(void *fd, const char *ptr, size_t len) {
         return 0;
     }
 
-    if (!file->push_pull_thread_data) {
+    if (!file->write_back) {
         log_write("[WEBDAV] Creating upload thread data for file: %s\n", file->entry->path.c_str());
-        file->push_pull_thread_data = CreatePullData(this->transfer_curl, build_url(file->entry->path, false));
-        if (!file->push_pull_thread_data) {
+        file->write_back = CreateWriteBackData(this->transfer_curl, build_url(file->entry->path, false));
+        if (!file->write_back) {
             log_write("[WEBDAV] Failed to create upload thread data for file: %s\n", file->entry->path.c_str());
             return -EIO;
         }
     }
 
-    const auto ret = file->push_pull_thread_data->PushData(ptr, len);
+    const auto ret = file->write_back->Write(ptr, len);
+    if (ret < 0) {
+        return ret;
+    }
 
     file->off += ret;
     file->entry->st.st_size = std::max<off_t>(file->entry->st.st_size, file->off);
@@ -637,7 +648,11 @@ int Device::devoptab_fsync(void *fd) {
         return -EBADF;
     }
 
-    return 0;
+    if (!file->write_back) {
+        return 0;
+    }
+
+    return file->write_back->Flush();
 }
 
 } // namespace
@@ -0,0 +1,166 @@
+#include "utils/search_index.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+
+namespace sphaira::utils {
+namespace {
+
+auto ToLower(std::string_view str) -> std::string {
+    std::string out(str);
+    for (auto& c : out) {
+        c = std::tolower((unsigned char)c);
+    }
+    return out;
+}
+
+auto MakeTrigram(const char* str) -> u32 {
+    return (u32)(u8)str[0] << 16 | (u32)(u8)str[1] << 8 | (u32)(u8)str[2];
+}
+
+void SetBit(SearchIndex::Bitmap& bitmap, u32 id) {
+    const auto word = id / 64;
+    if (bitmap.size() <= word) {
+        bitmap.resize(word + 1);
+    }
+    bitmap[word] |= 1ULL << (id % 64);
+}
+
+} // namespace
+
+void SearchIndex::Clear() {
+    m_text.clear();
+    m_fields.clear();
+    m_id_fields.clear();
+    m_trigrams.clear();
+    m_count = 0;
+    m_last_term.clear();
+    m_last_matches.clear();
+}
+
+void SearchIndex::Add(u32 id, u32 field, std::string_view text) {
+    // ids without any fields still need an entry.
+    while (m_count <= id) {
+        m_id_fields.emplace_back(m_fields.size());
+        m_count++;
+    }
+
+    const auto lower = ToLower(text);
+    m_fields.emplace_back(id, field, (u32)m_text.size(), (u32)lower.size());
+    m_text += lower;
+
+    for (size_t i = 0; i + 3 <= lower.size(); i++) {
+        SetBit(m_trigrams[MakeTrigram(lower.data() + i)], id);
+    }
+
+    // the index changed, so the last result can't be reused.
+    m_last_term.clear();
+    m_last_matches.clear();
+}
+
+auto SearchIndex::Search(std::string_view _term, u32 field_mask) -> std::vector<u32> {
+    const auto term = ToLower(_term);
+    if (term.empty()) {
+        return {};
+    }
+
+    // if the term extends the last term, then only the last matches can match.
+    Bitmap candidates;
+    if (!m_last_term.empty() && m_last_field_mask == field_mask && term.find(m_last_term) != std::string::npos) {
+        candidates = m_last_matches;
+    } else {
+        candidates = AllSet();
+    }
+
+    for (size_t i = 0; i + 3 <= term.size() && !candidates.empty(); i++) {
+        const auto it = m_trigrams.find(MakeTrigram(term.data() + i));
+        if (it == m_trigrams.end()) {
+            candidates.clear();
+            break;
+        }
+
+        const auto& bitmap = it->second;
+        candidates.resize(std::min(candidates.size(), bitmap.size()));
+        for (size_t j = 0; j < candidates.size(); j++) {
+            candidates[j] &= bitmap[j];
+        }
+    }
+
+    struct Result {
+        u32 id;
+        u32 field;
+        bool prefix;
+    };
+
+    std::vector<Result> results;
+    Bitmap matches;
+
+    // the trigrams may appear out of order or in different fields, so verify each candidate.
+    for (size_t i = 0; i < candidates.size(); i++) {
+        for (auto word = candidates[i]; word; word &= word - 1) {
+            const auto id = (u32)(i * 64 + std::countr_zero(word));
+
+            u32 field;
+            const auto pos = Match(id, term, field_mask, field);
+            if (pos != std::string::npos) {
+                results.emplace_back(id, field, pos == 0);
+                SetBit(matches, id);
+            }
+        }
+    }
+
+    m_last_term = term;
+    m_last_matches = std::move(matches);
+    m_last_field_mask = field_mask;
+
+    std::ranges::stable_sort(results, [](const Result& a, const Result& b) {
+        if (a.field != b.field) {
+            return a.field < b.field;
+        }
+        return a.prefix > b.prefix;
+    });
+
+    std::vector<u32> out;
+    out.reserve(results.size());
+    for (const auto& e : results) {
+        out.emplace_back(e.id);
+    }
+
+    return out;
+}
+
+auto SearchIndex::AllSet() const -> Bitmap {
+    Bitmap bitmap((m_count + 63) / 64, ~0ULL);
+    if (m_count % 64) {
+        bitmap.back() = (1ULL << (m_count % 64)) - 1;
+    }
+    return bitmap;
+}
+
+auto SearchIndex::Match(u32 id, std::string_view term, u32 field_mask, u32& field) const -> size_t {
+    const auto start = m_id_fields[id];
+    const auto end = id + 1 < m_count ? m_id_fields[id + 1] : m_fields.size();
+
+    auto best = std::string_view::npos;
+    for (auto i = start; i < end; i++) {
+        const auto& e = m_fields[i];
+        if (e.field >= 32 || !(field_mask & (1U << e.field))) {
+            continue;
+        }
+
+        const auto pos = std::string_view{m_text}.substr(e.off, e.len).find(term);
+        if (pos == std::string_view::npos) {
+            continue;
+        }
+
+        if (best == std::string_view::npos || e.field < field || (e.field == field && pos < best)) {
+            best = pos;
+            field = e.field;
+        }
+    }
+
+    return best;
+}
+
+} // namespace sphaira::utils
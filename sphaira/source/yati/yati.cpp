@@ -17,6 +17,7 @@
 
 #include "ui/progress_box.hpp"
 #include "ui/menus/game_menu.hpp"
+#include "title_info.hpp"
 
 #include "app.hpp"
 #include "i18n.hpp"
@@ -1254,6 +1255,7 @@ Result Yati::ImportTickets(std::span<TikCollection> tickets) {
 
 Result Yati::RemoveInstalledNcas(const CnmtCollection& cnmt) {
     const auto app_id = ncm::GetAppId(cnmt.key);
+    ON_SCOPE_EXIT(title::InvalidateMetaEntries(app_id));
 
     // remove current entries (if any).
     s32 db_list_total;
@@ -1362,6 +1364,8 @@ Result Yati::RegisterNcasAndPushRecord(const CnmtCollection& cnmt, u32 latest_ve
     pbox->NewTransfer("Pushing application record"_i18n);
 
     R_TRY(ns::PushApplicationRecord(app_id, std::addressof(content_storage_record), 1));
+    title::InvalidateMetaEntries(app_id);
+
     if (hosversionAtLeast(6,0,0)) {
         R_TRY(avmInitialize());
         ON_SCOPE_EXIT(avmExit());